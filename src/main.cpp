@@ -2,13 +2,85 @@
 
 import hello;
 import nr.rhi;
+import nr.shader;
+import nr.utils;
 import std;
 
-int main()
+int main(int argc, char **argv)
 {
     using namespace std;
+    const auto args = span(argv, static_cast<size_t>(argc)) | views::transform([](const char *arg) { return string_view(arg); }) | ranges::to<vector>();
     // hello::helloSlang();
-    nr::rhi::rhiTest();
+    // "--name=<count>"; a malformed count leaves `value` at its default
+    auto parseCount = [](string_view arg, uint32_t &value) {
+        const string_view text = arg.substr(arg.find('=') + 1);
+        uint32_t parsed = 0;
+        const auto [ptr, ec] = from_chars(text.data(), text.data() + text.size(), parsed);
+        if (ec != errc{} || ptr != text.data() + text.size())
+        {
+            nr::nrInfo(nr::LogLevel::warning)("Ignoring '{}': '{}' is not a valid count, keeping {}.", arg, text, value);
+            return;
+        }
+        value = parsed;
+    };
+    uint32_t framesInFlight = 2;
+    if (auto it = ranges::find_if(args, [](string_view arg) { return arg.starts_with("--frames-in-flight="); }); it != args.end())
+    {
+        parseCount(*it, framesInFlight);
+    }
+    if (auto it = ranges::find_if(args, [](string_view arg) { return arg.starts_with("--log-file="); }); it != args.end())
+    {
+        nr::addLogSink(make_unique<nr::RotatingFileSink>(filesystem::path(it->substr(it->find('=') + 1))));
+    }
+    if (ranges::contains(args, "--quiet"))
+    {
+        nr::setLogLevel(nr::LogLevel::warning);
+    }
+    nr::JobSystemOptions jobOptions;
+    if (auto it = ranges::find_if(args, [](string_view arg) { return arg.starts_with("--job-workers="); }); it != args.end())
+    {
+        parseCount(*it, jobOptions.workerCount);
+    }
+    jobOptions.pinWorkers = ranges::contains(args, "--pin-workers");
+    nr::JobSystem::configure(jobOptions);
+    if (ranges::contains(args, "--bench-math"))
+    {
+        nr::simdMathBenchmark();
+        return 0;
+    }
+    if (ranges::contains(args, "--bench-memory"))
+    {
+        nr::memoryBenchmark();
+        return 0;
+    }
+    if (auto it = ranges::find_if(args, [](string_view arg) { return arg.starts_with("--bench-shaders"); }); it != args.end())
+    {
+        const size_t eq = it->find('=');
+        nr::shader::shaderBenchmark(eq == string_view::npos ? filesystem::path("shaders") : filesystem::path(it->substr(eq + 1)));
+        return 0;
+    }
+    if (ranges::contains(args, "--bench-culling"))
+    {
+        nr::cullingBenchmark();
+        return 0;
+    }
+    if (ranges::contains(args, "--bench-trace"))
+    {
+        nr::traceBenchmark();
+        return 0;
+    }
+    // CPU zones from every thread and the resolved GPU zones, streamed into one trace while the app runs
+    optional<nr::TraceSession> trace;
+    if (auto it = ranges::find_if(args, [](string_view arg) { return arg.starts_with("--trace="); }); it != args.end())
+    {
+        trace.emplace(filesystem::path(it->substr(it->find('=') + 1)));
+    }
+    if (ranges::contains(args, "--bench-recording"))
+    {
+        nr::rhi::recordingBenchmark(ranges::contains(args, "--headless"));
+        return 0;
+    }
+    nr::rhi::rhiTest(ranges::contains(args, "--headless"), !ranges::contains(args, "--serial-init"), framesInFlight, ranges::contains(args, "--watch-shaders"));
     char p1[] = "abcdc";
     const char *p2 = "abcdc";
     print("{} {} {} {}", sizeof(p1), strlen(p1), sizeof(p2), strlen(p2));
@@ -0,0 +1,214 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+export module nr.rhi.descriptor;
+import nr.rhi.queue;
+import nr.utils;
+import std;
+
+export namespace nr::rhi
+{
+
+// binding index in the heap's set; shaders declare one unbounded array per binding
+enum class DescriptorKind : uint32_t
+{
+    sampledImage,
+    storageImage,
+    storageBuffer,
+    sampler,
+    size
+};
+
+// 32-bit slot index shaders use to address the resource in the array of its kind
+struct BindlessIndex
+{
+    static constexpr uint32_t invalid = ~0u;
+    DescriptorKind kind = DescriptorKind::sampledImage;
+    uint32_t index = invalid;
+    explicit operator bool() const
+    {
+        return index != invalid;
+    }
+};
+
+// One global update-after-bind descriptor set holding every sampled image, storage image, storage buffer and sampler.
+// It is bound once per command buffer together with pipelineLayout(); draws then select resources by pushing their
+// BindlessIndex values as push constants. Released slots are recycled only after the GPU has passed the last
+// submission that could read them, so a pending command buffer never sees a descriptor change under it.
+// Storage images and buffers are only in the heap when the device can update them after bind; otherwise their
+// capacity is 0. Images and buffers share the per-stage update-after-bind resource budget in proportion to the request.
+class BindlessHeap
+{
+  public:
+    static constexpr uint32_t kindCount = static_cast<uint32_t>(DescriptorKind::size);
+    static constexpr uint32_t pushConstantBytes = 128;
+    static constexpr std::array<vk::DescriptorType, kindCount> descriptorTypes{vk::DescriptorType::eSampledImage, vk::DescriptorType::eStorageImage, vk::DescriptorType::eStorageBuffer, vk::DescriptorType::eSampler};
+
+    // `enabledFeatures` are the Vulkan 1.2 features the device was created with
+    BindlessHeap(vk::raii::Device const &device, vk::raii::PhysicalDevice const &physicalDevice, vk::PhysicalDeviceVulkan12Features const &enabledFeatures,
+                 std::array<uint32_t, kindCount> requestedCapacity = {65536, 16384, 65536, 1024})
+        : device(&device)
+    {
+        auto props = physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceDescriptorIndexingProperties>();
+        auto const &limits = props.get<vk::PhysicalDeviceDescriptorIndexingProperties>();
+        const std::array<uint32_t, kindCount> deviceLimits{std::min(limits.maxDescriptorSetUpdateAfterBindSampledImages, limits.maxPerStageDescriptorUpdateAfterBindSampledImages),
+                                                           std::min(limits.maxDescriptorSetUpdateAfterBindStorageImages, limits.maxPerStageDescriptorUpdateAfterBindStorageImages),
+                                                           std::min(limits.maxDescriptorSetUpdateAfterBindStorageBuffers, limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers),
+                                                           std::min(limits.maxDescriptorSetUpdateAfterBindSamplers, limits.maxPerStageDescriptorUpdateAfterBindSamplers)};
+        const std::array<bool, kindCount> updateAfterBind{true, enabledFeatures.descriptorBindingStorageImageUpdateAfterBind == vk::True, enabledFeatures.descriptorBindingStorageBufferUpdateAfterBind == vk::True, true};
+        for (uint32_t k = 0; k < kindCount; ++k)
+        {
+            capacity[k] = updateAfterBind[k] ? std::min(requestedCapacity[k], deviceLimits[k]) : 0;
+            if (!updateAfterBind[k])
+                nrInfo(LogLevel::warning)("The device cannot update {} descriptors after bind; the bindless heap has none.", vk::to_string(descriptorTypes[k]));
+        }
+        // every binding is visible to every stage; samplers do not count against the per-stage resource limit
+        constexpr size_t samplerKind = static_cast<size_t>(DescriptorKind::sampler);
+        const uint64_t resourceBudget = limits.maxPerStageUpdateAfterBindResources;
+        uint64_t resourceTotal = 0;
+        for (size_t k = 0; k < kindCount; ++k)
+            resourceTotal += k == samplerKind ? 0 : capacity[k];
+        if (resourceTotal > resourceBudget)
+        {
+            for (size_t k = 0; k < kindCount; ++k)
+            {
+                if (k != samplerKind)
+                    capacity[k] = static_cast<uint32_t>(capacity[k] * resourceBudget / resourceTotal);
+            }
+        }
+
+        std::array<vk::DescriptorSetLayoutBinding, kindCount> bindings;
+        std::array<vk::DescriptorBindingFlags, kindCount> bindingFlags;
+        std::vector<vk::DescriptorPoolSize> poolSizes;
+        for (uint32_t k = 0; k < kindCount; ++k)
+        {
+            bindings[k] = vk::DescriptorSetLayoutBinding(k, descriptorTypes[k], capacity[k], vk::ShaderStageFlagBits::eAll);
+            bindingFlags[k] = vk::DescriptorBindingFlagBits::ePartiallyBound | vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending;
+            if (updateAfterBind[k])
+                bindingFlags[k] |= vk::DescriptorBindingFlagBits::eUpdateAfterBind;
+            // pool sizes must not be empty
+            if (capacity[k])
+                poolSizes.emplace_back(descriptorTypes[k], capacity[k]);
+            // hand out low indices first
+            freeSlots[k].resize(capacity[k]);
+            std::ranges::generate(freeSlots[k], [n = capacity[k]]() mutable { return --n; });
+        }
+
+        vk::StructureChain<vk::DescriptorSetLayoutCreateInfo, vk::DescriptorSetLayoutBindingFlagsCreateInfo> layoutCreateInfo({vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool, bindings}, {bindingFlags});
+        setLayout = vk::raii::DescriptorSetLayout(device, layoutCreateInfo.get<vk::DescriptorSetLayoutCreateInfo>());
+        pool = vk::raii::DescriptorPool(device, vk::DescriptorPoolCreateInfo(vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind | vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet, 1, poolSizes));
+        const vk::DescriptorSetLayout layoutHandle = *setLayout;
+        set = std::move(vk::raii::DescriptorSets(device, vk::DescriptorSetAllocateInfo(*pool, layoutHandle)).front());
+
+        const vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eAll, 0, pushConstantBytes);
+        pipelineLayoutHandle = vk::raii::PipelineLayout(device, vk::PipelineLayoutCreateInfo({}, layoutHandle, pushConstantRange));
+    }
+    BindlessHeap(const BindlessHeap &) = delete;
+    BindlessHeap &operator=(const BindlessHeap &) = delete;
+
+    [[nodiscard]] BindlessIndex registerSampledImage(vk::ImageView view, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal)
+    {
+        const vk::DescriptorImageInfo info({}, view, layout);
+        return write(DescriptorKind::sampledImage, &info, nullptr);
+    }
+    [[nodiscard]] BindlessIndex registerStorageImage(vk::ImageView view)
+    {
+        const vk::DescriptorImageInfo info({}, view, vk::ImageLayout::eGeneral);
+        return write(DescriptorKind::storageImage, &info, nullptr);
+    }
+    [[nodiscard]] BindlessIndex registerStorageBuffer(vk::Buffer buffer, vk::DeviceSize offset = 0, vk::DeviceSize range = vk::WholeSize)
+    {
+        const vk::DescriptorBufferInfo info(buffer, offset, range);
+        return write(DescriptorKind::storageBuffer, nullptr, &info);
+    }
+    [[nodiscard]] BindlessIndex registerSampler(vk::Sampler sampler)
+    {
+        const vk::DescriptorImageInfo info(sampler, {}, vk::ImageLayout::eUndefined);
+        return write(DescriptorKind::sampler, &info, nullptr);
+    }
+
+    // the slot becomes reusable once `lastUse` (the last submission that may read it) is reached
+    void release(BindlessIndex slot, SubmitPoint lastUse)
+    {
+        if (!slot)
+            return;
+        std::scoped_lock lock(mutex);
+        retired.push_back({slot, lastUse});
+    }
+
+    // move retired slots whose last use has completed back to the free lists; call once per frame
+    void recycle()
+    {
+        std::scoped_lock lock(mutex);
+        std::vector<std::pair<vk::Semaphore, std::uint64_t>> counters;
+        auto completedValue = [&](vk::Semaphore semaphore) {
+            auto it = std::ranges::find(counters, semaphore, &std::pair<vk::Semaphore, std::uint64_t>::first);
+            if (it == counters.end())
+                it = counters.insert(counters.end(), {semaphore, vk::Device(**device).getSemaphoreCounterValue(semaphore, *device->getDispatcher())});
+            return it->second;
+        };
+        std::erase_if(retired, [&](Retired const &r) {
+            if (r.lastUse && completedValue(r.lastUse.timeline) < r.lastUse.value)
+                return false;
+            freeSlots[static_cast<size_t>(r.slot.kind)].push_back(r.slot.index);
+            return true;
+        });
+    }
+
+    void bind(vk::raii::CommandBuffer const &cmd, vk::PipelineBindPoint bindPoint = vk::PipelineBindPoint::eGraphics) const
+    {
+        cmd.bindDescriptorSets(bindPoint, *pipelineLayoutHandle, 0, *set, {});
+    }
+
+    // per-draw resource selection: push the BindlessIndex values the shader expects
+    void pushIndices(vk::raii::CommandBuffer const &cmd, std::span<const uint32_t> indices, uint32_t offset = 0) const
+    {
+        nrAssert(offset + indices.size_bytes() <= pushConstantBytes)("{} bytes of bindless indices exceed the {} byte push constant block.", offset + indices.size_bytes(), pushConstantBytes);
+        cmd.pushConstants<uint32_t>(*pipelineLayoutHandle, vk::ShaderStageFlagBits::eAll, offset, indices);
+    }
+
+    [[nodiscard]] vk::PipelineLayout pipelineLayout() const
+    {
+        return *pipelineLayoutHandle;
+    }
+    [[nodiscard]] vk::DescriptorSetLayout descriptorSetLayout() const
+    {
+        return *setLayout;
+    }
+    [[nodiscard]] uint32_t slotCapacity(DescriptorKind kind) const
+    {
+        return capacity[static_cast<size_t>(kind)];
+    }
+
+  private:
+    BindlessIndex write(DescriptorKind kind, vk::DescriptorImageInfo const *imageInfo, vk::DescriptorBufferInfo const *bufferInfo)
+    {
+        const auto k = static_cast<size_t>(kind);
+        std::scoped_lock lock(mutex);
+        if (freeSlots[k].empty())
+            nrInfo(LogLevel::error)("Bindless heap is out of {} slots ({} in use).", vk::to_string(descriptorTypes[k]), capacity[k]);
+        const uint32_t index = freeSlots[k].back();
+        freeSlots[k].pop_back();
+        vk::WriteDescriptorSet descriptorWrite(*set, static_cast<uint32_t>(k), index, 1, descriptorTypes[k], imageInfo, bufferInfo);
+        device->updateDescriptorSets(descriptorWrite, {});
+        return {kind, index};
+    }
+
+    struct Retired
+    {
+        BindlessIndex slot;
+        SubmitPoint lastUse;
+    };
+
+    vk::raii::Device const *device;
+    vk::raii::DescriptorSetLayout setLayout = {nullptr};
+    vk::raii::DescriptorPool pool = {nullptr};
+    vk::raii::DescriptorSet set = {nullptr};
+    vk::raii::PipelineLayout pipelineLayoutHandle = {nullptr};
+    std::array<uint32_t, kindCount> capacity{};
+
+    std::mutex mutex;
+    std::array<std::vector<uint32_t>, kindCount> freeSlots;
+    std::vector<Retired> retired;
+};
+
+} // namespace nr::rhi
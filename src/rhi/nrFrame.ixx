@@ -0,0 +1,143 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+export module nr.rhi.frame;
+import nr.rhi.queue;
+import nr.utils;
+import std;
+
+export namespace nr::rhi
+{
+
+// A transient command pool plus the buffers allocated from it. Buffers are never freed individually: reset() recycles
+// the whole pool and acquire() hands the same buffers out again, so steady-state frames allocate nothing.
+struct Command
+{
+    vk::raii::Device const *device = nullptr;
+    vk::raii::CommandPool commandPool = {nullptr};
+    std::vector<vk::raii::CommandBuffer> commandBuffers;
+    std::vector<vk::raii::CommandBuffer> secondaryCommandBuffers;
+    size_t usedPrimary = 0;
+    size_t usedSecondary = 0;
+
+    Command() = default;
+    Command(vk::raii::Device const &device, std::uint32_t queueFamilyIndex, vk::CommandPoolCreateFlags flags = vk::CommandPoolCreateFlagBits::eTransient)
+        : device(&device), commandPool(device, vk::CommandPoolCreateInfo(flags, queueFamilyIndex))
+    {
+    }
+    Command(const Command &) = delete;
+    Command &operator=(const Command &) = delete;
+    Command(Command &&) = default;
+    Command &operator=(Command &&) = default;
+
+    // a buffer in the initial state, valid until the next reset()
+    [[nodiscard]] vk::raii::CommandBuffer &acquire(vk::CommandBufferLevel level = vk::CommandBufferLevel::ePrimary)
+    {
+        const bool primary = level == vk::CommandBufferLevel::ePrimary;
+        auto &buffers = primary ? commandBuffers : secondaryCommandBuffers;
+        size_t &used = primary ? usedPrimary : usedSecondary;
+        if (used == buffers.size())
+        {
+            // grow geometrically so a frame that records more than the last one only pays once
+            const auto growBy = static_cast<std::uint32_t>(std::max<size_t>(buffers.size(), 4));
+            for (auto &&buffer : vk::raii::CommandBuffers(*device, {*commandPool, level, growBy}))
+            {
+                buffers.push_back(std::move(buffer));
+            }
+        }
+        return buffers[used++];
+    }
+
+    void reset()
+    {
+        commandPool.reset();
+        usedPrimary = 0;
+        usedSecondary = 0;
+    }
+};
+
+// Everything one frame in flight owns: a command pool per recording thread, the binary semaphore for swapchain
+// acquisition, and the submit points that must be reached before any of it may be reused.
+struct FrameContext
+{
+    std::uint64_t frameNumber = 0;
+    std::vector<Command> threadCommands;
+    std::vector<SubmitPoint> completion;
+    vk::raii::Semaphore imageAvailable = {nullptr};
+
+    [[nodiscard]] Command &commands(size_t threadIndex)
+    {
+        return threadCommands[threadIndex];
+    }
+    // register a submission that uses this frame's resources
+    void signalOn(SubmitPoint point)
+    {
+        completion.push_back(point);
+    }
+};
+
+// Ring of 2-4 FrameContexts that lets the CPU record frame N+k while the GPU executes frame N. beginFrame() blocks only
+// if the GPU is a full ring behind, then resets the frame's pools wholesale.
+class FrameRing
+{
+  public:
+    static constexpr std::uint32_t minFramesInFlight = 2;
+    static constexpr std::uint32_t maxFramesInFlight = 4;
+
+    FrameRing(vk::raii::Device const &device, QueueSystem const &queues, std::uint32_t queueFamilyIndex, std::uint32_t framesInFlight = minFramesInFlight, std::uint32_t threadCount = 1) : queues(&queues)
+    {
+        frames.resize(std::clamp(framesInFlight, minFramesInFlight, maxFramesInFlight));
+        for (FrameContext &frame : frames)
+        {
+            for (std::uint32_t t = 0; t < std::max(threadCount, 1u); ++t)
+            {
+                frame.threadCommands.emplace_back(device, queueFamilyIndex);
+            }
+            frame.imageAvailable = vk::raii::Semaphore(device, vk::SemaphoreCreateInfo{});
+        }
+    }
+    FrameRing(const FrameRing &) = delete;
+    FrameRing &operator=(const FrameRing &) = delete;
+    ~FrameRing()
+    {
+        waitIdle();
+    }
+
+    FrameContext &beginFrame()
+    {
+        FrameContext &frame = frames[frameNumber % frames.size()];
+        queues->wait(frame.completion);
+        frame.completion.clear();
+        std::ranges::for_each(frame.threadCommands, &Command::reset);
+        frame.frameNumber = frameNumber++;
+        return frame;
+    }
+
+    [[nodiscard]] FrameContext &current()
+    {
+        return frames[(frameNumber + frames.size() - 1) % frames.size()];
+    }
+    [[nodiscard]] std::uint32_t framesInFlight() const
+    {
+        return static_cast<std::uint32_t>(frames.size());
+    }
+    [[nodiscard]] size_t threadCount() const
+    {
+        return frames.front().threadCommands.size();
+    }
+
+    void waitIdle()
+    {
+        for (FrameContext &frame : frames)
+        {
+            queues->wait(frame.completion);
+            frame.completion.clear();
+        }
+    }
+
+  private:
+    QueueSystem const *queues;
+    std::vector<FrameContext> frames;
+    std::uint64_t frameNumber = 0;
+};
+
+} // namespace nr::rhi
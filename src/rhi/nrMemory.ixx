@@ -0,0 +1,520 @@
+module;
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan_raii.hpp>
+export module nr.rhi.memory;
+import nr.rhi.queue;
+import nr.rhi.frame;
+import nr.utils;
+import std;
+
+export namespace nr::rhi
+{
+
+enum class MemoryPool
+{
+    // VMA's default per-memory-type pools
+    general,
+    // host-visible ring for data rewritten every frame (uniforms, dynamic vertices); freed in allocation order
+    frameLinear,
+    // device-local buffers that live for many frames; the pool the Defragmenter compacts
+    longLived,
+    size
+};
+
+struct BufferDesc
+{
+    vk::DeviceSize size = 0;
+    vk::BufferUsageFlags usage;
+    MemoryPool pool = MemoryPool::general;
+    VmaMemoryUsage memoryUsage = VMA_MEMORY_USAGE_AUTO;
+    VmaAllocationCreateFlags flags = 0;
+    // may be relocated by the Defragmenter; handle() changes, so never cache it across frames
+    bool movable = false;
+};
+
+struct ImageDesc
+{
+    vk::ImageCreateInfo createInfo;
+    // large render targets get their own VkDeviceMemory so they never pin or fragment shared blocks
+    bool renderTarget = false;
+    VmaAllocationCreateFlags flags = 0;
+};
+
+struct HeapStatistics
+{
+    uint32_t heapIndex = 0;
+    vk::MemoryHeapFlags flags;
+    vk::DeviceSize budget = 0;
+    vk::DeviceSize usage = 0;
+    uint32_t blockCount = 0;
+    uint32_t allocationCount = 0;
+    vk::DeviceSize blockBytes = 0;
+    vk::DeviceSize allocationBytes = 0;
+    vk::DeviceSize largestFreeRange = 0;
+    uint32_t freeRangeCount = 0;
+    // 0 = all free space is one range, towards 1 = free space is scattered in small holes
+    double fragmentation = 0.0;
+};
+
+class MemoryAllocator;
+
+class Buffer
+{
+  public:
+    Buffer() = default;
+    Buffer(std::nullptr_t)
+    {
+    }
+    Buffer(Buffer &&) noexcept = default;
+    Buffer &operator=(Buffer &&other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            allocator = std::exchange(other.allocator, nullptr);
+            record = std::move(other.record);
+        }
+        return *this;
+    }
+    ~Buffer()
+    {
+        release();
+    }
+
+    [[nodiscard]] vk::Buffer handle() const
+    {
+        return record ? record->buffer : vk::Buffer{};
+    }
+    [[nodiscard]] vk::DeviceSize size() const
+    {
+        return record ? record->createInfo.size : 0;
+    }
+    // persistently mapped pointer, null unless created with VMA_ALLOCATION_CREATE_MAPPED_BIT
+    [[nodiscard]] void *mapped() const
+    {
+        return record ? record->mapped : nullptr;
+    }
+    template <typename T> [[nodiscard]] std::span<T> mappedSpan() const
+    {
+        return {static_cast<T *>(mapped()), static_cast<size_t>(size() / sizeof(T))};
+    }
+    explicit operator bool() const
+    {
+        return static_cast<bool>(record);
+    }
+
+  private:
+    friend class MemoryAllocator;
+    friend class Defragmenter;
+    // heap-allocated so its address can serve as VMA pUserData while the Buffer itself moves around
+    struct Record
+    {
+        vk::Buffer buffer;
+        VmaAllocation allocation = nullptr;
+        vk::BufferCreateInfo createInfo;
+        void *mapped = nullptr;
+        bool movable = false;
+    };
+    void release()
+    {
+        if (record)
+            vmaDestroyBuffer(allocator, record->buffer, record->allocation);
+        record.reset();
+    }
+    VmaAllocator allocator = nullptr;
+    std::unique_ptr<Record> record;
+};
+
+class Image
+{
+  public:
+    Image() = default;
+    Image(std::nullptr_t)
+    {
+    }
+    Image(Image &&other) noexcept
+    {
+        *this = std::move(other);
+    }
+    Image &operator=(Image &&other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            allocator = std::exchange(other.allocator, nullptr);
+            image = std::exchange(other.image, {});
+            allocation = std::exchange(other.allocation, nullptr);
+            format = other.format;
+            extent = other.extent;
+        }
+        return *this;
+    }
+    ~Image()
+    {
+        release();
+    }
+
+    [[nodiscard]] vk::Image handle() const
+    {
+        return image;
+    }
+    explicit operator bool() const
+    {
+        return static_cast<bool>(image);
+    }
+
+    vk::Format format = vk::Format::eUndefined;
+    vk::Extent3D extent;
+
+  private:
+    friend class MemoryAllocator;
+    void release()
+    {
+        if (image)
+            vmaDestroyImage(allocator, image, allocation);
+        image = vk::Image{};
+    }
+    VmaAllocator allocator = nullptr;
+    vk::Image image;
+    VmaAllocation allocation = nullptr;
+};
+
+// Device memory not owned by any single resource. The render graph binds transient images whose lifetimes never
+// overlap into the same block, so they share one allocation.
+class MemoryBlock
+{
+  public:
+    MemoryBlock() = default;
+    MemoryBlock(MemoryBlock &&other) noexcept
+    {
+        *this = std::move(other);
+    }
+    MemoryBlock &operator=(MemoryBlock &&other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            allocator = std::exchange(other.allocator, nullptr);
+            allocation = std::exchange(other.allocation, nullptr);
+            bytes = std::exchange(other.bytes, 0);
+        }
+        return *this;
+    }
+    ~MemoryBlock()
+    {
+        release();
+    }
+
+    void bindImage(vk::Image image, vk::DeviceSize offset = 0) const
+    {
+        vk::detail::resultCheck(static_cast<vk::Result>(vmaBindImageMemory2(allocator, allocation, offset, image, nullptr)), "Failed to bind image to memory block");
+    }
+    [[nodiscard]] vk::DeviceSize size() const
+    {
+        return bytes;
+    }
+
+  private:
+    friend class MemoryAllocator;
+    void release()
+    {
+        if (allocation)
+            vmaFreeMemory(allocator, allocation);
+        allocation = nullptr;
+    }
+    VmaAllocator allocator = nullptr;
+    VmaAllocation allocation = nullptr;
+    vk::DeviceSize bytes = 0;
+};
+
+// Owns the VmaAllocator of a Device plus its custom pools. Creation functions are thread-safe (VMA locks internally).
+class MemoryAllocator
+{
+  public:
+    static constexpr vk::DeviceSize frameLinearBlockSize = 32ull << 20;
+
+    MemoryAllocator(vk::raii::Instance const &instance, vk::raii::PhysicalDevice const &physicalDevice, vk::raii::Device const &device, uint32_t apiVersion = VK_API_VERSION_1_4)
+    {
+        VmaVulkanFunctions vulkanFunctions{};
+        vulkanFunctions.vkGetInstanceProcAddr = instance.getDispatcher()->vkGetInstanceProcAddr;
+        vulkanFunctions.vkGetDeviceProcAddr = device.getDispatcher()->vkGetDeviceProcAddr;
+
+        VmaAllocatorCreateInfo allocatorCreateInfo{};
+        allocatorCreateInfo.vulkanApiVersion = apiVersion;
+        allocatorCreateInfo.instance = *instance;
+        allocatorCreateInfo.physicalDevice = *physicalDevice;
+        allocatorCreateInfo.device = *device;
+        allocatorCreateInfo.pVulkanFunctions = &vulkanFunctions;
+        VmaAllocator raw = nullptr;
+        vk::detail::resultCheck(static_cast<vk::Result>(vmaCreateAllocator(&allocatorCreateInfo, &raw)), "Failed to create VMA allocator");
+        allocator.reset(raw);
+
+        pools[static_cast<size_t>(MemoryPool::frameLinear)] = makePool(vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferSrc,
+                                                                       VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, VMA_POOL_CREATE_LINEAR_ALGORITHM_BIT, frameLinearBlockSize, 1);
+        pools[static_cast<size_t>(MemoryPool::longLived)] = makePool(vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eIndirectBuffer |
+                                                                         vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc,
+                                                                     0, 0, 0, 0);
+    }
+    MemoryAllocator(const MemoryAllocator &) = delete;
+    MemoryAllocator &operator=(const MemoryAllocator &) = delete;
+    ~MemoryAllocator()
+    {
+        for (VmaPool pool : pools)
+        {
+            if (pool)
+                vmaDestroyPool(allocator.get(), pool);
+        }
+    }
+
+    [[nodiscard]] VmaAllocator handle() const
+    {
+        return allocator.get();
+    }
+
+    [[nodiscard]] Buffer createBuffer(BufferDesc const &desc) const
+    {
+        Buffer result;
+        result.allocator = allocator.get();
+        result.record = std::make_unique<Buffer::Record>();
+        Buffer::Record &record = *result.record;
+        record.createInfo = vk::BufferCreateInfo({}, desc.size, desc.usage | (desc.movable ? vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst : vk::BufferUsageFlags{}));
+        record.movable = desc.movable;
+
+        VmaAllocationCreateInfo allocationCreateInfo{};
+        allocationCreateInfo.usage = desc.memoryUsage;
+        allocationCreateInfo.flags = desc.flags;
+        allocationCreateInfo.pool = pools[static_cast<size_t>(desc.pool)];
+        allocationCreateInfo.pUserData = &record;
+        if (desc.pool == MemoryPool::frameLinear)
+            allocationCreateInfo.flags |= VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VmaAllocationInfo allocationInfo{};
+        vk::detail::resultCheck(static_cast<vk::Result>(vmaCreateBuffer(allocator.get(), reinterpret_cast<const VkBufferCreateInfo *>(&record.createInfo), &allocationCreateInfo, &buffer, &record.allocation, &allocationInfo)), "Failed to create buffer");
+        record.buffer = buffer;
+        record.mapped = allocationInfo.pMappedData;
+        return result;
+    }
+
+    template <typename T> [[nodiscard]] Buffer createBuffer(size_t count, vk::BufferUsageFlags usage, MemoryPool pool = MemoryPool::general, VmaAllocationCreateFlags flags = 0) const
+    {
+        return createBuffer({.size = sizeof(T) * count, .usage = usage, .pool = pool, .flags = flags});
+    }
+
+    [[nodiscard]] Image createImage(ImageDesc const &desc) const
+    {
+        Image result;
+        result.allocator = allocator.get();
+        result.format = desc.createInfo.format;
+        result.extent = desc.createInfo.extent;
+
+        VmaAllocationCreateInfo allocationCreateInfo{};
+        allocationCreateInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+        allocationCreateInfo.flags = desc.flags | (desc.renderTarget ? VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT : 0);
+        if (desc.renderTarget)
+            allocationCreateInfo.priority = 1.0f;
+
+        VkImage image = VK_NULL_HANDLE;
+        vk::detail::resultCheck(static_cast<vk::Result>(vmaCreateImage(allocator.get(), reinterpret_cast<const VkImageCreateInfo *>(&desc.createInfo), &allocationCreateInfo, &image, &result.allocation, nullptr)), "Failed to create image");
+        result.image = image;
+        return result;
+    }
+
+    // device-local memory satisfying `requirements` (already merged over every resource that will be bound into it)
+    [[nodiscard]] MemoryBlock allocateMemory(vk::MemoryRequirements const &requirements) const
+    {
+        MemoryBlock result;
+        result.allocator = allocator.get();
+        result.bytes = requirements.size;
+
+        VmaAllocationCreateInfo allocationCreateInfo{};
+        allocationCreateInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        allocationCreateInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+        allocationCreateInfo.priority = 1.0f;
+        vk::detail::resultCheck(static_cast<vk::Result>(vmaAllocateMemory(allocator.get(), reinterpret_cast<const VkMemoryRequirements *>(&requirements), &allocationCreateInfo, &result.allocation, nullptr)), "Failed to allocate memory block");
+        return result;
+    }
+
+    [[nodiscard]] VmaPool pool(MemoryPool kind) const
+    {
+        return pools[static_cast<size_t>(kind)];
+    }
+
+    [[nodiscard]] std::vector<HeapStatistics> statistics() const
+    {
+        VmaTotalStatistics total{};
+        vmaCalculateStatistics(allocator.get(), &total);
+        std::array<VmaBudget, VK_MAX_MEMORY_HEAPS> budgets{};
+        vmaGetHeapBudgets(allocator.get(), budgets.data());
+        const VkPhysicalDeviceMemoryProperties *memoryProperties = nullptr;
+        vmaGetMemoryProperties(allocator.get(), &memoryProperties);
+
+        std::vector<HeapStatistics> result;
+        for (uint32_t heap = 0; heap < memoryProperties->memoryHeapCount; ++heap)
+        {
+            VmaDetailedStatistics const &detail = total.memoryHeap[heap];
+            HeapStatistics s;
+            s.heapIndex = heap;
+            s.flags = vk::MemoryHeapFlags(memoryProperties->memoryHeaps[heap].flags);
+            s.budget = budgets[heap].budget;
+            s.usage = budgets[heap].usage;
+            s.blockCount = detail.statistics.blockCount;
+            s.allocationCount = detail.statistics.allocationCount;
+            s.blockBytes = detail.statistics.blockBytes;
+            s.allocationBytes = detail.statistics.allocationBytes;
+            s.freeRangeCount = detail.unusedRangeCount;
+            s.largestFreeRange = detail.unusedRangeCount ? detail.unusedRangeSizeMax : 0;
+            const vk::DeviceSize freeBytes = s.blockBytes - s.allocationBytes;
+            s.fragmentation = freeBytes ? 1.0 - static_cast<double>(s.largestFreeRange) / static_cast<double>(freeBytes) : 0.0;
+            result.push_back(s);
+        }
+        return result;
+    }
+
+    void report() const
+    {
+        std::string table;
+        for (HeapStatistics const &s : statistics())
+        {
+            table += std::format("\n    heap {} {:<12} blocks {:>4}  allocations {:>6}  used {:>8.2f}/{:>8.2f} MiB in blocks  budget {:>8.2f}/{:>8.2f} MiB  free ranges {:>5}  fragmentation {:.1f}%", s.heapIndex,
+                                 (s.flags & vk::MemoryHeapFlagBits::eDeviceLocal) ? "device-local" : "host", s.blockCount, s.allocationCount, s.allocationBytes / 1048576.0, s.blockBytes / 1048576.0, s.usage / 1048576.0, s.budget / 1048576.0,
+                                 s.freeRangeCount, s.fragmentation * 100.0);
+        }
+        nrInfo()("GPU memory:{}", table);
+    }
+
+  private:
+    VmaPool makePool(vk::BufferUsageFlags exampleUsage, VmaAllocationCreateFlags allocationFlags, VmaPoolCreateFlags poolFlags, vk::DeviceSize blockSize, size_t maxBlockCount) const
+    {
+        const vk::BufferCreateInfo exampleBufferInfo({}, 1024, exampleUsage);
+        VmaAllocationCreateInfo allocationCreateInfo{};
+        allocationCreateInfo.usage = VMA_MEMORY_USAGE_AUTO;
+        allocationCreateInfo.flags = allocationFlags;
+        uint32_t memoryTypeIndex = 0;
+        vk::detail::resultCheck(static_cast<vk::Result>(vmaFindMemoryTypeIndexForBufferInfo(allocator.get(), reinterpret_cast<const VkBufferCreateInfo *>(&exampleBufferInfo), &allocationCreateInfo, &memoryTypeIndex)), "No memory type for pool");
+
+        VmaPoolCreateInfo poolCreateInfo{};
+        poolCreateInfo.memoryTypeIndex = memoryTypeIndex;
+        poolCreateInfo.flags = poolFlags;
+        poolCreateInfo.blockSize = blockSize;
+        poolCreateInfo.maxBlockCount = maxBlockCount;
+        VmaPool result = nullptr;
+        vk::detail::resultCheck(static_cast<vk::Result>(vmaCreatePool(allocator.get(), &poolCreateInfo, &result)), "Failed to create memory pool");
+        return result;
+    }
+
+    std::unique_ptr<VmaAllocator_T, decltype(&vmaDestroyAllocator)> allocator{nullptr, &vmaDestroyAllocator};
+    std::array<VmaPool, static_cast<size_t>(MemoryPool::size)> pools{};
+};
+
+// Incremental compaction of a pool, one VMA pass at a time. step() is meant to be called once per frame: it records
+// the copies of the current pass on the caller's command pool, submits them and returns; the pass is only committed
+// (and the old buffers freed) on a later step() once the GPU has reached the copy's SubmitPoint, so no frame waits.
+// Only buffers created with BufferDesc::movable and used on `queue` are relocated.
+class Defragmenter
+{
+  public:
+    Defragmenter(MemoryAllocator const &allocator, vk::raii::Device const &device, MemoryPool pool = MemoryPool::longLived, vk::DeviceSize maxBytesPerPass = 64ull << 20)
+        : allocator(allocator.handle()), device(&device)
+    {
+        VmaDefragmentationInfo info{};
+        info.flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_BALANCED_BIT;
+        info.pool = allocator.pool(pool);
+        info.maxBytesPerPass = maxBytesPerPass;
+        vk::detail::resultCheck(static_cast<vk::Result>(vmaBeginDefragmentation(this->allocator, &info, &context)), "Failed to begin defragmentation");
+    }
+    Defragmenter(const Defragmenter &) = delete;
+    Defragmenter &operator=(const Defragmenter &) = delete;
+    ~Defragmenter()
+    {
+        if (passOpen)
+        {
+            queue->wait(pendingCopy.value);
+            commitPass();
+        }
+        finish();
+    }
+
+    // true while there is work left
+    bool step(Queue &submitQueue, Command &commands)
+    {
+        if (!context)
+            return false;
+        if (passOpen)
+        {
+            if (!queue->isComplete(pendingCopy.value))
+                return true;
+            if (!commitPass())
+                return finish();
+            return true;
+        }
+        if (vmaBeginDefragmentationPass(allocator, context, &passInfo) == VK_SUCCESS)
+            return finish();
+
+        queue = &submitQueue;
+        vk::raii::CommandBuffer &cmd = commands.acquire();
+        cmd.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+        // earlier work on this queue may still write the sources, later work reads the destinations
+        const vk::MemoryBarrier2 before(vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryWrite, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferRead);
+        cmd.pipelineBarrier2(vk::DependencyInfo({}, before));
+        for (VmaDefragmentationMove &move : std::span(passInfo.pMoves, passInfo.moveCount))
+        {
+            VmaAllocationInfo info{};
+            vmaGetAllocationInfo(allocator, move.srcAllocation, &info);
+            auto *record = static_cast<Buffer::Record *>(info.pUserData);
+            if (record == nullptr || !record->movable)
+            {
+                move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+                continue;
+            }
+            vk::Buffer newBuffer = vk::Device(**device).createBuffer(record->createInfo, nullptr, *device->getDispatcher());
+            vk::detail::resultCheck(static_cast<vk::Result>(vmaBindBufferMemory(allocator, move.dstTmpAllocation, newBuffer)), "Failed to bind defragmented buffer");
+            cmd.copyBuffer(record->buffer, newBuffer, vk::BufferCopy(0, 0, record->createInfo.size));
+            retired.push_back(record->buffer);
+            record->buffer = newBuffer;
+        }
+        const vk::MemoryBarrier2 after(vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite, vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlagBits2::eMemoryRead | vk::AccessFlagBits2::eMemoryWrite);
+        cmd.pipelineBarrier2(vk::DependencyInfo({}, after));
+        cmd.end();
+        const vk::CommandBuffer cmdHandle = *cmd;
+        pendingCopy = submitQueue.submit({.commandBuffers = {&cmdHandle, 1}});
+        passOpen = true;
+        return true;
+    }
+
+  private:
+    // returns false once VMA reports the whole defragmentation as done
+    bool commitPass()
+    {
+        passOpen = false;
+        for (vk::Buffer buffer : retired)
+        {
+            vk::Device(**device).destroyBuffer(buffer, nullptr, *device->getDispatcher());
+        }
+        retired.clear();
+        return vmaEndDefragmentationPass(allocator, context, &passInfo) == VK_INCOMPLETE;
+    }
+
+    bool finish()
+    {
+        if (context)
+        {
+            VmaDefragmentationStats stats{};
+            vmaEndDefragmentation(allocator, context, &stats);
+            context = nullptr;
+            nrInfo()("defragmentation: moved {} allocations ({} bytes), freed {} blocks ({} bytes)", stats.allocationsMoved, stats.bytesMoved, stats.deviceMemoryBlocksFreed, stats.bytesFreed);
+        }
+        return false;
+    }
+
+    VmaAllocator allocator;
+    vk::raii::Device const *device;
+    VmaDefragmentationContext context = nullptr;
+    VmaDefragmentationPassMoveInfo passInfo{};
+    bool passOpen = false;
+    Queue *queue = nullptr;
+    SubmitPoint pendingCopy;
+    std::vector<vk::Buffer> retired;
+};
+
+} // namespace nr::rhi
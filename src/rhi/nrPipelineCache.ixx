@@ -0,0 +1,202 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+export module nr.rhi.pipelineCache;
+import nr.utils;
+import std;
+
+namespace detail
+{
+// Prefix written in front of the driver blob. The Vulkan header only carries vendor/device/UUID, so the
+// driver version and a checksum are added to reject blobs left behind by a driver update or a torn write.
+struct PipelineCacheFilePrefix
+{
+    static constexpr std::uint32_t expectedMagic = 0x4350524e; // "NRPC"
+    std::uint32_t magic = expectedMagic;
+    std::uint32_t driverVersion = 0;
+    std::uint64_t dataSize = 0;
+    std::uint64_t checksum = 0;
+};
+} // namespace detail
+
+export namespace nr::rhi
+{
+
+struct PipelineCacheStats
+{
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t loadedBytes = 0;
+    std::uint64_t savedBytes = 0;
+    double creationMilliseconds = 0.0;
+};
+
+// Chain `createInfo` into the pNext of a pipeline create info, create the pipeline, then hand it to PipelineCache::record.
+struct PipelineCreationFeedback
+{
+    vk::PipelineCreationFeedback pipelineFeedback{};
+    vk::PipelineCreationFeedbackCreateInfo createInfo{&pipelineFeedback, 0, nullptr};
+    PipelineCreationFeedback() = default;
+    PipelineCreationFeedback(const PipelineCreationFeedback &) = delete;
+    PipelineCreationFeedback &operator=(const PipelineCreationFeedback &) = delete;
+};
+
+// One persistent VkPipelineCache per physical device. Every recording thread gets its own cache seeded with the
+// on-disk blob so pipeline creation never contends on a driver-internal lock; the caches are merged on save().
+class PipelineCache
+{
+  public:
+    PipelineCache(vk::raii::Device const &device, vk::raii::PhysicalDevice const &physicalDevice, std::filesystem::path const &directory) : device(&device)
+    {
+        const vk::PhysicalDeviceProperties props = physicalDevice.getProperties();
+        vendorID = props.vendorID;
+        deviceID = props.deviceID;
+        driverVersion = props.driverVersion;
+        std::ranges::copy(props.pipelineCacheUUID, uuid.begin());
+        path = directory / std::format("pipeline-{:04x}-{:04x}.nrpc", vendorID, deviceID);
+
+        initialData = load();
+        stats.loadedBytes = initialData.size();
+        mainCache = makeCache();
+    }
+    PipelineCache(const PipelineCache &) = delete;
+    PipelineCache &operator=(const PipelineCache &) = delete;
+    ~PipelineCache()
+    {
+        save();
+    }
+
+    // cache to pass to vkCreate*Pipelines from the calling thread; it lives as long as this object
+    [[nodiscard]] vk::PipelineCache threadCache()
+    {
+        std::scoped_lock lock(mutex);
+        auto it = threadCaches.find(std::this_thread::get_id());
+        if (it == threadCaches.end())
+        {
+            it = threadCaches.emplace(std::this_thread::get_id(), makeCache()).first;
+        }
+        return *it->second;
+    }
+
+    void record(PipelineCreationFeedback const &feedback)
+    {
+        if (!(feedback.pipelineFeedback.flags & vk::PipelineCreationFeedbackFlagBits::eValid))
+            return;
+        bool hit = static_cast<bool>(feedback.pipelineFeedback.flags & vk::PipelineCreationFeedbackFlagBits::eApplicationPipelineCacheHit);
+        (hit ? hits : misses).fetch_add(1, std::memory_order_relaxed);
+        creationNanoseconds.fetch_add(feedback.pipelineFeedback.duration, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] PipelineCacheStats statistics() const
+    {
+        PipelineCacheStats result = stats;
+        result.hits = hits.load(std::memory_order_relaxed);
+        result.misses = misses.load(std::memory_order_relaxed);
+        result.creationMilliseconds = static_cast<double>(creationNanoseconds.load(std::memory_order_relaxed)) / 1e6;
+        return result;
+    }
+
+    void report() const
+    {
+        PipelineCacheStats s = statistics();
+        nrInfo()("pipeline cache '{}': {} hits, {} misses, {:.2f} ms creating pipelines, {} bytes loaded, {} bytes saved", path.string(), s.hits, s.misses, s.creationMilliseconds, s.loadedBytes, s.savedBytes);
+    }
+
+    // merge every per-thread cache into the main one and write it out; the file is replaced atomically. The per-thread
+    // caches stay alive, since other threads may still hold their handles, and merging them again is harmless.
+    void save()
+    {
+        std::scoped_lock lock(mutex);
+        if (!threadCaches.empty())
+        {
+            std::vector<vk::PipelineCache> sources = threadCaches | std::views::values | std::views::transform([](vk::raii::PipelineCache const &c) { return *c; }) | std::ranges::to<std::vector>();
+            mainCache.merge(sources);
+        }
+        std::vector<std::uint8_t> data = mainCache.getData();
+        if (data.empty())
+            return;
+
+        detail::PipelineCacheFilePrefix prefix;
+        prefix.driverVersion = driverVersion;
+        prefix.dataSize = data.size();
+        prefix.checksum = fnv1a64(std::as_bytes(std::span(data)));
+
+        std::error_code ec;
+        std::filesystem::create_directories(path.parent_path(), ec);
+        std::filesystem::path tmpPath = path;
+        tmpPath += ".tmp";
+        {
+            std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char *>(&prefix), sizeof(prefix));
+            file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+            if (!file)
+            {
+                nrInfo(LogLevel::warning)("Failed to write pipeline cache '{}'.", tmpPath.string());
+                return;
+            }
+        }
+        std::filesystem::rename(tmpPath, path, ec);
+        if (ec)
+        {
+            nrInfo(LogLevel::warning)("Failed to replace pipeline cache '{}': {}", path.string(), ec.message());
+            return;
+        }
+        stats.savedBytes = data.size();
+    }
+
+  private:
+    vk::raii::PipelineCache makeCache() const
+    {
+        return vk::raii::PipelineCache(*device, vk::PipelineCacheCreateInfo({}, initialData.size(), initialData.empty() ? nullptr : initialData.data()));
+    }
+
+    // returns the driver blob, or nothing if the file is missing, torn or was written by another device/driver
+    std::vector<std::uint8_t> load() const
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return {};
+
+        detail::PipelineCacheFilePrefix prefix;
+        if (!file.read(reinterpret_cast<char *>(&prefix), sizeof(prefix)) || prefix.magic != detail::PipelineCacheFilePrefix::expectedMagic || prefix.driverVersion != driverVersion)
+            return {};
+        // the size comes from the file itself: check it against what is left before allocating
+        std::error_code ec;
+        const std::uintmax_t fileSize = std::filesystem::file_size(path, ec);
+        if (ec || prefix.dataSize < sizeof(vk::PipelineCacheHeaderVersionOne) || prefix.dataSize > fileSize - sizeof(prefix))
+        {
+            nrInfo(LogLevel::warning)("Pipeline cache '{}' is corrupted and will be rebuilt.", path.string());
+            return {};
+        }
+        std::vector<std::uint8_t> data(prefix.dataSize);
+        if (!file.read(reinterpret_cast<char *>(data.data()), static_cast<std::streamsize>(data.size())) || fnv1a64(std::as_bytes(std::span(data))) != prefix.checksum)
+        {
+            nrInfo(LogLevel::warning)("Pipeline cache '{}' is corrupted and will be rebuilt.", path.string());
+            return {};
+        }
+
+        vk::PipelineCacheHeaderVersionOne header;
+        std::memcpy(&header, data.data(), sizeof(header));
+        if (header.headerVersion != vk::PipelineCacheHeaderVersion::eOne || header.vendorID != vendorID || header.deviceID != deviceID || !std::ranges::equal(header.pipelineCacheUUID, uuid))
+            return {};
+        return data;
+    }
+
+    vk::raii::Device const *device;
+    vk::raii::PipelineCache mainCache = {nullptr};
+    std::filesystem::path path;
+    std::uint32_t vendorID = 0;
+    std::uint32_t deviceID = 0;
+    std::uint32_t driverVersion = 0;
+    std::array<std::uint8_t, vk::UuidSize> uuid{};
+    std::vector<std::uint8_t> initialData;
+
+    std::mutex mutex;
+    std::unordered_map<std::thread::id, vk::raii::PipelineCache> threadCaches;
+
+    PipelineCacheStats stats;
+    std::atomic<std::uint64_t> hits = 0;
+    std::atomic<std::uint64_t> misses = 0;
+    std::atomic<std::uint64_t> creationNanoseconds = 0;
+};
+
+} // namespace nr::rhi
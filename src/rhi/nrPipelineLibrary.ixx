@@ -0,0 +1,309 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+export module nr.rhi.pipelineLibrary;
+import nr.rhi.queue;
+import nr.rhi.pipelineCache;
+import nr.rhi.resources;
+import nr.shader;
+import nr.shader.watcher;
+import nr.utils;
+import std;
+
+export namespace nr::rhi
+{
+
+using ShaderPipelineId = Handle<struct ShaderPipelineTag>;
+
+struct ShaderStage
+{
+    vk::ShaderStageFlagBits stage;
+    shader::ShaderRequest request;
+};
+
+// Creates the pipeline from its compiled stages through `cache`; chain `feedback.createInfo` into the create info's
+// pNext. Called again on a worker thread for every reload, so it must only capture state that stays valid and fixed.
+using PipelineBuilder = std::function<vk::Pipeline(vk::raii::Device const &device, vk::PipelineCache cache, std::span<const vk::PipelineShaderStageCreateInfo> stages, PipelineCreationFeedback &feedback)>;
+
+struct ShaderPipelineDesc
+{
+    std::string name;
+    std::vector<ShaderStage> stages;
+    // not owned; has to outlive the pipeline and all of its reloads
+    vk::PipelineLayout layout;
+    vk::PipelineBindPoint bindPoint = vk::PipelineBindPoint::eGraphics;
+    PipelineBuilder build;
+};
+
+// a compute pipeline needs nothing beyond its layout and its one stage
+inline PipelineBuilder computePipelineBuilder(vk::PipelineLayout layout)
+{
+    return [layout](vk::raii::Device const &device, vk::PipelineCache cache, std::span<const vk::PipelineShaderStageCreateInfo> stages, PipelineCreationFeedback &feedback) {
+        const vk::ComputePipelineCreateInfo createInfo({}, stages.front(), layout, {}, 0, &feedback.createInfo);
+        return vk::Device(*device).createComputePipeline(cache, createInfo, nullptr, *device.getDispatcher()).value;
+    };
+}
+
+struct PipelineLibraryStatistics
+{
+    std::size_t pipelines = 0;
+    std::uint64_t reloads = 0;
+    std::uint64_t failedReloads = 0;
+};
+
+// Pipelines built from Slang sources that can be rebuilt while the application runs. Each ShaderPipelineId keeps
+// pointing at the current PipelineId in ResourcePools; the sources and includes every pipeline was compiled from are
+// tracked, so a change rebuilds just the pipelines that read the file, each distinct module compiled once. Reloads
+// compile and create pipelines on the job system and only queue the result; commit() swaps them in at a frame
+// boundary and retires the replaced pipelines until the frames still using them are done, so a reload never stalls a
+// frame. A reload that fails to compile or build keeps the previous pipeline and reports through nrInfo.
+class PipelineLibrary
+{
+  public:
+    PipelineLibrary(vk::raii::Device const &device, ResourcePools &resources, PipelineCache &cache, shader::ShaderCompiler &compiler = shader::ShaderCompiler::instance(), JobSystem &jobs = JobSystem::instance())
+        : device(&device), resources(&resources), cache(&cache), compiler(&compiler), jobs(&jobs)
+    {
+    }
+    PipelineLibrary(const PipelineLibrary &) = delete;
+    PipelineLibrary &operator=(const PipelineLibrary &) = delete;
+    // the GPU must no longer use any of the pipelines
+    ~PipelineLibrary()
+    {
+        watcher.reset();
+        jobs->wait(pendingBuilds);
+        std::scoped_lock lock(mutex, readyMutex);
+        for (Ready const &r : ready)
+            resources->release(r.pipeline);
+        for (PipelineId const id : entries.column<1>())
+            resources->release(id);
+    }
+
+    // Compiles and builds on the calling thread; std::nullopt if a stage does not compile or the builder fails
+    [[nodiscard]] std::optional<ShaderPipelineId> create(ShaderPipelineDesc desc)
+    {
+        auto shared = std::make_shared<const ShaderPipelineDesc>(std::move(desc));
+        const std::vector<shader::ShaderRequest> requests = shared->stages | std::views::transform(&ShaderStage::request) | std::ranges::to<std::vector>();
+        const std::vector<std::optional<shader::CompiledShader>> compiled = compiler->compileAll(requests, *jobs);
+        std::vector<shader::CompiledShader const *> stages;
+        for (std::optional<shader::CompiledShader> const &stage : compiled)
+        {
+            if (!stage)
+            {
+                nrInfo(LogLevel::warning)("The '{}' pipeline was not created: a stage failed to compile.", shared->name);
+                return std::nullopt;
+            }
+            stages.push_back(&*stage);
+        }
+        std::optional<Built> built = build(*shared, stages);
+        if (!built)
+            return std::nullopt;
+        std::scoped_lock lock(mutex);
+        const ShaderPipelineId id = entries.insert(std::move(shared), built->pipeline, 0);
+        dependencies.set(id, built->dependencies);
+        return id;
+    }
+
+    // `lastUse` as for ResourcePools::release
+    void destroy(ShaderPipelineId id, SubmitPoint lastUse = {})
+    {
+        std::scoped_lock lock(mutex);
+        auto removed = entries.erase(id);
+        nrAssert(removed.has_value())("Destroyed a stale pipeline handle (index {}, generation {}).", id.index, id.generation);
+        if (!removed)
+            return;
+        resources->release(std::get<1>(*removed), lastUse);
+        dependencies.erase(id);
+    }
+
+    // current pipeline; a null id once `id` was destroyed
+    [[nodiscard]] PipelineId pipeline(ShaderPipelineId id) const
+    {
+        std::shared_lock lock(mutex);
+        auto const *current = entries.get<1>(id);
+        return current ? *current : PipelineId{};
+    }
+    bool bind(vk::raii::CommandBuffer const &cmd, ShaderPipelineId id) const
+    {
+        return resources->bindPipeline(cmd, pipeline(id));
+    }
+
+    // starts watching the shader sources; every batch of changes goes to reload()
+    void watch(shader::ShaderWatcherOptions options = {})
+    {
+        watcher.reset();
+        watcher.emplace(std::move(options), [this](std::span<const std::filesystem::path> changed) { reload(changed); });
+        nrInfo()("Watching shader sources for changes ({}).", watcher->usesInotify() ? "inotify" : "polling");
+    }
+
+    // rebuilds, in the background, every pipeline compiled from one of `changed`
+    void reload(std::span<const std::filesystem::path> changed)
+    {
+        std::vector<Rebuild> batch;
+        {
+            std::scoped_lock lock(mutex);
+            for (ShaderPipelineId const id : dependencies.affected(changed))
+            {
+                if (auto const *desc = entries.get<0>(id))
+                    batch.push_back({id, *desc, ++nextSerial});
+            }
+        }
+        if (batch.empty())
+            return;
+        jobs->run(pendingBuilds, [this, batch = std::move(batch)] { rebuild(batch); });
+    }
+
+    // Swaps in the pipelines rebuilt since the last call. Call at a frame boundary, before recording; `lastUse` is the
+    // latest submission that may still bind a replaced pipeline, normally the graphics queue's lastEnqueuedPoint().
+    void commit(SubmitPoint lastUse)
+    {
+        std::vector<Ready> swaps;
+        {
+            std::scoped_lock lock(readyMutex);
+            if (ready.empty())
+                return;
+            swaps.swap(ready);
+        }
+        std::scoped_lock lock(mutex);
+        for (Ready &r : swaps)
+        {
+            PipelineId *current = entries.get<1>(r.id);
+            std::uint64_t *serial = entries.get<2>(r.id);
+            // destroyed meanwhile, or overtaken by a newer rebuild; never bound, so no need to wait
+            if (!current || *serial > r.serial)
+            {
+                resources->release(r.pipeline);
+                continue;
+            }
+            resources->release(*current, lastUse);
+            *current = r.pipeline;
+            *serial = r.serial;
+            dependencies.set(r.id, r.dependencies);
+            nrInfo()("Reloaded the '{}' pipeline.", (*entries.get<0>(r.id))->name);
+        }
+    }
+
+    [[nodiscard]] PipelineLibraryStatistics statistics() const
+    {
+        std::shared_lock lock(mutex);
+        return {entries.size(), reloads.load(), failedReloads.load()};
+    }
+
+  private:
+    struct Built
+    {
+        PipelineId pipeline;
+        std::vector<std::filesystem::path> dependencies;
+    };
+    struct Rebuild
+    {
+        ShaderPipelineId id;
+        std::shared_ptr<const ShaderPipelineDesc> desc;
+        std::uint64_t serial;
+    };
+    struct Ready
+    {
+        ShaderPipelineId id;
+        std::uint64_t serial;
+        PipelineId pipeline;
+        std::vector<std::filesystem::path> dependencies;
+    };
+
+    std::optional<Built> build(ShaderPipelineDesc const &desc, std::span<shader::CompiledShader const *const> compiled) const
+    {
+        vk::Device const raw(**device);
+        auto const &dispatcher = *device->getDispatcher();
+        std::vector<vk::ShaderModule> modules;
+        std::vector<std::string> entryPoints;
+        std::vector<vk::PipelineShaderStageCreateInfo> stages;
+        entryPoints.reserve(compiled.size());
+        Built built;
+        try
+        {
+            for (std::size_t i = 0; i < compiled.size(); ++i)
+            {
+                const std::vector<std::uint32_t> &spirv = compiled[i]->spirv;
+                modules.push_back(raw.createShaderModule({{}, spirv.size() * sizeof(std::uint32_t), spirv.data()}, nullptr, dispatcher));
+                std::string entryPoint = shader::spirvEntryPointName(spirv);
+                entryPoints.push_back(entryPoint.empty() ? desc.stages[i].request.entryPoint : std::move(entryPoint));
+                stages.push_back({{}, desc.stages[i].stage, modules.back(), entryPoints.back().c_str()});
+                built.dependencies.insert(built.dependencies.end(), compiled[i]->dependencies.begin(), compiled[i]->dependencies.end());
+            }
+            PipelineCreationFeedback feedback;
+            const vk::Pipeline pipeline = desc.build(*device, cache->threadCache(), stages, feedback);
+            cache->record(feedback);
+            if (pipeline)
+                built.pipeline = resources->adoptPipeline(pipeline, desc.layout, desc.bindPoint);
+            else
+                nrInfo(LogLevel::warning)("The builder of the '{}' pipeline returned no pipeline.", desc.name);
+        }
+        catch (std::exception const &error)
+        {
+            nrInfo(LogLevel::warning)("Failed to create the '{}' pipeline: {}", desc.name, error.what());
+        }
+        // the pipeline keeps what it needs; the modules only have to outlive its creation
+        for (vk::ShaderModule const module : modules)
+            raw.destroyShaderModule(module, nullptr, dispatcher);
+        if (!built.pipeline)
+            return std::nullopt;
+        return built;
+    }
+
+    void rebuild(std::vector<Rebuild> const &batch)
+    {
+        auto zone = nrZone("rebuild pipelines");
+        // a module shared by several of the pipelines is compiled once
+        std::vector<shader::ShaderRequest> requests;
+        for (Rebuild const &r : batch)
+        {
+            for (ShaderStage const &stage : r.desc->stages)
+            {
+                if (!std::ranges::contains(requests, stage.request))
+                    requests.push_back(stage.request);
+            }
+        }
+        const std::vector<std::optional<shader::CompiledShader>> compiled = compiler->compileAll(requests, *jobs);
+
+        for (Rebuild const &r : batch)
+        {
+            reloads.fetch_add(1, std::memory_order_relaxed);
+            std::vector<shader::CompiledShader const *> stages;
+            for (ShaderStage const &stage : r.desc->stages)
+            {
+                std::optional<shader::CompiledShader> const &result = compiled[static_cast<std::size_t>(std::ranges::find(requests, stage.request) - requests.begin())];
+                if (!result)
+                    break;
+                stages.push_back(&*result);
+            }
+            std::optional<Built> built = stages.size() == r.desc->stages.size() ? build(*r.desc, stages) : std::nullopt;
+            if (!built)
+            {
+                failedReloads.fetch_add(1, std::memory_order_relaxed);
+                nrInfo(LogLevel::warning)("Reloading the '{}' pipeline failed; the previous one stays in use.", r.desc->name);
+                continue;
+            }
+            std::scoped_lock lock(readyMutex);
+            ready.push_back({r.id, r.serial, built->pipeline, std::move(built->dependencies)});
+        }
+    }
+
+    vk::raii::Device const *device;
+    ResourcePools *resources;
+    PipelineCache *cache;
+    shader::ShaderCompiler *compiler;
+    JobSystem *jobs;
+
+    mutable std::shared_mutex mutex;
+    // description, current pipeline, serial of the rebuild that produced it (0 for the first build)
+    HandlePool<ShaderPipelineTag, std::shared_ptr<const ShaderPipelineDesc>, PipelineId, std::uint64_t> entries;
+    shader::ShaderDependencyGraph<ShaderPipelineId> dependencies;
+    std::uint64_t nextSerial = 0;
+
+    std::mutex readyMutex;
+    std::vector<Ready> ready;
+    JobCounter pendingBuilds;
+    std::atomic<std::uint64_t> reloads = 0;
+    std::atomic<std::uint64_t> failedReloads = 0;
+    // last, so no change arrives while the rest is torn down
+    std::optional<shader::ShaderWatcher> watcher;
+};
+
+} // namespace nr::rhi
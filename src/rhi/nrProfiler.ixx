@@ -0,0 +1,275 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+export module nr.rhi.profiler;
+import nr.rhi.queue;
+import nr.rhi.frame;
+import nr.utils;
+import std;
+
+export namespace nr::rhi
+{
+
+struct GpuZoneStatistics
+{
+    std::string name;
+    std::uint64_t count = 0;
+    double totalMs = 0.0;
+    double maxMs = 0.0;
+};
+
+class GpuProfiler;
+
+// Brackets GPU work recorded on `cmd` with a pair of timestamps (and a debug-utils label in debug builds). A null
+// profiler makes it a no-op, so call sites don't need to branch.
+class GpuZone
+{
+  public:
+    GpuZone(GpuProfiler *profiler, vk::raii::CommandBuffer const &cmd, std::string_view name);
+    GpuZone(const GpuZone &) = delete;
+    GpuZone &operator=(const GpuZone &) = delete;
+    ~GpuZone();
+
+  private:
+    GpuProfiler *profiler;
+    vk::raii::CommandBuffer const *cmd;
+    std::uint32_t zone;
+};
+
+// Timestamp queries with one query pool per frame in flight. Zones take their query pair from the current frame's
+// pool with an atomic increment, so any recording thread may open them. A frame's results are read when its slot comes
+// round again in beginFrame(); the FrameRing has already waited for that frame, so reading never stalls, and the pool
+// is then reset from the host (hostQueryReset). Ticks are converted with timestampPeriod and placed on the CPU clock
+// through a calibration point and handed to the recording TraceSession, so GPU zones land in the same trace and on the
+// same timeline as the nrZone CPU zones. The two clocks drift apart, so beginFrame() recalibrates periodically: with
+// VK_EXT_calibrated_timestamps enabled (`calibratedTimestamps`) by reading the device clock directly, otherwise through
+// a timestamp submit, which waits for the queue and therefore runs less often. Frames still in flight are resolved
+// by flush() or at destruction.
+class GpuProfiler
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    GpuProfiler(vk::raii::Device const &device, vk::raii::PhysicalDevice const &physicalDevice, Queue &queue, std::uint32_t framesInFlight, bool calibratedTimestamps = false,
+                std::uint32_t maxZonesPerFrame = 1024)
+        : device(&device), queue(&queue), maxZones(maxZonesPerFrame)
+    {
+        timestampPeriod = physicalDevice.getProperties().limits.timestampPeriod;
+        const std::uint32_t validBits = physicalDevice.getQueueFamilyProperties()[queue.queueFamilyIndex()].timestampValidBits;
+        nrAssert(validBits != 0)("Queue family {} does not support timestamps; GPU zones will read as zero.", queue.queueFamilyIndex());
+        timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+        slots.resize(framesInFlight);
+        for (FrameSlot &slot : slots)
+        {
+            slot.pool = vk::raii::QueryPool(device, vk::QueryPoolCreateInfo({}, vk::QueryType::eTimestamp, 2 * maxZones));
+            slot.pool.reset(0, 2 * maxZones);
+            slot.zones = std::vector<ZoneRecord>(maxZones);
+        }
+        useDeviceClock = calibratedTimestamps && std::ranges::contains(physicalDevice.getCalibrateableTimeDomainsEXT(), vk::TimeDomainEXT::eDevice);
+        recalibrationInterval = useDeviceClock ? std::chrono::seconds(1) : std::chrono::seconds(10);
+        calibrate();
+    }
+    GpuProfiler(const GpuProfiler &) = delete;
+    GpuProfiler &operator=(const GpuProfiler &) = delete;
+    ~GpuProfiler()
+    {
+        try
+        {
+            flush();
+        }
+        catch (vk::SystemError const &error)
+        {
+            nrInfo(LogLevel::warning)("GPU profiler dropped the frames still in flight: {}", error.what());
+        }
+    }
+
+    // call right after FrameRing::beginFrame with the same frame number
+    void beginFrame(std::uint64_t frameNumber)
+    {
+        FrameSlot &slot = slots[frameNumber % slots.size()];
+        resolve(slot);
+        slot.frameNumber = frameNumber;
+        current = &slot;
+        if (Clock::now() - calibrationTime >= recalibrationInterval)
+            calibrate();
+    }
+
+    // waits for the queue and resolves every frame still in flight, oldest first; call before report() at shutdown
+    void flush()
+    {
+        queue->waitIdle();
+        std::vector<FrameSlot *> pending = slots | std::views::transform([](FrameSlot &slot) { return &slot; }) | std::ranges::to<std::vector>();
+        std::ranges::sort(pending, {}, [](FrameSlot const *slot) { return slot->frameNumber; });
+        for (FrameSlot *slot : pending)
+            resolve(*slot);
+    }
+
+    [[nodiscard]] GpuZone zone(vk::raii::CommandBuffer const &cmd, std::string_view name)
+    {
+        return GpuZone(this, cmd, name);
+    }
+
+    // per-name GPU time over every resolved frame, most expensive first
+    [[nodiscard]] std::vector<GpuZoneStatistics> statistics() const
+    {
+        std::scoped_lock lock(mutex);
+        std::vector<GpuZoneStatistics> result = zoneStatistics | std::views::values | std::ranges::to<std::vector>();
+        std::ranges::sort(result, std::ranges::greater{}, &GpuZoneStatistics::totalMs);
+        return result;
+    }
+
+    void report() const
+    {
+        std::string table;
+        for (GpuZoneStatistics const &s : statistics())
+        {
+            table += std::format("\n    {:<32} {:>7} zones  avg {:>8.3f} ms  max {:>8.3f} ms", s.name, s.count, s.count ? s.totalMs / s.count : 0.0, s.maxMs);
+        }
+        nrInfo()("GPU zones ({} dropped):{}", droppedZones.load(std::memory_order_relaxed), table);
+    }
+
+  private:
+    friend class GpuZone;
+
+    struct ZoneRecord
+    {
+        std::string name;
+    };
+
+    struct FrameSlot
+    {
+        vk::raii::QueryPool pool = {nullptr};
+        std::vector<ZoneRecord> zones;
+        std::atomic<std::uint32_t> zoneCount = 0;
+        std::uint64_t frameNumber = 0;
+
+        FrameSlot() = default;
+        FrameSlot(FrameSlot &&other) noexcept : pool(std::move(other.pool)), zones(std::move(other.zones)), zoneCount(other.zoneCount.load()), frameNumber(other.frameNumber)
+        {
+        }
+    };
+
+    // returns slot * maxZones + zone, or ~0u if the frame's pool is exhausted; the slot is kept so a zone that is
+    // closed after the next beginFrame still ends in the pool it began in
+    std::uint32_t openZone(vk::raii::CommandBuffer const &cmd, std::string_view name)
+    {
+        FrameSlot *slot = current;
+        if (!slot)
+            return ~0u;
+        const std::uint32_t zone = slot->zoneCount.fetch_add(1, std::memory_order_relaxed);
+        if (zone >= maxZones)
+        {
+            droppedZones.fetch_add(1, std::memory_order_relaxed);
+            return ~0u;
+        }
+        slot->zones[zone].name = name;
+        if constexpr (isDebugMode())
+            cmd.beginDebugUtilsLabelEXT(vk::DebugUtilsLabelEXT(slot->zones[zone].name.c_str()));
+        cmd.writeTimestamp2(vk::PipelineStageFlagBits2::eTopOfPipe, *slot->pool, 2 * zone);
+        return static_cast<std::uint32_t>(slot - slots.data()) * maxZones + zone;
+    }
+
+    void closeZone(vk::raii::CommandBuffer const &cmd, std::uint32_t zone)
+    {
+        if (zone == ~0u)
+            return;
+        cmd.writeTimestamp2(vk::PipelineStageFlagBits2::eBottomOfPipe, *slots[zone / maxZones].pool, 2 * (zone % maxZones) + 1);
+        if constexpr (isDebugMode())
+            cmd.endDebugUtilsLabelEXT();
+    }
+
+    void resolve(FrameSlot &slot)
+    {
+        const std::uint32_t count = std::min(slot.zoneCount.exchange(0, std::memory_order_relaxed), maxZones);
+        if (count == 0)
+            return;
+        // [timestamp, availability] per query
+        auto [result, data] = slot.pool.getResults<std::uint64_t>(0, 2 * count, 2 * count * 2 * sizeof(std::uint64_t), 2 * sizeof(std::uint64_t), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWithAvailability);
+        {
+            std::scoped_lock lock(mutex);
+            for (std::uint32_t zone = 0; zone < count; ++zone)
+            {
+                const std::uint64_t begin = data[4 * zone], beginAvailable = data[4 * zone + 1];
+                const std::uint64_t end = data[4 * zone + 2], endAvailable = data[4 * zone + 3];
+                // zones opened but never submitted (e.g. a skipped frame) stay unavailable
+                if (!beginAvailable || !endAvailable)
+                    continue;
+                const double durationMs = static_cast<double>((end - begin) & timestampMask) * timestampPeriod / 1e6;
+                std::string const &name = slot.zones[zone].name;
+                GpuZoneStatistics &stats = zoneStatistics[name];
+                stats.name = name;
+                ++stats.count;
+                stats.totalMs += durationMs;
+                stats.maxMs = std::max(stats.maxMs, durationMs);
+                const Clock::time_point beginTime = gpuToTime(begin);
+                traceExternalZone("GPU", name, beginTime, beginTime + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(durationMs)));
+            }
+        }
+        slot.pool.reset(0, 2 * count);
+    }
+
+    // Pins one GPU tick to the CPU clock at the midpoint of the CPU reads around it. Reading the device clock takes
+    // microseconds; the fallback timestamp lands somewhere between submit and wait returning, so its midpoint is off by
+    // at most half that round trip.
+    void calibrate()
+    {
+        if (useDeviceClock)
+        {
+            const Clock::time_point before = Clock::now();
+            const std::uint64_t ticks = device->getCalibratedTimestampEXT(vk::CalibratedTimestampInfoEXT(vk::TimeDomainEXT::eDevice)).first;
+            const Clock::time_point after = Clock::now();
+            calibrationTicks = ticks;
+            calibrationTime = before + (after - before) / 2;
+            return;
+        }
+        Command command(*device, queue->queueFamilyIndex());
+        vk::raii::QueryPool pool(*device, vk::QueryPoolCreateInfo({}, vk::QueryType::eTimestamp, 1));
+        pool.reset(0, 1);
+        vk::raii::CommandBuffer &cmd = command.acquire();
+        cmd.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+        cmd.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands, *pool, 0);
+        cmd.end();
+        const vk::CommandBuffer cmdHandle = *cmd;
+        const Clock::time_point before = Clock::now();
+        queue->wait(queue->submit({.commandBuffers = {&cmdHandle, 1}}).value);
+        const Clock::time_point after = Clock::now();
+        calibrationTicks = pool.getResult<std::uint64_t>(0, 1, sizeof(std::uint64_t), vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait).second;
+        calibrationTime = before + (after - before) / 2;
+    }
+
+    Clock::time_point gpuToTime(std::uint64_t ticks) const
+    {
+        // signed distance in the valid bit range, so timestamps just before the calibration point work too
+        const std::uint64_t delta = (ticks - calibrationTicks) & timestampMask;
+        const double signedTicks = delta > timestampMask / 2 ? -static_cast<double>((calibrationTicks - ticks) & timestampMask) : static_cast<double>(delta);
+        return calibrationTime + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::nano>(signedTicks * timestampPeriod));
+    }
+
+    vk::raii::Device const *device;
+    Queue *queue;
+    std::uint32_t maxZones;
+    float timestampPeriod = 1.0f;
+    std::uint64_t timestampMask = ~0ull;
+    bool useDeviceClock = false;
+    Clock::duration recalibrationInterval{};
+    std::uint64_t calibrationTicks = 0;
+    Clock::time_point calibrationTime;
+
+    std::vector<FrameSlot> slots;
+    FrameSlot *current = nullptr;
+    std::atomic<std::uint64_t> droppedZones = 0;
+
+    mutable std::mutex mutex;
+    std::map<std::string, GpuZoneStatistics, std::less<>> zoneStatistics;
+};
+
+inline GpuZone::GpuZone(GpuProfiler *profiler, vk::raii::CommandBuffer const &cmd, std::string_view name) : profiler(profiler), cmd(&cmd), zone(profiler ? profiler->openZone(cmd, name) : ~0u)
+{
+}
+inline GpuZone::~GpuZone()
+{
+    if (profiler)
+        profiler->closeZone(*cmd, zone);
+}
+
+} // namespace nr::rhi
@@ -0,0 +1,278 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+export module nr.rhi.queue;
+import nr.rhi.vk;
+import nr.utils;
+import std;
+
+export namespace nr::rhi
+{
+
+// A value on a queue's timeline semaphore; reached once everything submitted up to it has finished on the GPU
+struct SubmitPoint
+{
+    vk::Semaphore timeline;
+    std::uint64_t value = 0;
+    explicit operator bool() const
+    {
+        return static_cast<bool>(timeline);
+    }
+};
+
+// cross-queue dependency: the submission waits at `stages` until `point` is reached
+struct QueueWait
+{
+    SubmitPoint point;
+    vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eAllCommands;
+};
+
+struct SubmitDesc
+{
+    std::span<const vk::CommandBuffer> commandBuffers;
+    std::span<const QueueWait> waits;
+    // binary semaphores (swapchain acquire/present) that cannot be expressed as SubmitPoints
+    std::span<const vk::SemaphoreSubmitInfo> extraWaits;
+    std::span<const vk::SemaphoreSubmitInfo> extraSignals;
+    vk::PipelineStageFlags2 signalStages = vk::PipelineStageFlagBits2::eAllCommands;
+};
+
+// One VkQueue plus its timeline semaphore. Every submission signals the next timeline value, so a SubmitPoint is all
+// another queue or the host needs to synchronize with it. enqueue() only records the batch; flush() hands all pending
+// batches to the driver in a single vkQueueSubmit2. All members are safe to call from any thread.
+class Queue
+{
+  public:
+    Queue(vk::raii::Device const &device, QueueKind kind, std::uint32_t familyIndex, std::uint32_t queueIndex = 0) : device(&device), queue(device, familyIndex, queueIndex), kind(kind), familyIndex(familyIndex)
+    {
+        vk::StructureChain<vk::SemaphoreCreateInfo, vk::SemaphoreTypeCreateInfo> semaphoreCreateInfo({}, {vk::SemaphoreType::eTimeline, 0});
+        timeline = vk::raii::Semaphore(device, semaphoreCreateInfo.get<vk::SemaphoreCreateInfo>());
+    }
+    Queue(const Queue &) = delete;
+    Queue &operator=(const Queue &) = delete;
+    ~Queue()
+    {
+        // the timeline semaphore must outlive every submission that signals it
+        std::scoped_lock lock(mutex);
+        flushLocked({});
+        waitLocked(lastSubmitted);
+    }
+
+    SubmitPoint enqueue(SubmitDesc const &desc)
+    {
+        std::scoped_lock lock(mutex);
+        return enqueueLocked(desc);
+    }
+
+    void flush(vk::Fence fence = {})
+    {
+        std::scoped_lock lock(mutex);
+        flushLocked(fence);
+    }
+
+    // enqueue + flush, submitted together with whatever other threads have batched so far
+    SubmitPoint submit(SubmitDesc const &desc, vk::Fence fence = {})
+    {
+        std::scoped_lock lock(mutex);
+        SubmitPoint point = enqueueLocked(desc);
+        flushLocked(fence);
+        return point;
+    }
+
+    // pending batches are flushed first so the presented image is never ahead of its rendering
+    vk::Result present(vk::PresentInfoKHR const &presentInfo)
+    {
+        std::scoped_lock lock(mutex);
+        flushLocked({});
+        return queue.presentKHR(presentInfo);
+    }
+
+    [[nodiscard]] std::uint64_t completedValue() const
+    {
+        return timeline.getCounterValue();
+    }
+    [[nodiscard]] bool isComplete(std::uint64_t value) const
+    {
+        return completedValue() >= value;
+    }
+    void wait(std::uint64_t value, std::uint64_t timeout = std::numeric_limits<std::uint64_t>::max()) const
+    {
+        if (value == 0)
+            return;
+        const vk::Semaphore semaphore = *timeline;
+        vk::detail::resultCheck(device->waitSemaphores(vk::SemaphoreWaitInfo({}, semaphore, value), timeout), "Failed to wait for queue timeline");
+    }
+    void waitIdle()
+    {
+        std::scoped_lock lock(mutex);
+        flushLocked({});
+        waitLocked(lastSubmitted);
+    }
+
+    // newest point handed to the driver; safe to wait on
+    [[nodiscard]] SubmitPoint lastSubmittedPoint() const
+    {
+        std::scoped_lock lock(mutex);
+        return {*timeline, lastSubmitted};
+    }
+    // newest point enqueued, possibly not flushed yet: right for retiring resources recorded into that work, but a
+    // wait on it blocks until some thread flushes
+    [[nodiscard]] SubmitPoint lastEnqueuedPoint() const
+    {
+        std::scoped_lock lock(mutex);
+        return {*timeline, lastEnqueued};
+    }
+    [[nodiscard]] QueueKind queueKind() const
+    {
+        return kind;
+    }
+    [[nodiscard]] std::uint32_t queueFamilyIndex() const
+    {
+        return familyIndex;
+    }
+    [[nodiscard]] vk::Queue handle() const
+    {
+        return *queue;
+    }
+
+  private:
+    struct Batch
+    {
+        std::vector<vk::SemaphoreSubmitInfo> waits;
+        std::vector<vk::CommandBufferSubmitInfo> commandBuffers;
+        std::vector<vk::SemaphoreSubmitInfo> signals;
+    };
+
+    SubmitPoint enqueueLocked(SubmitDesc const &desc)
+    {
+        Batch &batch = pending.emplace_back();
+        batch.waits = desc.waits | std::views::filter([](QueueWait const &w) { return static_cast<bool>(w.point); }) |
+                      std::views::transform([](QueueWait const &w) { return vk::SemaphoreSubmitInfo(w.point.timeline, w.point.value, w.stages); }) | std::ranges::to<std::vector>();
+        batch.waits.append_range(desc.extraWaits);
+        batch.commandBuffers = desc.commandBuffers | std::views::transform([](vk::CommandBuffer cmd) { return vk::CommandBufferSubmitInfo(cmd); }) | std::ranges::to<std::vector>();
+        batch.signals.emplace_back(*timeline, ++lastEnqueued, desc.signalStages);
+        batch.signals.append_range(desc.extraSignals);
+        return {*timeline, lastEnqueued};
+    }
+
+    void flushLocked(vk::Fence fence)
+    {
+        if (pending.empty() && !fence)
+            return;
+        std::vector<vk::SubmitInfo2> submitInfos = pending | std::views::transform([](Batch const &b) { return vk::SubmitInfo2({}, b.waits, b.commandBuffers, b.signals); }) | std::ranges::to<std::vector>();
+        queue.submit2(submitInfos, fence);
+        pending.clear();
+        lastSubmitted = lastEnqueued;
+    }
+
+    void waitLocked(std::uint64_t value) const
+    {
+        if (*timeline)
+            wait(value);
+    }
+
+    vk::raii::Device const *device;
+    vk::raii::Queue queue;
+    vk::raii::Semaphore timeline = {nullptr};
+    QueueKind kind;
+    std::uint32_t familyIndex;
+
+    mutable std::mutex mutex;
+    std::uint64_t lastEnqueued = 0;
+    // last value flushed to the driver; lags lastEnqueued while batches are pending
+    std::uint64_t lastSubmitted = 0;
+    std::vector<Batch> pending;
+};
+
+// Submission objects for the graphics, compute and transfer QueueKinds, possibly several queues per kind. Kinds whose
+// granted (family, index) pairs coincide share one Queue (and thus one lock and one timeline) because a VkQueue must be
+// externally synchronized; distinct queues never contend, so threads spread over forThread() submit in parallel.
+class QueueSystem
+{
+  public:
+    static constexpr std::array<QueueKind, 3> wrappedKinds{QueueKind::graphics, QueueKind::compute, QueueKind::transfer};
+    static constexpr size_t kindCount = static_cast<size_t>(QueueKind::size);
+
+    QueueSystem(vk::raii::Device const &device, std::span<const size_t, kindCount> queueFamilyDict, std::span<const std::vector<std::uint32_t>, kindCount> queueIndexDict) : device(&device)
+    {
+        for (QueueKind kind : wrappedKinds)
+        {
+            const auto family = static_cast<std::uint32_t>(queueFamilyDict[static_cast<size_t>(kind)]);
+            for (std::uint32_t index : queueIndexDict[static_cast<size_t>(kind)])
+            {
+                auto it = std::ranges::find_if(queues, [&](auto const &q) { return q.family == family && q.index == index; });
+                if (it == queues.end())
+                    it = queues.insert(queues.end(), Slot{family, index, std::make_unique<Queue>(device, kind, family, index)});
+                byKind[static_cast<size_t>(kind)].push_back(it->queue.get());
+            }
+        }
+    }
+    QueueSystem(const QueueSystem &) = delete;
+    QueueSystem &operator=(const QueueSystem &) = delete;
+
+    // the first (highest priority by convention) queue of `kind`
+    [[nodiscard]] Queue &operator[](QueueKind kind) const
+    {
+        return at(kind, 0);
+    }
+
+    [[nodiscard]] Queue &at(QueueKind kind, size_t index) const
+    {
+        auto const &list = byKind[static_cast<size_t>(kind)];
+        nrAssert(index < list.size())("Queue kind {} has no queue #{} ({} granted).", static_cast<size_t>(kind), index, list.size());
+        return *list[index];
+    }
+
+    [[nodiscard]] size_t count(QueueKind kind) const
+    {
+        return byKind[static_cast<size_t>(kind)].size();
+    }
+
+    // A stable queue of `kind` for the calling thread. Threads are dealt out round-robin, so recording threads land on
+    // different queues as long as enough were requested.
+    [[nodiscard]] Queue &forThread(QueueKind kind) const
+    {
+        static std::atomic<size_t> nextThreadSlot = 0;
+        thread_local const size_t threadSlot = nextThreadSlot.fetch_add(1, std::memory_order_relaxed);
+        return at(kind, threadSlot % count(kind));
+    }
+
+    // true if `kind` runs on its own queue and can overlap with graphics work
+    [[nodiscard]] bool isDedicated(QueueKind kind) const
+    {
+        return kind == QueueKind::graphics || std::ranges::none_of(byKind[static_cast<size_t>(kind)], [this](Queue *q) { return std::ranges::contains(byKind[static_cast<size_t>(QueueKind::graphics)], q); });
+    }
+
+    void flushAll()
+    {
+        std::ranges::for_each(queues, [](auto &q) { q.queue->flush(); });
+    }
+
+    void waitIdle()
+    {
+        std::ranges::for_each(queues, [](auto &q) { q.queue->waitIdle(); });
+    }
+
+    // host wait until every point is reached
+    void wait(std::span<const SubmitPoint> points, std::uint64_t timeout = std::numeric_limits<std::uint64_t>::max()) const
+    {
+        auto valid = points | std::views::filter([](SubmitPoint const &p) { return static_cast<bool>(p); });
+        std::vector<vk::Semaphore> semaphores = valid | std::views::transform(&SubmitPoint::timeline) | std::ranges::to<std::vector>();
+        std::vector<std::uint64_t> values = valid | std::views::transform(&SubmitPoint::value) | std::ranges::to<std::vector>();
+        if (semaphores.empty())
+            return;
+        vk::detail::resultCheck(device->waitSemaphores(vk::SemaphoreWaitInfo({}, semaphores, values), timeout), "Failed to wait for submit points");
+    }
+
+  private:
+    struct Slot
+    {
+        std::uint32_t family;
+        std::uint32_t index;
+        std::unique_ptr<Queue> queue;
+    };
+    vk::raii::Device const *device;
+    std::vector<Slot> queues;
+    std::array<std::vector<Queue *>, kindCount> byKind{};
+};
+
+} // namespace nr::rhi
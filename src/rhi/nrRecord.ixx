@@ -0,0 +1,82 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+export module nr.rhi.record;
+import nr.rhi.frame;
+import nr.utils;
+import std;
+
+export namespace nr::rhi
+{
+
+// Fills one command buffer; it is already begun and is ended by the recorder
+using RecordJob = std::function<void(vk::raii::CommandBuffer &)>;
+
+// Splits a frame's recording into jobs executed on the job system. A job records from
+// FrameContext::commands(JobSystem::currentSlot()), so no pool is ever touched by two threads at once; the calling
+// thread helps and records from the external slot. `maxThreads` caps how many threads record at the same time.
+class ParallelRecorder
+{
+  public:
+    explicit ParallelRecorder(std::uint32_t threadLimit = std::numeric_limits<std::uint32_t>::max(), JobSystem &system = JobSystem::instance()) : jobs(&system), maxThreads(std::clamp(threadLimit, 1u, system.slotCount()))
+    {
+    }
+
+    // number of command pools a FrameContext needs for record()
+    [[nodiscard]] std::uint32_t threadCount() const
+    {
+        return jobs->slotCount();
+    }
+    [[nodiscard]] std::uint32_t concurrency() const
+    {
+        return maxThreads;
+    }
+
+    // Records every job into its own buffer of `level` and returns the buffers in job order, ready for
+    // vkCmdExecuteCommands (secondary) or a single SubmitDesc (primary). `frame` needs threadCount() pools.
+    std::vector<vk::CommandBuffer> record(FrameContext &frame, std::span<const RecordJob> recordJobs, vk::CommandBufferLevel level = vk::CommandBufferLevel::eSecondary,
+                                          vk::CommandBufferInheritanceInfo const &inheritance = {})
+    {
+        nrAssert(frame.threadCommands.size() >= threadCount())("FrameContext has {} command pools, recorder needs {}.", frame.threadCommands.size(), threadCount());
+        std::vector<vk::CommandBuffer> results(recordJobs.size());
+        if (recordJobs.empty())
+            return results;
+
+        auto recordRange = [&](std::size_t first, std::size_t last) {
+            Command &commands = frame.commands(jobs->currentSlot());
+            for (std::size_t i = first; i < last; ++i)
+            {
+                auto zone = nrZone("record job");
+                vk::raii::CommandBuffer &cmd = commands.acquire(level);
+                cmd.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit, level == vk::CommandBufferLevel::eSecondary ? &inheritance : nullptr});
+                recordJobs[i](cmd);
+                cmd.end();
+                results[i] = *cmd;
+            }
+        };
+        // exactly one range per thread allowed to record, the first one on the calling thread, so no more than
+        // maxThreads ever record at once
+        const std::size_t count = recordJobs.size();
+        const std::size_t pieces = std::min<std::size_t>(maxThreads, count);
+        JobCounter counter;
+        for (std::size_t p = 1; p < pieces; ++p)
+            jobs->run(counter, [&recordRange, count, pieces, p] { recordRange(count * p / pieces, count * (p + 1) / pieces); });
+        try
+        {
+            recordRange(0, count / pieces);
+        }
+        catch (...)
+        {
+            // the other ranges still reference this frame
+            jobs->wait(counter);
+            throw;
+        }
+        jobs->wait(counter);
+        return results;
+    }
+
+  private:
+    JobSystem *jobs;
+    std::uint32_t maxThreads;
+};
+
+} // namespace nr::rhi
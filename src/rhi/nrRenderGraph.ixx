@@ -0,0 +1,732 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+export module nr.rhi.renderGraph;
+import nr.rhi.memory;
+import nr.rhi.profiler;
+import nr.utils;
+import std;
+
+export namespace nr::rhi
+{
+
+// How a pass touches a resource. Each maps to the synchronization2 stages and access it needs and, for images, to
+// the layout it expects.
+enum class Access
+{
+    colorAttachmentWrite,
+    depthAttachmentWrite,
+    depthAttachmentRead,
+    sampledRead,
+    storageRead,
+    storageWrite,
+    transferRead,
+    transferWrite,
+    vertexInputRead,
+    indirectRead,
+    uniformRead,
+};
+
+struct AccessInfo
+{
+    vk::PipelineStageFlags2 stages;
+    vk::AccessFlags2 access;
+    vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+    vk::ImageUsageFlags imageUsage;
+    vk::BufferUsageFlags bufferUsage;
+    bool write = false;
+};
+
+constexpr AccessInfo accessInfo(Access access)
+{
+    using S = vk::PipelineStageFlagBits2;
+    using A = vk::AccessFlagBits2;
+    using L = vk::ImageLayout;
+    constexpr vk::PipelineStageFlags2 shaderStages = S::eVertexShader | S::eFragmentShader | S::eComputeShader;
+    constexpr vk::PipelineStageFlags2 depthStages = S::eEarlyFragmentTests | S::eLateFragmentTests;
+    switch (access)
+    {
+    case Access::colorAttachmentWrite:
+        return {S::eColorAttachmentOutput, A::eColorAttachmentRead | A::eColorAttachmentWrite, L::eColorAttachmentOptimal, vk::ImageUsageFlagBits::eColorAttachment, {}, true};
+    case Access::depthAttachmentWrite:
+        return {depthStages, A::eDepthStencilAttachmentRead | A::eDepthStencilAttachmentWrite, L::eDepthStencilAttachmentOptimal, vk::ImageUsageFlagBits::eDepthStencilAttachment, {}, true};
+    case Access::depthAttachmentRead:
+        return {depthStages, A::eDepthStencilAttachmentRead, L::eDepthStencilReadOnlyOptimal, vk::ImageUsageFlagBits::eDepthStencilAttachment, {}, false};
+    case Access::sampledRead:
+        return {shaderStages, A::eShaderSampledRead, L::eShaderReadOnlyOptimal, vk::ImageUsageFlagBits::eSampled, {}, false};
+    case Access::storageRead:
+        return {shaderStages, A::eShaderStorageRead, L::eGeneral, vk::ImageUsageFlagBits::eStorage, vk::BufferUsageFlagBits::eStorageBuffer, false};
+    case Access::storageWrite:
+        return {shaderStages, A::eShaderStorageRead | A::eShaderStorageWrite, L::eGeneral, vk::ImageUsageFlagBits::eStorage, vk::BufferUsageFlagBits::eStorageBuffer, true};
+    case Access::transferRead:
+        return {S::eAllTransfer, A::eTransferRead, L::eTransferSrcOptimal, vk::ImageUsageFlagBits::eTransferSrc, vk::BufferUsageFlagBits::eTransferSrc, false};
+    case Access::transferWrite:
+        return {S::eAllTransfer, A::eTransferWrite, L::eTransferDstOptimal, vk::ImageUsageFlagBits::eTransferDst, vk::BufferUsageFlagBits::eTransferDst, true};
+    case Access::vertexInputRead:
+        return {S::eVertexInput, A::eVertexAttributeRead | A::eIndexRead, L::eUndefined, {}, vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer, false};
+    case Access::indirectRead:
+        return {S::eDrawIndirect, A::eIndirectCommandRead, L::eUndefined, {}, vk::BufferUsageFlagBits::eIndirectBuffer, false};
+    case Access::uniformRead:
+        return {shaderStages, A::eUniformRead, L::eUndefined, {}, vk::BufferUsageFlagBits::eUniformBuffer, false};
+    }
+    return {};
+}
+
+struct ImageHandle
+{
+    std::uint32_t index = ~0u;
+    explicit operator bool() const
+    {
+        return index != ~0u;
+    }
+};
+
+struct BufferHandle
+{
+    std::uint32_t index = ~0u;
+    explicit operator bool() const
+    {
+        return index != ~0u;
+    }
+};
+
+// A render target that only exists inside the graph; its usage flags are derived from the passes that touch it
+struct TransientImageDesc
+{
+    vk::Format format = vk::Format::eR8G8B8A8Unorm;
+    vk::Extent2D extent;
+    std::uint32_t mipLevels = 1;
+    std::uint32_t arrayLayers = 1;
+    vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+};
+
+struct RenderGraphStatistics
+{
+    std::uint32_t declaredPasses = 0;
+    std::uint32_t livePasses = 0;
+    std::uint32_t barrierBatches = 0;
+    std::uint32_t imageBarriers = 0;
+    std::uint32_t memoryBarriers = 0;
+    std::uint32_t transientImages = 0;
+    std::uint32_t memoryBlocks = 0;
+    // sum of the transient images' own requirements vs. what was allocated after aliasing
+    vk::DeviceSize transientBytes = 0;
+    vk::DeviceSize allocatedBytes = 0;
+};
+
+// Frame structure declared as passes in execution order. Each pass lists the images and buffers it reads and writes;
+// compile() then
+//   - culls passes whose results never reach an imported resource, an output or a pass with side effects,
+//   - plans one vkCmdPipelineBarrier2 per pass that batches every layout transition and hazard it needs
+//     (buffers share a single global memory barrier), skipping read-after-read entirely,
+//   - places transient images whose live ranges don't overlap into the same MemoryBlock.
+// The compiled graph is recorded every frame with execute(); imported images may be rebound per frame (swapchain)
+// with setImportedImage(). All passes run on one queue; submission order alone orders nothing on the GPU, but a barrier's
+// first scope reaches back into earlier submissions, so each transient's first use in a frame also waits for its last
+// use in the frame before.
+class RenderGraph
+{
+  public:
+    using Execute = std::function<void(vk::raii::CommandBuffer const &, RenderGraph const &)>;
+
+    class PassBuilder
+    {
+      public:
+        PassBuilder &read(ImageHandle image, Access access)
+        {
+            nrAssert(!accessInfo(access).write)("Pass '{}' declares a write access as a read.", graph->passes[pass].name);
+            graph->use(pass, ResourceType::image, image.index, access);
+            return *this;
+        }
+        PassBuilder &write(ImageHandle image, Access access)
+        {
+            nrAssert(accessInfo(access).write)("Pass '{}' declares a read access as a write.", graph->passes[pass].name);
+            graph->use(pass, ResourceType::image, image.index, access);
+            return *this;
+        }
+        PassBuilder &read(BufferHandle buffer, Access access)
+        {
+            nrAssert(!accessInfo(access).write)("Pass '{}' declares a write access as a read.", graph->passes[pass].name);
+            graph->use(pass, ResourceType::buffer, buffer.index, access);
+            return *this;
+        }
+        PassBuilder &write(BufferHandle buffer, Access access)
+        {
+            nrAssert(accessInfo(access).write)("Pass '{}' declares a read access as a write.", graph->passes[pass].name);
+            graph->use(pass, ResourceType::buffer, buffer.index, access);
+            return *this;
+        }
+        // never culled, e.g. readbacks or work observed outside the graph
+        PassBuilder &sideEffects()
+        {
+            graph->passes[pass].sideEffects = true;
+            return *this;
+        }
+
+      private:
+        friend class RenderGraph;
+        PassBuilder(RenderGraph *graph, std::uint32_t pass) : graph(graph), pass(pass)
+        {
+        }
+        RenderGraph *graph;
+        std::uint32_t pass;
+    };
+
+    RenderGraph(vk::raii::Device const &device, MemoryAllocator const &memory) : device(&device), memory(&memory)
+    {
+    }
+    RenderGraph(const RenderGraph &) = delete;
+    RenderGraph &operator=(const RenderGraph &) = delete;
+
+    // `initialLayout` is what the image is in when the graph starts; it is left in `finalLayout` (eUndefined: wherever the last pass left it)
+    ImageHandle importImage(std::string name, vk::Image image, vk::ImageView view, vk::Format format, vk::Extent2D extent, vk::ImageLayout initialLayout = vk::ImageLayout::eUndefined,
+                            vk::ImageLayout finalLayout = vk::ImageLayout::eUndefined)
+    {
+        ImageResource &resource = images.emplace_back();
+        resource.name = std::move(name);
+        resource.desc = {.format = format, .extent = extent};
+        resource.imported = true;
+        resource.image = image;
+        resource.view = view;
+        resource.initialLayout = initialLayout;
+        resource.finalLayout = finalLayout;
+        return {static_cast<std::uint32_t>(images.size() - 1)};
+    }
+    ImageHandle createImage(std::string name, TransientImageDesc const &desc)
+    {
+        ImageResource &resource = images.emplace_back();
+        resource.name = std::move(name);
+        resource.desc = desc;
+        return {static_cast<std::uint32_t>(images.size() - 1)};
+    }
+    BufferHandle importBuffer(std::string name, vk::Buffer buffer, vk::DeviceSize size)
+    {
+        BufferResource &resource = buffers.emplace_back();
+        resource.name = std::move(name);
+        resource.imported = true;
+        resource.buffer = buffer;
+        resource.size = size;
+        return {static_cast<std::uint32_t>(buffers.size() - 1)};
+    }
+    BufferHandle createBuffer(std::string name, vk::DeviceSize size)
+    {
+        BufferResource &resource = buffers.emplace_back();
+        resource.name = std::move(name);
+        resource.size = size;
+        return {static_cast<std::uint32_t>(buffers.size() - 1)};
+    }
+
+    // keeps the passes producing a transient resource alive although no later pass reads it
+    void markOutput(ImageHandle image)
+    {
+        images[image.index].output = true;
+    }
+    void markOutput(BufferHandle buffer)
+    {
+        buffers[buffer.index].output = true;
+    }
+
+    [[nodiscard]] PassBuilder addPass(std::string name, Execute execute)
+    {
+        passes.push_back({.name = std::move(name), .execute = std::move(execute)});
+        compiled = false;
+        return PassBuilder(this, static_cast<std::uint32_t>(passes.size() - 1));
+    }
+
+    // Builds transient resources and barrier batches. Frees the previous compile's transients, so the caller must make
+    // sure no submitted frame still uses them.
+    void compile()
+    {
+        auto zone = nrZone("RenderGraph::compile");
+        cull();
+        allocateTransients();
+        planBarriers();
+        compiled = true;
+    }
+
+    // rebinding an imported image (e.g. to this frame's swapchain image) needs no recompile
+    void setImportedImage(ImageHandle handle, vk::Image image, vk::ImageView view = {})
+    {
+        nrAssert(images[handle.index].imported)("'{}' is not an imported image.", images[handle.index].name);
+        images[handle.index].image = image;
+        images[handle.index].view = view;
+    }
+
+    // with a profiler every pass, including its barrier batch, becomes a GPU zone named after the pass
+    void execute(vk::raii::CommandBuffer const &cmd, GpuProfiler *profiler = nullptr)
+    {
+        nrAssert(compiled)("RenderGraph::execute called before compile().");
+        for (std::uint32_t p : livePasses)
+        {
+            GpuZone zone(profiler, cmd, passes[p].name);
+            emit(cmd, passes[p].barriers);
+            passes[p].execute(cmd, *this);
+        }
+        emit(cmd, finalBarriers);
+    }
+
+    [[nodiscard]] vk::Image image(ImageHandle handle) const
+    {
+        return images[handle.index].image;
+    }
+    [[nodiscard]] vk::ImageView imageView(ImageHandle handle) const
+    {
+        return images[handle.index].view;
+    }
+    [[nodiscard]] vk::Extent2D extent(ImageHandle handle) const
+    {
+        return images[handle.index].desc.extent;
+    }
+    [[nodiscard]] vk::Buffer buffer(BufferHandle handle) const
+    {
+        return buffers[handle.index].buffer;
+    }
+    [[nodiscard]] RenderGraphStatistics const &statistics() const
+    {
+        return stats;
+    }
+
+    void report() const
+    {
+        nrInfo()("render graph: {}/{} passes live, {} barrier batches ({} image, {} memory barriers), {} transient images in {} blocks: {:.2f} MiB aliased into {:.2f} MiB", stats.livePasses, stats.declaredPasses,
+                 stats.barrierBatches, stats.imageBarriers, stats.memoryBarriers, stats.transientImages, stats.memoryBlocks, stats.transientBytes / 1048576.0, stats.allocatedBytes / 1048576.0);
+    }
+
+  private:
+    enum class ResourceType
+    {
+        image,
+        buffer
+    };
+
+    struct Use
+    {
+        ResourceType type;
+        std::uint32_t index;
+        AccessInfo info;
+    };
+
+    struct BarrierBatch
+    {
+        std::vector<vk::ImageMemoryBarrier2> imageBarriers;
+        // resource index of each image barrier; the vk::Image is filled in at execute() so imports can be rebound
+        std::vector<std::uint32_t> barrierImages;
+        vk::MemoryBarrier2 memoryBarrier;
+        bool hasMemoryBarrier = false;
+    };
+
+    struct Pass
+    {
+        std::string name;
+        Execute execute;
+        std::vector<Use> uses;
+        bool sideEffects = false;
+        BarrierBatch barriers;
+    };
+
+    // what the pending dependencies of one resource look like at a point in the pass sequence
+    struct SyncState
+    {
+        vk::PipelineStageFlags2 writeStages;
+        vk::AccessFlags2 writeAccess;
+        // readers since the last write; a later write or layout transition must wait for them
+        vk::PipelineStageFlags2 readStages;
+        // stages/access the last write has already been made visible to
+        vk::PipelineStageFlags2 visibleStages;
+        vk::AccessFlags2 visibleAccess;
+        vk::ImageLayout layout = vk::ImageLayout::eUndefined;
+    };
+
+    struct ImageResource
+    {
+        std::string name;
+        TransientImageDesc desc;
+        bool imported = false;
+        bool output = false;
+        vk::ImageLayout initialLayout = vk::ImageLayout::eUndefined;
+        vk::ImageLayout finalLayout = vk::ImageLayout::eUndefined;
+        vk::Image image;
+        vk::ImageView view;
+        // compile() results for transients
+        vk::ImageUsageFlags usage;
+        std::uint32_t firstUse = ~0u;
+        std::uint32_t lastUse = 0;
+        std::uint32_t block = ~0u;
+        vk::raii::Image ownedImage = {nullptr};
+        vk::raii::ImageView ownedView = {nullptr};
+    };
+
+    struct BufferResource
+    {
+        std::string name;
+        vk::DeviceSize size = 0;
+        bool imported = false;
+        bool output = false;
+        vk::Buffer buffer;
+        vk::BufferUsageFlags usage;
+        Buffer owned;
+    };
+
+    static constexpr vk::AccessFlags2 writeAccessMask = vk::AccessFlagBits2::eShaderWrite | vk::AccessFlagBits2::eShaderStorageWrite | vk::AccessFlagBits2::eColorAttachmentWrite |
+                                                        vk::AccessFlagBits2::eDepthStencilAttachmentWrite | vk::AccessFlagBits2::eTransferWrite | vk::AccessFlagBits2::eHostWrite | vk::AccessFlagBits2::eMemoryWrite;
+
+    void use(std::uint32_t pass, ResourceType type, std::uint32_t index, Access access)
+    {
+        nrAssert(index < (type == ResourceType::image ? images.size() : buffers.size()))("Pass '{}' uses an invalid resource handle.", passes[pass].name);
+        const AccessInfo info = accessInfo(access);
+        auto &uses = passes[pass].uses;
+        auto it = std::ranges::find_if(uses, [&](Use const &u) { return u.type == type && u.index == index; });
+        if (it == uses.end())
+        {
+            uses.push_back({type, index, info});
+            return;
+        }
+        // several accesses to one resource in a pass merge into one; images must agree on the layout
+        nrAssert(type == ResourceType::buffer || it->info.layout == info.layout)("Pass '{}' uses image '{}' in two layouts.", passes[pass].name, images[index].name);
+        it->info.stages |= info.stages;
+        it->info.access |= info.access;
+        it->info.imageUsage |= info.imageUsage;
+        it->info.bufferUsage |= info.bufferUsage;
+        it->info.write = it->info.write || info.write;
+    }
+
+    // walks the passes backwards from everything observable and keeps only the ones contributing to it
+    void cull()
+    {
+        std::vector<bool> imageNeeded(images.size()), bufferNeeded(buffers.size());
+        for (size_t i = 0; i < images.size(); ++i)
+        {
+            imageNeeded[i] = images[i].imported || images[i].output;
+        }
+        for (size_t i = 0; i < buffers.size(); ++i)
+        {
+            bufferNeeded[i] = buffers[i].imported || buffers[i].output;
+        }
+        auto needed = [&](Use const &u) { return u.type == ResourceType::image ? imageNeeded[u.index] : bufferNeeded[u.index]; };
+
+        livePasses.clear();
+        for (std::uint32_t p = static_cast<std::uint32_t>(passes.size()); p-- > 0;)
+        {
+            Pass const &pass = passes[p];
+            if (!pass.sideEffects && std::ranges::none_of(pass.uses, [&](Use const &u) { return u.info.write && needed(u); }))
+                continue;
+            livePasses.push_back(p);
+            // writes are not assumed to cover the whole resource, so earlier producers of written resources stay too
+            for (Use const &u : pass.uses)
+            {
+                (u.type == ResourceType::image ? imageNeeded[u.index] : bufferNeeded[u.index]) = true;
+            }
+        }
+        std::ranges::reverse(livePasses);
+    }
+
+    void allocateTransients()
+    {
+        for (ImageResource &resource : images)
+        {
+            resource.usage = {};
+            resource.firstUse = ~0u;
+            resource.lastUse = 0;
+            resource.block = ~0u;
+            resource.ownedView = nullptr;
+            resource.ownedImage = nullptr;
+            if (!resource.imported)
+            {
+                resource.image = vk::Image{};
+                resource.view = vk::ImageView{};
+            }
+        }
+        blocks.clear();
+        for (BufferResource &resource : buffers)
+        {
+            resource.usage = {};
+            if (!resource.imported)
+            {
+                resource.owned = nullptr;
+                resource.buffer = vk::Buffer{};
+            }
+        }
+        for (std::uint32_t order = 0; order < livePasses.size(); ++order)
+        {
+            for (Use const &u : passes[livePasses[order]].uses)
+            {
+                if (u.type == ResourceType::buffer)
+                {
+                    buffers[u.index].usage |= u.info.bufferUsage;
+                    continue;
+                }
+                ImageResource &resource = images[u.index];
+                resource.usage |= u.info.imageUsage;
+                resource.firstUse = std::min(resource.firstUse, order);
+                resource.lastUse = std::max(resource.lastUse, order);
+            }
+        }
+
+        stats = {};
+        std::vector<std::uint32_t> transients;
+        std::vector<vk::MemoryRequirements> requirements(images.size());
+        for (std::uint32_t i = 0; i < images.size(); ++i)
+        {
+            ImageResource &resource = images[i];
+            if (resource.imported || resource.firstUse == ~0u)
+                continue;
+            const vk::ImageCreateInfo createInfo({}, vk::ImageType::e2D, resource.desc.format, vk::Extent3D(resource.desc.extent, 1), resource.desc.mipLevels, resource.desc.arrayLayers, resource.desc.samples, vk::ImageTiling::eOptimal,
+                                                 resource.usage, vk::SharingMode::eExclusive, {}, vk::ImageLayout::eUndefined);
+            resource.ownedImage = vk::raii::Image(*device, createInfo);
+            resource.image = *resource.ownedImage;
+            requirements[i] = resource.ownedImage.getMemoryRequirements();
+            stats.transientBytes += requirements[i].size;
+            transients.push_back(i);
+        }
+
+        // Largest first, each image goes into the first block whose occupants are all dead before it starts or
+        // born after it ends. Everything sits at offset 0, so a block is as large as its first (largest) occupant.
+        std::ranges::stable_sort(transients, std::ranges::greater{}, [&](std::uint32_t i) { return requirements[i].size; });
+        struct Plan
+        {
+            vk::MemoryRequirements requirements;
+            std::vector<std::uint32_t> occupants;
+        };
+        std::vector<Plan> plans;
+        for (std::uint32_t i : transients)
+        {
+            ImageResource &resource = images[i];
+            auto disjoint = [&](std::uint32_t other) { return images[other].lastUse < resource.firstUse || resource.lastUse < images[other].firstUse; };
+            auto it = std::ranges::find_if(plans, [&](Plan const &plan) { return (plan.requirements.memoryTypeBits & requirements[i].memoryTypeBits) && std::ranges::all_of(plan.occupants, disjoint); });
+            if (it == plans.end())
+            {
+                plans.push_back({requirements[i], {}});
+                it = plans.end() - 1;
+            }
+            it->requirements.memoryTypeBits &= requirements[i].memoryTypeBits;
+            it->requirements.alignment = std::max(it->requirements.alignment, requirements[i].alignment);
+            it->occupants.push_back(i);
+            resource.block = static_cast<std::uint32_t>(it - plans.begin());
+        }
+
+        for (Plan const &plan : plans)
+        {
+            MemoryBlock &block = blocks.emplace_back(memory->allocateMemory(plan.requirements));
+            stats.allocatedBytes += block.size();
+            for (std::uint32_t i : plan.occupants)
+            {
+                ImageResource &resource = images[i];
+                block.bindImage(resource.image);
+                const vk::ImageViewCreateInfo viewCreateInfo({}, resource.image, resource.desc.arrayLayers > 1 ? vk::ImageViewType::e2DArray : vk::ImageViewType::e2D, resource.desc.format, {}, subresourceRange(resource.desc.format));
+                resource.ownedView = vk::raii::ImageView(*device, viewCreateInfo);
+                resource.view = *resource.ownedView;
+            }
+        }
+        blockOccupants.clear();
+        for (Plan &plan : plans)
+        {
+            blockOccupants.push_back(std::move(plan.occupants));
+        }
+
+        for (BufferResource &resource : buffers)
+        {
+            if (resource.imported || !resource.usage)
+                continue;
+            resource.owned = memory->createBuffer({.size = resource.size, .usage = resource.usage});
+            resource.buffer = resource.owned.handle();
+        }
+        stats.declaredPasses = static_cast<std::uint32_t>(passes.size());
+        stats.livePasses = static_cast<std::uint32_t>(livePasses.size());
+        stats.transientImages = static_cast<std::uint32_t>(transients.size());
+        stats.memoryBlocks = static_cast<std::uint32_t>(blocks.size());
+    }
+
+    // Adds what moving `state` to `use` requires to src/dst and updates the state; false if nothing is needed.
+    static bool transition(SyncState &state, AccessInfo const &use, bool isImage, vk::PipelineStageFlags2 &srcStages, vk::AccessFlags2 &srcAccess)
+    {
+        const bool layoutChange = isImage && state.layout != use.layout;
+        if (use.write || layoutChange)
+        {
+            // write-after-write/read, or a layout transition (which is itself a write)
+            srcStages = state.writeStages | state.readStages;
+            srcAccess = state.writeAccess;
+            const bool needed = layoutChange || srcStages;
+            if (use.write)
+                state = {.writeStages = use.stages, .writeAccess = use.access & writeAccessMask, .layout = use.layout};
+            else
+                state = {.readStages = use.stages, .visibleStages = use.stages, .visibleAccess = use.access, .layout = use.layout};
+            return needed;
+        }
+        // read-after-read needs nothing; read-after-write only once per destination stage/access
+        state.readStages |= use.stages;
+        if (!state.writeStages || ((use.stages & ~state.visibleStages) == vk::PipelineStageFlags2{} && (use.access & ~state.visibleAccess) == vk::AccessFlags2{}))
+            return false;
+        srcStages = state.writeStages;
+        srcAccess = state.writeAccess;
+        state.visibleStages |= use.stages;
+        state.visibleAccess |= use.access;
+        return true;
+    }
+
+    void planBarriers()
+    {
+        // imports may have been touched by anything before the graph; transients start with undefined contents
+        std::vector<SyncState> imageStates(images.size()), bufferStates(buffers.size());
+        for (size_t i = 0; i < images.size(); ++i)
+        {
+            if (images[i].imported)
+                imageStates[i] = {.writeStages = vk::PipelineStageFlagBits2::eAllCommands, .writeAccess = vk::AccessFlagBits2::eMemoryWrite, .layout = images[i].initialLayout};
+        }
+        for (size_t i = 0; i < buffers.size(); ++i)
+        {
+            if (buffers[i].imported)
+                bufferStates[i] = {.writeStages = vk::PipelineStageFlagBits2::eAllCommands, .writeAccess = vk::AccessFlagBits2::eMemoryWrite};
+        }
+
+        // first barrier of each transient image, patched below with the hazards of the memory it aliases
+        std::vector<std::pair<std::uint32_t, size_t>> firstBarrier(images.size(), {~0u, 0});
+        // first pass using each transient buffer and how, patched below with the buffer's end-of-frame state
+        std::vector<std::pair<std::uint32_t, AccessInfo>> firstBufferUse(buffers.size(), {~0u, {}});
+        for (std::uint32_t p : livePasses)
+        {
+            BarrierBatch &batch = passes[p].barriers;
+            batch = {};
+            for (Use const &u : passes[p].uses)
+            {
+                vk::PipelineStageFlags2 srcStages;
+                vk::AccessFlags2 srcAccess;
+                if (u.type == ResourceType::buffer)
+                {
+                    if (!buffers[u.index].imported && firstBufferUse[u.index].first == ~0u)
+                        firstBufferUse[u.index] = {p, u.info};
+                    if (!transition(bufferStates[u.index], u.info, false, srcStages, srcAccess))
+                        continue;
+                    batch.memoryBarrier.srcStageMask |= srcStages;
+                    batch.memoryBarrier.srcAccessMask |= srcAccess;
+                    batch.memoryBarrier.dstStageMask |= u.info.stages;
+                    batch.memoryBarrier.dstAccessMask |= u.info.access;
+                    batch.hasMemoryBarrier = true;
+                    continue;
+                }
+                const vk::ImageLayout oldLayout = imageStates[u.index].layout;
+                if (!transition(imageStates[u.index], u.info, true, srcStages, srcAccess))
+                    continue;
+                if (!images[u.index].imported && firstBarrier[u.index].first == ~0u)
+                    firstBarrier[u.index] = {p, batch.imageBarriers.size()};
+                batch.imageBarriers.emplace_back(srcStages, srcAccess, u.info.stages, u.info.access, oldLayout, u.info.layout, vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, vk::Image{},
+                                                 subresourceRange(images[u.index].desc.format));
+                batch.barrierImages.push_back(u.index);
+            }
+        }
+
+        // A transient's first use discards its contents (oldLayout stays undefined) but must still wait for every
+        // image sharing its memory, including its own last use in the previous frame.
+        for (std::vector<std::uint32_t> const &occupants : blockOccupants)
+        {
+            vk::PipelineStageFlags2 stages;
+            vk::AccessFlags2 access;
+            for (std::uint32_t i : occupants)
+            {
+                stages |= imageStates[i].writeStages | imageStates[i].readStages;
+                access |= imageStates[i].writeAccess;
+            }
+            for (std::uint32_t i : occupants)
+            {
+                auto [pass, barrier] = firstBarrier[i];
+                if (pass == ~0u)
+                    continue;
+                vk::ImageMemoryBarrier2 &first = passes[pass].barriers.imageBarriers[barrier];
+                first.srcStageMask |= stages;
+                first.srcAccessMask |= access;
+                first.oldLayout = vk::ImageLayout::eUndefined;
+            }
+        }
+
+        // Likewise a transient buffer's first use waits for what the previous frame last did to the same VkBuffer
+        for (std::uint32_t i = 0; i < buffers.size(); ++i)
+        {
+            auto const &[pass, use] = firstBufferUse[i];
+            SyncState const &state = bufferStates[i];
+            const vk::PipelineStageFlags2 stages = state.writeStages | state.readStages;
+            // a read-only last use only orders a first write; a read after a read needs nothing
+            if (pass == ~0u || !stages || (!state.writeStages && !use.write))
+                continue;
+            BarrierBatch &batch = passes[pass].barriers;
+            batch.memoryBarrier.srcStageMask |= use.write ? stages : state.writeStages;
+            batch.memoryBarrier.srcAccessMask |= state.writeAccess;
+            batch.memoryBarrier.dstStageMask |= use.stages;
+            batch.memoryBarrier.dstAccessMask |= use.access;
+            batch.hasMemoryBarrier = true;
+        }
+
+        finalBarriers = {};
+        for (std::uint32_t i = 0; i < images.size(); ++i)
+        {
+            SyncState const &state = imageStates[i];
+            if (!images[i].imported || images[i].finalLayout == vk::ImageLayout::eUndefined || images[i].finalLayout == state.layout)
+                continue;
+            finalBarriers.imageBarriers.emplace_back(state.writeStages | state.readStages, state.writeAccess, vk::PipelineStageFlagBits2::eAllCommands, vk::AccessFlags2{}, state.layout, images[i].finalLayout,
+                                                     vk::QueueFamilyIgnored, vk::QueueFamilyIgnored, vk::Image{}, subresourceRange(images[i].desc.format));
+            finalBarriers.barrierImages.push_back(i);
+        }
+
+        for (BarrierBatch const *batch : livePasses | std::views::transform([&](std::uint32_t p) { return &passes[p].barriers; }))
+        {
+            count(*batch);
+        }
+        count(finalBarriers);
+    }
+
+    void count(BarrierBatch const &batch)
+    {
+        if (batch.imageBarriers.empty() && !batch.hasMemoryBarrier)
+            return;
+        ++stats.barrierBatches;
+        stats.imageBarriers += static_cast<std::uint32_t>(batch.imageBarriers.size());
+        stats.memoryBarriers += batch.hasMemoryBarrier ? 1 : 0;
+    }
+
+    void emit(vk::raii::CommandBuffer const &cmd, BarrierBatch &batch) const
+    {
+        if (batch.imageBarriers.empty() && !batch.hasMemoryBarrier)
+            return;
+        for (size_t b = 0; b < batch.imageBarriers.size(); ++b)
+        {
+            batch.imageBarriers[b].image = images[batch.barrierImages[b]].image;
+        }
+        vk::DependencyInfo dependencyInfo({}, {}, {}, batch.imageBarriers);
+        if (batch.hasMemoryBarrier)
+            dependencyInfo.setMemoryBarriers(batch.memoryBarrier);
+        cmd.pipelineBarrier2(dependencyInfo);
+    }
+
+    static vk::ImageSubresourceRange subresourceRange(vk::Format format)
+    {
+        vk::ImageAspectFlags aspect = vk::ImageAspectFlagBits::eColor;
+        switch (format)
+        {
+        case vk::Format::eD16Unorm:
+        case vk::Format::eX8D24UnormPack32:
+        case vk::Format::eD32Sfloat:
+            aspect = vk::ImageAspectFlagBits::eDepth;
+            break;
+        case vk::Format::eD16UnormS8Uint:
+        case vk::Format::eD24UnormS8Uint:
+        case vk::Format::eD32SfloatS8Uint:
+            aspect = vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+            break;
+        default:
+            break;
+        }
+        return {aspect, 0, vk::RemainingMipLevels, 0, vk::RemainingArrayLayers};
+    }
+
+    vk::raii::Device const *device;
+    MemoryAllocator const *memory;
+    std::vector<Pass> passes;
+    // blocks are declared before the images so the images bound into them are destroyed first
+    std::vector<MemoryBlock> blocks;
+    std::vector<std::vector<std::uint32_t>> blockOccupants;
+    std::vector<ImageResource> images;
+    std::vector<BufferResource> buffers;
+    std::vector<std::uint32_t> livePasses;
+    BarrierBatch finalBarriers;
+    RenderGraphStatistics stats;
+    bool compiled = false;
+};
+
+} // namespace nr::rhi
@@ -0,0 +1,329 @@
+module;
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan_raii.hpp>
+export module nr.rhi.resources;
+import nr.rhi.queue;
+import nr.rhi.memory;
+import nr.utils;
+import std;
+
+export namespace nr::rhi
+{
+
+using BufferId = Handle<struct BufferTag>;
+using ImageId = Handle<struct ImageTag>;
+using ImageViewId = Handle<struct ImageViewTag>;
+using SamplerId = Handle<struct SamplerTag>;
+using PipelineId = Handle<struct PipelineTag>;
+
+struct ResourceStatistics
+{
+    std::size_t buffers = 0;
+    std::size_t images = 0;
+    std::size_t imageViews = 0;
+    std::size_t samplers = 0;
+    std::size_t pipelines = 0;
+    // released but still waiting for the GPU
+    std::size_t retired = 0;
+    // pool rows only; the driver's and VMA's own objects are not counted
+    std::size_t bytes = 0;
+};
+
+// Device-wide owner of buffers, images, image views, samplers and pipelines, addressed by generational handles. Each
+// kind lives in a dense SoA HandlePool of plain Vulkan handles plus the little state the hot paths read, instead of
+// one heap-allocated vk::raii object per resource that repeats the device and dispatcher pointers. Everything is
+// destroyed through the one device held here.
+//
+// release() retires a handle at once - it goes stale for every lookup - but the Vulkan object is destroyed only by
+// recycle() once the GPU has passed `lastUse`, the same rule BindlessHeap applies to its slots. Lookups take a shared
+// lock, creation and recycling an exclusive one; any thread may call any member.
+class ResourcePools
+{
+  public:
+    ResourcePools(vk::raii::Device const &device, MemoryAllocator const &memory) : device(&device), memory(&memory)
+    {
+    }
+    ResourcePools(const ResourcePools &) = delete;
+    ResourcePools &operator=(const ResourcePools &) = delete;
+    ~ResourcePools()
+    {
+        std::scoped_lock lock(mutex);
+        for (Retired &r : retired)
+            destroy(r.object);
+        retired.clear();
+        // anything still alive here leaked; destroy it anyway so the device can go
+        const std::size_t leaked = buffers.size() + images.size() + imageViews.size() + samplers.size() + pipelines.size();
+        if (leaked > 0)
+            nrInfo(LogLevel::warning)("{} resources were never released.", leaked);
+        while (!imageViews.empty())
+            destroy(takeLocked(imageViews, imageViews.handles().back()));
+        while (!images.empty())
+            destroy(takeLocked(images, images.handles().back()));
+        while (!buffers.empty())
+            destroy(takeLocked(buffers, buffers.handles().back()));
+        while (!samplers.empty())
+            destroy(takeLocked(samplers, samplers.handles().back()));
+        while (!pipelines.empty())
+            destroy(takeLocked(pipelines, pipelines.handles().back()));
+    }
+
+    [[nodiscard]] BufferId createBuffer(BufferDesc const &desc)
+    {
+        nrAssert(!desc.movable)("Pooled buffers cannot be movable; create them with MemoryAllocator::createBuffer.");
+        const vk::BufferCreateInfo createInfo({}, desc.size, desc.usage);
+        VmaAllocationCreateInfo allocationCreateInfo{};
+        allocationCreateInfo.usage = desc.memoryUsage;
+        allocationCreateInfo.flags = desc.flags;
+        allocationCreateInfo.pool = memory->pool(desc.pool);
+        if (desc.pool == MemoryPool::frameLinear)
+            allocationCreateInfo.flags |= VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VmaAllocation allocation = nullptr;
+        VmaAllocationInfo allocationInfo{};
+        vk::detail::resultCheck(static_cast<vk::Result>(vmaCreateBuffer(memory->handle(), reinterpret_cast<const VkBufferCreateInfo *>(&createInfo), &allocationCreateInfo, &buffer, &allocation, &allocationInfo)), "Failed to create buffer");
+        std::scoped_lock lock(mutex);
+        return buffers.insert(buffer, allocation, desc.size, allocationInfo.pMappedData);
+    }
+
+    [[nodiscard]] ImageId createImage(ImageDesc const &desc)
+    {
+        VmaAllocationCreateInfo allocationCreateInfo{};
+        allocationCreateInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+        allocationCreateInfo.flags = desc.flags | (desc.renderTarget ? VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT : 0);
+        if (desc.renderTarget)
+            allocationCreateInfo.priority = 1.0f;
+
+        VkImage image = VK_NULL_HANDLE;
+        VmaAllocation allocation = nullptr;
+        vk::detail::resultCheck(static_cast<vk::Result>(vmaCreateImage(memory->handle(), reinterpret_cast<const VkImageCreateInfo *>(&desc.createInfo), &allocationCreateInfo, &image, &allocation, nullptr)), "Failed to create image");
+        std::scoped_lock lock(mutex);
+        return images.insert(image, allocation, desc.createInfo.format, desc.createInfo.extent);
+    }
+
+    // an image owned elsewhere (a swapchain image); release() forgets it without destroying it
+    [[nodiscard]] ImageId importImage(vk::Image image, vk::Format format, vk::Extent3D extent)
+    {
+        std::scoped_lock lock(mutex);
+        return images.insert(image, nullptr, format, extent);
+    }
+
+    // `createInfo.image` is filled in from `owner`
+    [[nodiscard]] ImageViewId createImageView(ImageId owner, vk::ImageViewCreateInfo createInfo)
+    {
+        createInfo.image = image(owner);
+        nrAssert(static_cast<bool>(createInfo.image))("Image view created for a stale image handle.");
+        const vk::ImageView view = vk::Device(**device).createImageView(createInfo, nullptr, *device->getDispatcher());
+        std::scoped_lock lock(mutex);
+        return imageViews.insert(view, owner);
+    }
+
+    [[nodiscard]] SamplerId createSampler(vk::SamplerCreateInfo const &createInfo)
+    {
+        const vk::Sampler sampler = vk::Device(**device).createSampler(createInfo, nullptr, *device->getDispatcher());
+        std::scoped_lock lock(mutex);
+        return samplers.insert(sampler);
+    }
+
+    // takes ownership of a pipeline built elsewhere (PipelineCache, the shader system); the layout is not owned
+    [[nodiscard]] PipelineId adoptPipeline(vk::Pipeline pipeline, vk::PipelineLayout layout, vk::PipelineBindPoint bindPoint)
+    {
+        std::scoped_lock lock(mutex);
+        return pipelines.insert(pipeline, layout, bindPoint);
+    }
+
+    // Null handles for stale ids, so a lookup doubles as the validity check
+    [[nodiscard]] vk::Buffer buffer(BufferId id) const
+    {
+        std::shared_lock lock(mutex);
+        auto const *handle = buffers.get<0>(id);
+        return handle ? *handle : vk::Buffer{};
+    }
+    [[nodiscard]] vk::DeviceSize bufferSize(BufferId id) const
+    {
+        std::shared_lock lock(mutex);
+        auto const *size = buffers.get<2>(id);
+        return size ? *size : 0;
+    }
+    [[nodiscard]] void *mapped(BufferId id) const
+    {
+        std::shared_lock lock(mutex);
+        auto const *data = buffers.get<3>(id);
+        return data ? *data : nullptr;
+    }
+    [[nodiscard]] vk::Image image(ImageId id) const
+    {
+        std::shared_lock lock(mutex);
+        auto const *handle = images.get<0>(id);
+        return handle ? *handle : vk::Image{};
+    }
+    [[nodiscard]] vk::Format imageFormat(ImageId id) const
+    {
+        std::shared_lock lock(mutex);
+        auto const *format = images.get<2>(id);
+        return format ? *format : vk::Format::eUndefined;
+    }
+    [[nodiscard]] vk::Extent3D imageExtent(ImageId id) const
+    {
+        std::shared_lock lock(mutex);
+        auto const *extent = images.get<3>(id);
+        return extent ? *extent : vk::Extent3D{};
+    }
+    [[nodiscard]] vk::ImageView imageView(ImageViewId id) const
+    {
+        std::shared_lock lock(mutex);
+        auto const *handle = imageViews.get<0>(id);
+        return handle ? *handle : vk::ImageView{};
+    }
+    [[nodiscard]] vk::Sampler sampler(SamplerId id) const
+    {
+        std::shared_lock lock(mutex);
+        auto const *handle = samplers.get<0>(id);
+        return handle ? *handle : vk::Sampler{};
+    }
+    [[nodiscard]] vk::Pipeline pipeline(PipelineId id) const
+    {
+        std::shared_lock lock(mutex);
+        auto const *handle = pipelines.get<0>(id);
+        return handle ? *handle : vk::Pipeline{};
+    }
+    [[nodiscard]] bool contains(BufferId id) const
+    {
+        std::shared_lock lock(mutex);
+        return buffers.contains(id);
+    }
+    [[nodiscard]] bool contains(ImageId id) const
+    {
+        std::shared_lock lock(mutex);
+        return images.contains(id);
+    }
+
+    // Binds the pipeline and returns false for a stale id; the layout is the one given to adoptPipeline
+    bool bindPipeline(vk::raii::CommandBuffer const &cmd, PipelineId id) const
+    {
+        std::shared_lock lock(mutex);
+        const std::optional<std::uint32_t> row = pipelines.row(id);
+        if (!row)
+            return false;
+        cmd.bindPipeline(pipelines.column<2>()[*row], pipelines.column<0>()[*row]);
+        return true;
+    }
+
+    // The handle goes stale immediately; the object is destroyed by recycle() once `lastUse` has been reached. An
+    // empty SubmitPoint means the GPU no longer uses it.
+    void release(BufferId id, SubmitPoint lastUse = {})
+    {
+        retire(buffers, id, lastUse);
+    }
+    void release(ImageId id, SubmitPoint lastUse = {})
+    {
+        retire(images, id, lastUse);
+    }
+    void release(ImageViewId id, SubmitPoint lastUse = {})
+    {
+        retire(imageViews, id, lastUse);
+    }
+    void release(SamplerId id, SubmitPoint lastUse = {})
+    {
+        retire(samplers, id, lastUse);
+    }
+    void release(PipelineId id, SubmitPoint lastUse = {})
+    {
+        retire(pipelines, id, lastUse);
+    }
+
+    // destroys retired objects whose last use has completed; call once per frame
+    void recycle()
+    {
+        std::scoped_lock lock(mutex);
+        std::vector<std::pair<vk::Semaphore, std::uint64_t>> counters;
+        auto completedValue = [&](vk::Semaphore semaphore) {
+            auto it = std::ranges::find(counters, semaphore, &std::pair<vk::Semaphore, std::uint64_t>::first);
+            if (it == counters.end())
+                it = counters.insert(counters.end(), {semaphore, vk::Device(**device).getSemaphoreCounterValue(semaphore, *device->getDispatcher())});
+            return it->second;
+        };
+        std::erase_if(retired, [&](Retired &r) {
+            if (r.lastUse && completedValue(r.lastUse.timeline) < r.lastUse.value)
+                return false;
+            destroy(r.object);
+            return true;
+        });
+    }
+
+    [[nodiscard]] ResourceStatistics statistics() const
+    {
+        std::shared_lock lock(mutex);
+        ResourceStatistics s{buffers.size(), images.size(), imageViews.size(), samplers.size(), pipelines.size(), retired.size(), 0};
+        s.bytes = s.buffers * decltype(buffers)::rowBytes + s.images * decltype(images)::rowBytes + s.imageViews * decltype(imageViews)::rowBytes + s.samplers * decltype(samplers)::rowBytes +
+                  s.pipelines * decltype(pipelines)::rowBytes;
+        return s;
+    }
+
+  private:
+    using BufferPool = HandlePool<BufferTag, vk::Buffer, VmaAllocation, vk::DeviceSize, void *>;
+    // a null allocation marks an imported image
+    using ImagePool = HandlePool<ImageTag, vk::Image, VmaAllocation, vk::Format, vk::Extent3D>;
+    using ImageViewPool = HandlePool<ImageViewTag, vk::ImageView, ImageId>;
+    using SamplerPool = HandlePool<SamplerTag, vk::Sampler>;
+    using PipelinePool = HandlePool<PipelineTag, vk::Pipeline, vk::PipelineLayout, vk::PipelineBindPoint>;
+
+    using RetiredObject = std::variant<std::tuple<vk::Buffer, VmaAllocation, vk::DeviceSize, void *>, std::tuple<vk::Image, VmaAllocation, vk::Format, vk::Extent3D>, std::tuple<vk::ImageView, ImageId>, std::tuple<vk::Sampler>,
+                                       std::tuple<vk::Pipeline, vk::PipelineLayout, vk::PipelineBindPoint>>;
+    struct Retired
+    {
+        RetiredObject object;
+        SubmitPoint lastUse;
+    };
+
+    template <typename Pool> static RetiredObject takeLocked(Pool &pool, typename Pool::HandleType id)
+    {
+        return *pool.erase(id);
+    }
+
+    template <typename Pool> void retire(Pool &pool, typename Pool::HandleType id, SubmitPoint lastUse)
+    {
+        std::scoped_lock lock(mutex);
+        auto removed = pool.erase(id);
+        nrAssert(removed.has_value())("Released a stale resource handle (index {}, generation {}).", id.index, id.generation);
+        if (removed)
+            retired.push_back({std::move(*removed), lastUse});
+    }
+
+    void destroy(RetiredObject const &object) const
+    {
+        vk::Device const raw(**device);
+        auto const &dispatcher = *device->getDispatcher();
+        std::visit(
+            [&](auto const &values) {
+                const auto handle = std::get<0>(values);
+                using Type = std::remove_cvref_t<decltype(handle)>;
+                if constexpr (std::same_as<Type, vk::Buffer>)
+                    vmaDestroyBuffer(memory->handle(), handle, std::get<1>(values));
+                else if constexpr (std::same_as<Type, vk::Image>)
+                {
+                    if (std::get<1>(values))
+                        vmaDestroyImage(memory->handle(), handle, std::get<1>(values));
+                }
+                else if constexpr (std::same_as<Type, vk::ImageView>)
+                    raw.destroyImageView(handle, nullptr, dispatcher);
+                else if constexpr (std::same_as<Type, vk::Sampler>)
+                    raw.destroySampler(handle, nullptr, dispatcher);
+                else
+                    raw.destroyPipeline(handle, nullptr, dispatcher);
+            },
+            object);
+    }
+
+    vk::raii::Device const *device;
+    MemoryAllocator const *memory;
+    mutable std::shared_mutex mutex;
+    BufferPool buffers;
+    ImagePool images;
+    ImageViewPool imageViews;
+    SamplerPool samplers;
+    PipelinePool pipelines;
+    std::vector<Retired> retired;
+};
+
+} // namespace nr::rhi
@@ -0,0 +1,278 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+export module nr.rhi.swapChain;
+import nr.rhi.queue;
+import nr.utils;
+import std;
+
+export namespace nr::rhi
+{
+
+enum class PresentPolicy
+{
+    // no vblank wait, tearing only as a fallback: mailbox, immediate, FIFO-relaxed, FIFO
+    lowLatency,
+    // uncapped frame rate for measurements, tearing allowed: immediate, mailbox, FIFO-relaxed, FIFO
+    throughput,
+    // vsync that tears instead of stuttering when a frame is late: FIFO-relaxed, FIFO
+    adaptiveVsync,
+    // strict vsync; FIFO is the only mode every implementation supports
+    vsync
+};
+
+inline std::span<const vk::PresentModeKHR> presentModePreference(PresentPolicy policy)
+{
+    using P = vk::PresentModeKHR;
+    static constexpr std::array<P, 4> lowLatency{P::eMailbox, P::eImmediate, P::eFifoRelaxed, P::eFifo};
+    static constexpr std::array<P, 4> throughput{P::eImmediate, P::eMailbox, P::eFifoRelaxed, P::eFifo};
+    static constexpr std::array<P, 2> adaptiveVsync{P::eFifoRelaxed, P::eFifo};
+    static constexpr std::array<P, 1> vsync{P::eFifo};
+    switch (policy)
+    {
+    case PresentPolicy::lowLatency:
+        return lowLatency;
+    case PresentPolicy::throughput:
+        return throughput;
+    case PresentPolicy::adaptiveVsync:
+        return adaptiveVsync;
+    case PresentPolicy::vsync:
+        return vsync;
+    }
+    return vsync;
+}
+
+struct AcquiredImage
+{
+    std::uint32_t index = 0;
+    vk::Image image;
+    vk::ImageView view;
+    // signal it from the frame's last submission; present() waits on it
+    vk::Semaphore renderFinished;
+};
+
+// Owns the VkSwapchainKHR of one surface and keeps it valid. Out-of-date/suboptimal results and resize() only mark
+// the chain dirty; the next acquire() rebuilds it with the old chain as oldSwapchain. The old chain is not destroyed
+// on the spot, which would need a waitIdle: it is retired together with its present semaphores and released once the
+// present queue has passed its last submission and the new chain has cycled through all of its images. Retired
+// semaphores go back to a spare list, so resizing creates no new semaphores in steady state.
+class SwapChain
+{
+  public:
+    SwapChain() = default;
+    SwapChain(vk::raii::Device const &device, vk::raii::PhysicalDevice const &physicalDevice, vk::SurfaceKHR surface, Queue &presentQueue, vk::Extent2D windowExtent, PresentPolicy policy = PresentPolicy::lowLatency,
+              std::uint32_t desiredImageCount = 3)
+        : device(&device), physicalDevice(&physicalDevice), surface(surface), presentQueue(&presentQueue), windowExtent(windowExtent), policy(policy), desiredImageCount(desiredImageCount)
+    {
+        nrAssert(physicalDevice.getSurfaceSupportKHR(presentQueue.queueFamilyIndex(), surface))("Queue family {} cannot present to the surface", presentQueue.queueFamilyIndex());
+        surfaceFormat = selectFormat(physicalDevice.getSurfaceFormatsKHR(surface));
+        recreate();
+    }
+    SwapChain(const SwapChain &) = delete;
+    SwapChain &operator=(const SwapChain &) = delete;
+    SwapChain(SwapChain &&) = default;
+    SwapChain &operator=(SwapChain &&) = default;
+
+    // nullopt when no image can be rendered this frame (minimized window, chain out of date twice in a row); the
+    // caller skips the frame. `imageAvailable` is only signalled when an image is returned.
+    [[nodiscard]] std::optional<AcquiredImage> acquire(vk::Semaphore imageAvailable)
+    {
+        collectRetired();
+        for (int attempt = 0; attempt < 2; ++attempt)
+        {
+            if (dirty && !recreate())
+                return std::nullopt;
+            try
+            {
+                auto [result, index] = swapChain.acquireNextImage(std::numeric_limits<std::uint64_t>::max(), imageAvailable);
+                // a suboptimal image is still presentable; rebuild after this frame
+                dirty = dirty || result == vk::Result::eSuboptimalKHR;
+                ++acquireCount;
+                return AcquiredImage{index, images[index], *imageViews[index], *renderFinished[index]};
+            }
+            catch (vk::OutOfDateKHRError const &)
+            {
+                dirty = true;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void present(AcquiredImage const &image)
+    {
+        const vk::SwapchainKHR swapChainHandle = *swapChain;
+        try
+        {
+            if (presentQueue->present(vk::PresentInfoKHR(image.renderFinished, swapChainHandle, image.index)) == vk::Result::eSuboptimalKHR)
+                dirty = true;
+        }
+        catch (vk::OutOfDateKHRError const &)
+        {
+            dirty = true;
+        }
+    }
+
+    // new framebuffer size from the window system; applied on the next acquire()
+    void resize(vk::Extent2D newWindowExtent)
+    {
+        if (newWindowExtent == windowExtent)
+            return;
+        windowExtent = newWindowExtent;
+        dirty = true;
+    }
+    void setPolicy(PresentPolicy newPolicy)
+    {
+        if (std::exchange(policy, newPolicy) != newPolicy)
+            dirty = true;
+    }
+
+    [[nodiscard]] vk::Format format() const
+    {
+        return surfaceFormat.format;
+    }
+    [[nodiscard]] vk::Extent2D extent() const
+    {
+        return currentExtent;
+    }
+    [[nodiscard]] vk::PresentModeKHR presentMode() const
+    {
+        return currentPresentMode;
+    }
+    [[nodiscard]] std::uint32_t imageCount() const
+    {
+        return static_cast<std::uint32_t>(images.size());
+    }
+    // bumped on every rebuild so dependants (render graph imports, framebuffers) know when to refresh
+    [[nodiscard]] std::uint64_t generation() const
+    {
+        return recreateCount;
+    }
+    explicit operator bool() const
+    {
+        return *swapChain != vk::SwapchainKHR{};
+    }
+
+  private:
+    struct Retired
+    {
+        vk::raii::SwapchainKHR swapChain = {nullptr};
+        std::vector<vk::raii::ImageView> imageViews;
+        std::vector<vk::raii::Semaphore> renderFinished;
+        SubmitPoint lastSubmit;
+        std::uint64_t releaseAfterAcquire = 0;
+    };
+
+    static vk::SurfaceFormatKHR selectFormat(std::vector<vk::SurfaceFormatKHR> const &formats)
+    {
+        nrAssert(!formats.empty())("No available surface formats");
+        for (vk::Format preferred : {vk::Format::eB8G8R8A8Srgb, vk::Format::eR8G8B8A8Srgb})
+        {
+            auto it = std::ranges::find(formats, preferred, &vk::SurfaceFormatKHR::format);
+            if (it != formats.end())
+                return *it;
+        }
+        nrInfo(nr::LogLevel::warning)("Your device does not support basic sRGB format. You may need to convert output color space manually.");
+        return formats.front();
+    }
+
+    vk::PresentModeKHR selectPresentMode() const
+    {
+        const std::vector<vk::PresentModeKHR> supported = physicalDevice->getSurfacePresentModesKHR(surface);
+        for (vk::PresentModeKHR mode : presentModePreference(policy))
+        {
+            if (std::ranges::contains(supported, mode))
+                return mode;
+        }
+        return vk::PresentModeKHR::eFifo;
+    }
+
+    // false while the surface has no area (minimized); the chain stays dirty and is retried on the next acquire
+    bool recreate()
+    {
+        const vk::SurfaceCapabilitiesKHR capabilities = physicalDevice->getSurfaceCapabilitiesKHR(surface);
+        vk::Extent2D extent = capabilities.currentExtent;
+        if (extent.width == std::numeric_limits<std::uint32_t>::max())
+        {
+            extent.width = std::clamp(windowExtent.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
+            extent.height = std::clamp(windowExtent.height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
+        }
+        if (extent.width == 0 || extent.height == 0)
+            return false;
+
+        // maxImageCount 0 means no upper limit
+        const std::uint32_t maxImages = capabilities.maxImageCount ? capabilities.maxImageCount : std::numeric_limits<std::uint32_t>::max();
+        const vk::PresentModeKHR mode = selectPresentMode();
+        const vk::SwapchainCreateInfoKHR createInfo({}, surface, std::clamp(desiredImageCount, capabilities.minImageCount, maxImages), surfaceFormat.format, surfaceFormat.colorSpace, extent, 1,
+                                                    vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eColorAttachment, vk::SharingMode::eExclusive, {}, capabilities.currentTransform,
+                                                    vk::CompositeAlphaFlagBitsKHR::eOpaque, mode, vk::True, *swapChain);
+        vk::raii::SwapchainKHR newSwapChain(*device, createInfo);
+        if (*swapChain)
+        {
+            retired.push_back({std::move(swapChain), std::move(imageViews), std::move(renderFinished), presentQueue->lastSubmittedPoint(), 0});
+            imageViews.clear();
+            renderFinished.clear();
+        }
+        swapChain = std::move(newSwapChain);
+        images = swapChain.getImages();
+
+        // views always follow the new VkImages; the create info (format, range) is shared
+        vk::ImageViewCreateInfo imageViewCreateInfo({}, {}, vk::ImageViewType::e2D, surfaceFormat.format, {}, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+        for (vk::Image image : images)
+        {
+            imageViewCreateInfo.image = image;
+            imageViews.emplace_back(*device, imageViewCreateInfo);
+            if (!spareSemaphores.empty())
+            {
+                renderFinished.push_back(std::move(spareSemaphores.back()));
+                spareSemaphores.pop_back();
+            }
+            else
+            {
+                renderFinished.emplace_back(*device, vk::SemaphoreCreateInfo{});
+            }
+        }
+        if (!retired.empty())
+            retired.back().releaseAfterAcquire = acquireCount + images.size();
+
+        if (mode != currentPresentMode || extent != currentExtent)
+            nrInfo()("swapchain: {}x{} {} {} images, present mode {}", extent.width, extent.height, vk::to_string(surfaceFormat.format), images.size(), vk::to_string(mode));
+        currentExtent = extent;
+        currentPresentMode = mode;
+        ++recreateCount;
+        dirty = false;
+        return true;
+    }
+
+    void collectRetired()
+    {
+        std::erase_if(retired, [&](Retired &r) {
+            if (acquireCount < r.releaseAfterAcquire || !presentQueue->isComplete(r.lastSubmit.value))
+                return false;
+            std::ranges::move(r.renderFinished, std::back_inserter(spareSemaphores));
+            return true;
+        });
+    }
+
+    vk::raii::Device const *device = nullptr;
+    vk::raii::PhysicalDevice const *physicalDevice = nullptr;
+    vk::SurfaceKHR surface;
+    Queue *presentQueue = nullptr;
+    vk::Extent2D windowExtent;
+    PresentPolicy policy = PresentPolicy::lowLatency;
+    std::uint32_t desiredImageCount = 3;
+
+    vk::SurfaceFormatKHR surfaceFormat;
+    vk::Extent2D currentExtent;
+    vk::PresentModeKHR currentPresentMode = vk::PresentModeKHR::eFifo;
+    bool dirty = false;
+    std::uint64_t acquireCount = 0;
+    std::uint64_t recreateCount = 0;
+
+    std::vector<Retired> retired;
+    std::vector<vk::raii::Semaphore> spareSemaphores;
+    vk::raii::SwapchainKHR swapChain = {nullptr};
+    std::vector<vk::Image> images;
+    std::vector<vk::raii::ImageView> imageViews;
+    std::vector<vk::raii::Semaphore> renderFinished;
+};
+
+} // namespace nr::rhi
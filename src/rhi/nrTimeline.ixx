@@ -0,0 +1,141 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+export module nr.rhi.timeline;
+import nr.rhi.queue;
+import nr.utils;
+import std;
+
+export namespace nr::rhi
+{
+
+// Resumes coroutines once timeline semaphores reach their SubmitPoints. One thread sleeps in vkWaitSemaphores (wait
+// any) on every pending point plus a private wake semaphore that until() signals from the host, so registering a new
+// wait interrupts the sleep without polling. Reached points hand their coroutines to the job system; nothing runs on
+// the waiting thread itself. The destructor lets every registered wait finish first.
+class TimelineWaiter
+{
+  public:
+    explicit TimelineWaiter(vk::raii::Device const &device, JobSystem &jobs = JobSystem::instance()) : device(&device), jobs(&jobs)
+    {
+        vk::StructureChain<vk::SemaphoreCreateInfo, vk::SemaphoreTypeCreateInfo> semaphoreCreateInfo({}, {vk::SemaphoreType::eTimeline, 0});
+        wake = vk::raii::Semaphore(device, semaphoreCreateInfo.get<vk::SemaphoreCreateInfo>());
+        worker = std::thread([this] { run(); });
+    }
+    TimelineWaiter(const TimelineWaiter &) = delete;
+    TimelineWaiter &operator=(const TimelineWaiter &) = delete;
+    ~TimelineWaiter()
+    {
+        {
+            std::scoped_lock lock(mutex);
+            stopping = true;
+            signalWakeLocked();
+        }
+        worker.join();
+    }
+
+    [[nodiscard]] bool isComplete(SubmitPoint point) const
+    {
+        return !point || vk::Device(**device).getSemaphoreCounterValue(point.timeline, *device->getDispatcher()) >= point.value;
+    }
+
+    // co_await until(point): continues on a job-system worker once the GPU has reached `point`, or right away if it
+    // already has
+    auto until(SubmitPoint point)
+    {
+        struct Awaiter
+        {
+            TimelineWaiter *waiter;
+            SubmitPoint point;
+            bool await_ready() const
+            {
+                return waiter->isComplete(point);
+            }
+            void await_suspend(std::coroutine_handle<> awaiting) const
+            {
+                waiter->enqueue(point, awaiting);
+            }
+            void await_resume() const noexcept
+            {
+            }
+        };
+        return Awaiter{this, point};
+    }
+
+  private:
+    struct Wait
+    {
+        SubmitPoint point;
+        std::coroutine_handle<> coroutine;
+    };
+
+    void enqueue(SubmitPoint point, std::coroutine_handle<> coroutine)
+    {
+        std::scoped_lock lock(mutex);
+        waits.push_back({point, coroutine});
+        signalWakeLocked();
+    }
+
+    // timeline signals have to increase, so they are issued under the lock
+    void signalWakeLocked()
+    {
+        device->signalSemaphore(vk::SemaphoreSignalInfo(*wake, ++wakeValue));
+    }
+
+    void run()
+    {
+        setTraceThreadName("timeline waiter");
+        std::vector<vk::Semaphore> semaphores;
+        std::vector<std::uint64_t> values;
+        while (true)
+        {
+            semaphores.assign(1, *wake);
+            values.clear();
+            {
+                std::scoped_lock lock(mutex);
+                if (stopping && waits.empty())
+                    return;
+                values.push_back(wakeValue + 1);
+                // the smallest pending value per semaphore is the first one that can make progress
+                for (Wait const &w : waits)
+                {
+                    auto it = std::ranges::find(semaphores, w.point.timeline);
+                    if (it == semaphores.end())
+                    {
+                        semaphores.push_back(w.point.timeline);
+                        values.push_back(w.point.value);
+                    }
+                    else
+                    {
+                        std::uint64_t &value = values[static_cast<size_t>(it - semaphores.begin())];
+                        value = std::min(value, w.point.value);
+                    }
+                }
+            }
+            try
+            {
+                static_cast<void>(device->waitSemaphores(vk::SemaphoreWaitInfo(vk::SemaphoreWaitFlagBits::eAny, semaphores, values), std::numeric_limits<std::uint64_t>::max()));
+            }
+            catch (vk::SystemError const &error)
+            {
+                nrInfo(LogLevel::error)("Timeline wait failed: {}", error.what());
+            }
+
+            std::scoped_lock lock(mutex);
+            auto reached = std::ranges::partition(waits, [&](Wait const &w) { return !isComplete(w.point); });
+            for (Wait const &w : reached)
+                jobs->post([coroutine = w.coroutine] { coroutine.resume(); });
+            waits.erase(reached.begin(), reached.end());
+        }
+    }
+
+    vk::raii::Device const *device;
+    JobSystem *jobs;
+    vk::raii::Semaphore wake = {nullptr};
+    std::mutex mutex;
+    std::uint64_t wakeValue = 0;
+    std::vector<Wait> waits;
+    bool stopping = false;
+    std::thread worker;
+};
+
+} // namespace nr::rhi
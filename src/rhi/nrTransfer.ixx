@@ -0,0 +1,364 @@
+module;
+#include <vk_mem_alloc.h>
+#include <vulkan/vulkan_raii.hpp>
+export module nr.rhi.transfer;
+import nr.rhi.vk;
+import nr.rhi.queue;
+import nr.rhi.frame;
+import nr.rhi.memory;
+import nr.rhi.timeline;
+import nr.utils;
+import std;
+
+export namespace nr::rhi
+{
+
+// Uploads asset data through one persistently mapped staging ring on the transfer queue.
+//
+// Any thread may call upload*(): the data is copied straight into the ring and the copy command is appended to the
+// open batch. flush() (called once per frame, or automatically when a batch grows past autoFlushBytes) records the
+// whole batch into one command buffer, coalescing copies to the same destination into a single vkCmdCopyBuffer /
+// vkCmdCopyBufferToImage, and submits it. Every upload returns the SubmitPoint on the manager's own timeline that
+// its batch will signal, so consumers can depend on it before it is even flushed.
+//
+// When the owning QueueKind lives in another family the batch ends with a release barrier; submitAcquires() must be
+// called on the owner's side (typically at the start of each frame) to record the matching acquire barriers and
+// the timeline wait. The graphics queue never waits on the CPU and no staging buffer is ever created per request.
+class TransferManager
+{
+  public:
+    TransferManager(vk::raii::Device const &device, MemoryAllocator const &memory, QueueSystem &queues, vk::DeviceSize ringSize = 64ull << 20, vk::DeviceSize autoFlushBytes = 16ull << 20)
+        : device(&device), queues(&queues), transferQueue(&queues[QueueKind::transfer]), autoFlushBytes(autoFlushBytes)
+    {
+        ring = memory.createBuffer({.size = ringSize, .usage = vk::BufferUsageFlagBits::eTransferSrc, .memoryUsage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST, .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT});
+        ringData = static_cast<std::byte *>(ring.mapped());
+        vk::StructureChain<vk::SemaphoreCreateInfo, vk::SemaphoreTypeCreateInfo> semaphoreCreateInfo({}, {vk::SemaphoreType::eTimeline, 0});
+        timeline = vk::raii::Semaphore(device, semaphoreCreateInfo.get<vk::SemaphoreCreateInfo>());
+    }
+    TransferManager(const TransferManager &) = delete;
+    TransferManager &operator=(const TransferManager &) = delete;
+    ~TransferManager()
+    {
+        flush();
+        wait({*timeline, nextBatch - 1});
+    }
+
+    SubmitPoint uploadBuffer(vk::Buffer dst, vk::DeviceSize dstOffset, std::span<const std::byte> data, QueueKind owner = QueueKind::graphics)
+    {
+        SubmitPoint point;
+        // larger than the ring: split into chunks, each chunk may land in a different batch
+        const vk::DeviceSize chunk = ring.size() / 2;
+        for (vk::DeviceSize offset = 0; offset < data.size(); offset += chunk)
+        {
+            auto part = data.subspan(offset, std::min<vk::DeviceSize>(chunk, data.size() - offset));
+            point = stage(part, copyAlignment, [&](vk::DeviceSize stagingOffset) {
+                pending.bufferCopies.push_back({dst, vk::BufferCopy(stagingOffset, dstOffset + offset, part.size()), owner});
+            });
+        }
+        return point;
+    }
+
+    template <typename T> SubmitPoint uploadBuffer(Buffer const &dst, std::span<const T> data, vk::DeviceSize dstOffset = 0, QueueKind owner = QueueKind::graphics)
+    {
+        return uploadBuffer(dst.handle(), dstOffset, std::as_bytes(data), owner);
+    }
+
+    // Tightly packed texel data for one subresource region; `currentLayout` = eUndefined discards the old contents.
+    // Unlike buffers, images are not split: every batch transitions and releases the whole image, so the copy has to
+    // land in one batch and fit the ring.
+    SubmitPoint uploadImage(vk::Image dst, vk::ImageSubresourceLayers subresource, vk::Offset3D offset, vk::Extent3D extent, std::span<const std::byte> data, vk::ImageLayout finalLayout,
+                            vk::ImageLayout currentLayout = vk::ImageLayout::eUndefined, QueueKind owner = QueueKind::graphics)
+    {
+        if (data.size() > ring.size())
+            nrInfo(LogLevel::error)("Image upload of {} bytes does not fit the {} byte staging ring.", data.size(), ring.size());
+        return stage(data, imageCopyAlignment, [&](vk::DeviceSize stagingOffset) {
+            pending.imageCopies.push_back({dst, vk::BufferImageCopy(stagingOffset, 0, 0, subresource, offset, extent), currentLayout, finalLayout, owner});
+        });
+    }
+
+    // Streams a whole file into `dst`: read on a worker, staged and flushed, then resumed on a worker once the copy
+    // has finished on the transfer queue. `owner` still has to submitAcquires() before it reads the buffer.
+    Task<SubmitPoint> streamBuffer(TimelineWaiter &waiter, std::filesystem::path path, vk::Buffer dst, vk::DeviceSize dstOffset = 0, QueueKind owner = QueueKind::graphics)
+    {
+        const std::vector<std::byte> bytes = co_await readFile(std::move(path));
+        uploadBuffer(dst, dstOffset, bytes, owner);
+        const SubmitPoint point = flush();
+        co_await waiter.until(point);
+        co_return point;
+    }
+
+    // submit the open batch; returns its SubmitPoint (or the last one if nothing was pending)
+    SubmitPoint flush()
+    {
+        std::scoped_lock lock(mutex);
+        return flushLocked();
+    }
+
+    // Record, on `owner`'s queue, the acquire half of every ownership transfer flushed so far plus a wait on the
+    // newest flushed batch. Must be called by the thread that records for `owner` before it uses uploaded data.
+    void submitAcquires(QueueKind owner, Command &commands)
+    {
+        std::vector<vk::BufferMemoryBarrier2> bufferBarriers;
+        std::vector<vk::ImageMemoryBarrier2> imageBarriers;
+        std::uint64_t waitValue = 0;
+        {
+            std::scoped_lock lock(mutex);
+            auto &acquires = pendingAcquires[static_cast<size_t>(owner)];
+            bufferBarriers = std::move(acquires.buffers);
+            imageBarriers = std::move(acquires.images);
+            waitValue = std::exchange(acquires.waitValue, 0);
+            acquires = {};
+        }
+        if (waitValue == 0)
+            return;
+        std::vector<vk::CommandBuffer> cmds;
+        if (!bufferBarriers.empty() || !imageBarriers.empty())
+        {
+            vk::raii::CommandBuffer &cmd = commands.acquire();
+            cmd.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+            cmd.pipelineBarrier2(vk::DependencyInfo({}, {}, bufferBarriers, imageBarriers));
+            cmd.end();
+            cmds.push_back(*cmd);
+        }
+        const QueueWait wait{{*timeline, waitValue}, vk::PipelineStageFlagBits2::eAllCommands};
+        (*queues)[owner].enqueue({.commandBuffers = cmds, .waits = {&wait, 1}});
+    }
+
+    [[nodiscard]] bool isComplete(SubmitPoint point) const
+    {
+        return timeline.getCounterValue() >= point.value;
+    }
+    void wait(SubmitPoint point) const
+    {
+        if (point.value == 0)
+            return;
+        const vk::Semaphore semaphore = *timeline;
+        vk::detail::resultCheck(device->waitSemaphores(vk::SemaphoreWaitInfo({}, semaphore, point.value), std::numeric_limits<std::uint64_t>::max()), "Failed to wait for upload");
+    }
+
+  private:
+    static constexpr vk::DeviceSize copyAlignment = 16;
+    // covers optimalBufferCopyOffsetAlignment and the texel-size multiple required for every format
+    static constexpr vk::DeviceSize imageCopyAlignment = 256;
+
+    struct BufferCopy
+    {
+        vk::Buffer dst;
+        vk::BufferCopy region;
+        QueueKind owner;
+    };
+    struct ImageCopy
+    {
+        vk::Image dst;
+        vk::BufferImageCopy region;
+        vk::ImageLayout currentLayout;
+        vk::ImageLayout finalLayout;
+        QueueKind owner;
+    };
+    struct OpenBatch
+    {
+        std::vector<BufferCopy> bufferCopies;
+        std::vector<ImageCopy> imageCopies;
+        vk::DeviceSize bytes = 0;
+    };
+    struct InFlightBatch
+    {
+        std::uint64_t value;
+        std::uint64_t ringEnd; // ring head when the batch was closed; the tail may advance here once `value` is reached
+        Command commands;
+    };
+    struct Acquires
+    {
+        std::vector<vk::BufferMemoryBarrier2> buffers;
+        std::vector<vk::ImageMemoryBarrier2> images;
+        std::uint64_t waitValue = 0;
+    };
+
+    // reserve ring space, register the copy, then memcpy outside the lock
+    template <typename RegisterCopy> SubmitPoint stage(std::span<const std::byte> data, vk::DeviceSize alignment, RegisterCopy &&registerCopy)
+    {
+        std::byte *destination = nullptr;
+        SubmitPoint point;
+        bool flushNow = false;
+        {
+            std::unique_lock lock(mutex);
+            const vk::DeviceSize offset = reserve(lock, data.size(), alignment);
+            destination = ringData + offset;
+            registerCopy(offset);
+            pending.bytes += data.size();
+            point = {*timeline, nextBatch};
+            flushNow = pending.bytes >= autoFlushBytes;
+            writers.fetch_add(1, std::memory_order_relaxed);
+        }
+        std::memcpy(destination, data.data(), data.size());
+        writers.fetch_sub(1, std::memory_order_release);
+        writers.notify_all();
+
+        if (flushNow)
+            flush();
+        return point;
+    }
+
+    vk::DeviceSize reserve(std::unique_lock<std::mutex> &lock, vk::DeviceSize size, vk::DeviceSize alignment)
+    {
+        const vk::DeviceSize capacity = ring.size();
+        // could never fit, however much of the ring is retired
+        if (size > capacity)
+            nrInfo(LogLevel::error)("Staging {} bytes does not fit the {} byte staging ring.", size, capacity);
+        while (true)
+        {
+            std::uint64_t start = (head + alignment - 1) / alignment * alignment;
+            // never wrap inside an allocation
+            if (start % capacity + size > capacity)
+                start = (start / capacity + 1) * capacity;
+            if (start + size - tail <= capacity)
+            {
+                head = start + size;
+                return start % capacity;
+            }
+            if (retireCompleted())
+                continue;
+            if (inFlight.empty())
+            {
+                // nothing owns ring space but the wrap padding: restart at the next lap
+                if (pending.bufferCopies.empty() && pending.imageCopies.empty())
+                {
+                    head = tail = (head / capacity + 1) * capacity;
+                    continue;
+                }
+                flushLocked();
+            }
+            // ring is full of work the GPU has not finished: wait for the oldest batch (only upload threads block here)
+            const std::uint64_t oldest = inFlight.front().value;
+            lock.unlock();
+            wait({*timeline, oldest});
+            lock.lock();
+        }
+    }
+
+    // returns true if any ring space was freed
+    bool retireCompleted()
+    {
+        const std::uint64_t completed = timeline.getCounterValue();
+        bool freed = false;
+        while (!inFlight.empty() && inFlight.front().value <= completed)
+        {
+            tail = inFlight.front().ringEnd;
+            inFlight.front().commands.reset();
+            freeCommands.push_back(std::move(inFlight.front().commands));
+            inFlight.pop_front();
+            freed = true;
+        }
+        return freed;
+    }
+
+    SubmitPoint flushLocked()
+    {
+        if (pending.bufferCopies.empty() && pending.imageCopies.empty())
+            return {*timeline, nextBatch - 1};
+        // writers registered their copies under the lock but may still be filling the ring
+        for (std::uint32_t w = writers.load(std::memory_order_acquire); w != 0; w = writers.load(std::memory_order_acquire))
+        {
+            writers.wait(w, std::memory_order_acquire);
+        }
+        retireCompleted();
+
+        Command commands = freeCommands.empty() ? Command(*device, transferQueue->queueFamilyIndex()) : std::move(freeCommands.back());
+        if (!freeCommands.empty())
+            freeCommands.pop_back();
+        vk::raii::CommandBuffer &cmd = commands.acquire();
+        cmd.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+        const std::uint32_t transferFamily = transferQueue->queueFamilyIndex();
+
+        // image layouts: -> transferDst before the copies
+        std::vector<vk::ImageMemoryBarrier2> toTransfer;
+        for (ImageCopy const &c : pending.imageCopies)
+        {
+            if (std::ranges::any_of(toTransfer, [&](auto const &b) { return b.image == c.dst; }))
+                continue;
+            toTransfer.emplace_back(vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone, vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite, c.currentLayout, vk::ImageLayout::eTransferDstOptimal, vk::QueueFamilyIgnored,
+                                    vk::QueueFamilyIgnored, c.dst, vk::ImageSubresourceRange(c.region.imageSubresource.aspectMask, 0, vk::RemainingMipLevels, 0, vk::RemainingArrayLayers));
+        }
+        if (!toTransfer.empty())
+            cmd.pipelineBarrier2(vk::DependencyInfo({}, {}, {}, toTransfer));
+
+        // coalesce: one command per destination
+        std::ranges::stable_sort(pending.bufferCopies, {}, [](BufferCopy const &c) { return static_cast<VkBuffer>(c.dst); });
+        for (auto group : pending.bufferCopies | std::views::chunk_by([](auto const &a, auto const &b) { return a.dst == b.dst; }))
+        {
+            std::vector<vk::BufferCopy> regions = group | std::views::transform(&BufferCopy::region) | std::ranges::to<std::vector>();
+            cmd.copyBuffer(ring.handle(), group.front().dst, regions);
+        }
+        std::ranges::stable_sort(pending.imageCopies, {}, [](ImageCopy const &c) { return static_cast<VkImage>(c.dst); });
+        for (auto group : pending.imageCopies | std::views::chunk_by([](auto const &a, auto const &b) { return a.dst == b.dst; }))
+        {
+            std::vector<vk::BufferImageCopy> regions = group | std::views::transform(&ImageCopy::region) | std::ranges::to<std::vector>();
+            cmd.copyBufferToImage(ring.handle(), group.front().dst, vk::ImageLayout::eTransferDstOptimal, regions);
+        }
+
+        // release to the owner family (or plain transition when the family is shared)
+        const std::uint64_t value = nextBatch++;
+        std::vector<vk::BufferMemoryBarrier2> releaseBuffers;
+        std::vector<vk::ImageMemoryBarrier2> releaseImages;
+        for (auto group : pending.bufferCopies | std::views::chunk_by([](auto const &a, auto const &b) { return a.dst == b.dst; }))
+        {
+            const std::uint32_t ownerFamily = (*queues)[group.front().owner].queueFamilyIndex();
+            if (ownerFamily == transferFamily)
+                continue;
+            vk::BufferMemoryBarrier2 release(vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite, vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone, transferFamily, ownerFamily, group.front().dst, 0, vk::WholeSize);
+            releaseBuffers.push_back(release);
+            auto &acquire = pendingAcquires[static_cast<size_t>(group.front().owner)].buffers.emplace_back(release);
+            acquire.setSrcStageMask(vk::PipelineStageFlagBits2::eNone).setSrcAccessMask({}).setDstStageMask(vk::PipelineStageFlagBits2::eAllCommands).setDstAccessMask(vk::AccessFlagBits2::eMemoryRead);
+        }
+        for (auto group : pending.imageCopies | std::views::chunk_by([](auto const &a, auto const &b) { return a.dst == b.dst; }))
+        {
+            ImageCopy const &c = group.front();
+            const std::uint32_t ownerFamily = (*queues)[c.owner].queueFamilyIndex();
+            const bool transferOwnership = ownerFamily != transferFamily;
+            vk::ImageMemoryBarrier2 release(vk::PipelineStageFlagBits2::eCopy, vk::AccessFlagBits2::eTransferWrite, transferOwnership ? vk::PipelineStageFlagBits2::eNone : vk::PipelineStageFlagBits2::eAllCommands,
+                                            transferOwnership ? vk::AccessFlagBits2::eNone : vk::AccessFlagBits2::eMemoryRead, vk::ImageLayout::eTransferDstOptimal, c.finalLayout, transferOwnership ? transferFamily : vk::QueueFamilyIgnored,
+                                            transferOwnership ? ownerFamily : vk::QueueFamilyIgnored, c.dst, vk::ImageSubresourceRange(c.region.imageSubresource.aspectMask, 0, vk::RemainingMipLevels, 0, vk::RemainingArrayLayers));
+            releaseImages.push_back(release);
+            if (!transferOwnership)
+                continue;
+            auto &acquire = pendingAcquires[static_cast<size_t>(c.owner)].images.emplace_back(release);
+            acquire.setSrcStageMask(vk::PipelineStageFlagBits2::eNone).setSrcAccessMask({}).setDstStageMask(vk::PipelineStageFlagBits2::eAllCommands).setDstAccessMask(vk::AccessFlagBits2::eMemoryRead);
+        }
+        cmd.pipelineBarrier2(vk::DependencyInfo({}, {}, releaseBuffers, releaseImages));
+        cmd.end();
+
+        for (QueueKind owner : QueueSystem::wrappedKinds)
+        {
+            const bool used = std::ranges::any_of(pending.bufferCopies, [owner](auto const &c) { return c.owner == owner; }) || std::ranges::any_of(pending.imageCopies, [owner](auto const &c) { return c.owner == owner; });
+            if (used)
+                pendingAcquires[static_cast<size_t>(owner)].waitValue = value;
+        }
+
+        const vk::CommandBuffer cmdHandle = *cmd;
+        const vk::SemaphoreSubmitInfo signal(*timeline, value, vk::PipelineStageFlagBits2::eAllCommands);
+        transferQueue->submit({.commandBuffers = {&cmdHandle, 1}, .extraSignals = {&signal, 1}});
+        inFlight.push_back({value, head, std::move(commands)});
+        pending = {};
+        return {*timeline, value};
+    }
+
+    vk::raii::Device const *device;
+    QueueSystem *queues;
+    Queue *transferQueue;
+    vk::DeviceSize autoFlushBytes;
+    Buffer ring;
+    std::byte *ringData = nullptr;
+    vk::raii::Semaphore timeline = {nullptr};
+
+    std::mutex mutex;
+    std::atomic<std::uint32_t> writers = 0;
+    std::uint64_t head = 0; // monotonic byte positions; ring offset = position % capacity
+    std::uint64_t tail = 0;
+    std::uint64_t nextBatch = 1;
+    OpenBatch pending;
+    std::deque<InFlightBatch> inFlight;
+    std::vector<Command> freeCommands;
+    std::array<Acquires, static_cast<size_t>(QueueKind::size)> pendingAcquires;
+};
+
+} // namespace nr::rhi
@@ -0,0 +1,228 @@
+module;
+#include <vulkan/vulkan_raii.hpp>
+export module nr.rhi.validation;
+import nr.utils;
+import std;
+
+export namespace nr::rhi
+{
+
+struct ValidationMessageStatistics
+{
+    std::int32_t id = 0;
+    std::string idName;
+    vk::DebugUtilsMessageSeverityFlagBitsEXT severity = vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning;
+    vk::DebugUtilsMessageTypeFlagsEXT types;
+    std::uint64_t count = 0;
+    std::uint64_t printed = 0;
+    // message text and labels/objects of the first occurrence
+    std::string firstMessage;
+    std::string firstContext;
+    std::chrono::steady_clock::time_point firstSeen;
+    std::chrono::steady_clock::time_point lastPrinted;
+    // occurrences swallowed by the rate limit since the last printed one
+    std::uint64_t pendingRepeats = 0;
+};
+
+struct ValidationPolicy
+{
+    // a repeated ID is printed at most once per interval, as one line with the number of swallowed repeats
+    std::chrono::milliseconds repeatInterval{2000};
+    // summary table while messages are being rate limited; zero disables it
+    std::chrono::milliseconds summaryInterval{10000};
+    // ERROR-severity messages are logged at LogLevel::error, which ends the process; otherwise they are warnings
+    bool fatalErrors = true;
+};
+
+// Aggregates debug-utils messages by messageIdNumber; messages without one (ID 0, loader notices among them) are told
+// apart by their text. The first occurrence is printed in full with its labels and objects, repeats only as a periodic
+// one-line count, and every occurrence is counted for report(). Suppressed messages are still counted but never
+// printed. The messenger can call in from any thread.
+class ValidationMessages
+{
+  public:
+    static ValidationMessages &instance()
+    {
+        static ValidationMessages messages;
+        return messages;
+    }
+
+    void setPolicy(ValidationPolicy newPolicy)
+    {
+        std::scoped_lock lock(mutex);
+        policy = newPolicy;
+    }
+    void suppress(std::int32_t id)
+    {
+        std::scoped_lock lock(mutex);
+        suppressedIds.insert(id);
+    }
+    // by VUID or message ID name, for IDs whose number isn't stable across layer versions
+    void suppress(std::string_view idName)
+    {
+        std::scoped_lock lock(mutex);
+        suppressedNames.emplace(idName);
+    }
+    void unsuppress(std::int32_t id)
+    {
+        std::scoped_lock lock(mutex);
+        suppressedIds.erase(id);
+    }
+    void unsuppress(std::string_view idName)
+    {
+        std::scoped_lock lock(mutex);
+        if (auto it = suppressedNames.find(idName); it != suppressedNames.end())
+            suppressedNames.erase(it);
+    }
+    // by a fragment of the message text, for notices that carry no ID of their own
+    void suppressText(std::string_view fragment)
+    {
+        std::scoped_lock lock(mutex);
+        suppressedTexts.emplace(fragment);
+    }
+
+    void submit(vk::DebugUtilsMessageSeverityFlagBitsEXT severity, vk::DebugUtilsMessageTypeFlagsEXT types, vk::DebugUtilsMessengerCallbackDataEXT const &data)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        const std::string_view idName = data.pMessageIdName ? data.pMessageIdName : "";
+        const std::string_view text = data.pMessage ? data.pMessage : "";
+        // formatted under the lock, logged after it: an error ends the process from inside nrInfo
+        std::string line;
+        std::string summary;
+        LogLevel level = LogLevel::warning;
+        {
+            std::scoped_lock lock(mutex);
+            auto [it, inserted] = messages.try_emplace(MessageKey{data.messageIdNumber, data.messageIdNumber == 0 ? std::string(text) : std::string()});
+            ValidationMessageStatistics &stats = it->second;
+            ++stats.count;
+            if (inserted)
+            {
+                stats.id = data.messageIdNumber;
+                stats.idName = idName;
+                stats.severity = severity;
+                stats.types = types;
+                stats.firstMessage = text;
+                stats.firstContext = describeContext(data);
+                stats.firstSeen = now;
+            }
+            if (isSuppressed(data.messageIdNumber, idName, text))
+                return;
+
+            if (severity == vk::DebugUtilsMessageSeverityFlagBitsEXT::eError)
+                level = policy.fatalErrors ? LogLevel::error : LogLevel::warning;
+            else if (severity != vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning)
+                level = LogLevel::info;
+            if (inserted)
+            {
+                stats.lastPrinted = now;
+                ++stats.printed;
+                line = std::format("{} {} [{} 0x{:08x}]\n  {}{}", vk::to_string(severity), vk::to_string(types), idName, static_cast<std::uint32_t>(data.messageIdNumber), stats.firstMessage, stats.firstContext);
+            }
+            else if (now - stats.lastPrinted >= policy.repeatInterval)
+            {
+                stats.lastPrinted = now;
+                ++stats.printed;
+                line = std::format("{} [{} 0x{:08x}] repeated {} more times (total {})", vk::to_string(severity), idName, static_cast<std::uint32_t>(data.messageIdNumber), stats.pendingRepeats + 1, stats.count);
+                stats.pendingRepeats = 0;
+            }
+            else
+            {
+                ++stats.pendingRepeats;
+                ++rateLimited;
+            }
+
+            if (policy.summaryInterval.count() > 0 && rateLimited > 0 && now - lastSummary >= policy.summaryInterval)
+            {
+                lastSummary = now;
+                rateLimited = 0;
+                summary = table();
+            }
+        }
+        if (!line.empty())
+            nrInfo(level)("{}", line);
+        if (!summary.empty())
+            nrInfo(LogLevel::warning)("{}", summary);
+    }
+
+    [[nodiscard]] std::vector<ValidationMessageStatistics> statistics() const
+    {
+        std::scoped_lock lock(mutex);
+        std::vector<ValidationMessageStatistics> result;
+        result.reserve(messages.size());
+        for (auto const &[key, stats] : messages)
+            result.push_back(stats);
+        std::ranges::sort(result, std::greater{}, &ValidationMessageStatistics::count);
+        return result;
+    }
+
+    // on-exit summary; prints nothing when the layers stayed quiet
+    void report() const
+    {
+        std::scoped_lock lock(mutex);
+        if (!messages.empty())
+            nrInfo()("{}", table());
+    }
+
+  private:
+    ValidationMessages()
+    {
+        // notices that show up on every run:
+        //  0x822806fa VK_EXT_debug_utils is intended for debugging only
+        //  0xe8d1a9fe debug builds of the validation layers affect performance
+        suppressedIds = {static_cast<std::int32_t>(0x822806fa), static_cast<std::int32_t>(0xe8d1a9fe)};
+        // the loader reports this one without an ID, so it goes by its text
+        suppressedTexts = {"Override layer has override paths set to"};
+    }
+
+    // expects the mutex to be held
+    bool isSuppressed(std::int32_t id, std::string_view idName, std::string_view text) const
+    {
+        return suppressedIds.contains(id) || suppressedNames.contains(idName) || std::ranges::any_of(suppressedTexts, [&](std::string const &fragment) { return text.contains(fragment); });
+    }
+
+    static std::string describeContext(vk::DebugUtilsMessengerCallbackDataEXT const &data)
+    {
+        std::string context;
+        auto appendLabels = [&](std::string_view title, std::span<const vk::DebugUtilsLabelEXT> labels) {
+            if (labels.empty())
+                return;
+            context += std::format("\n  {}:", title);
+            for (auto const &label : labels)
+                context += std::format(" <{}>", label.pLabelName ? label.pLabelName : "");
+        };
+        appendLabels("queue labels", std::span(data.pQueueLabels, data.queueLabelCount));
+        appendLabels("command buffer labels", std::span(data.pCmdBufLabels, data.cmdBufLabelCount));
+        for (auto const &object : std::span(data.pObjects, data.objectCount))
+            context += std::format("\n  object {} 0x{:x}{}", vk::to_string(object.objectType), object.objectHandle, object.pObjectName ? std::format(" <{}>", object.pObjectName) : std::string());
+        return context;
+    }
+
+    // expects the mutex to be held
+    std::string table() const
+    {
+        std::vector<ValidationMessageStatistics const *> sorted;
+        for (auto const &[key, stats] : messages)
+            sorted.push_back(&stats);
+        std::ranges::sort(sorted, std::greater{}, [](auto const *s) { return s->count; });
+        std::string text = std::format("validation messages: {} distinct IDs\n{:<10} {:<8} {:>9} {:>8}  {}", sorted.size(), "id", "severity", "count", "printed", "name");
+        for (auto const *s : sorted)
+        {
+            const bool suppressed = isSuppressed(s->id, s->idName, s->firstMessage);
+            text += std::format("\n0x{:08x} {:<8} {:>9} {:>8}  {}{}", static_cast<std::uint32_t>(s->id), vk::to_string(s->severity), s->count, s->printed, s->idName, suppressed ? " (suppressed)" : "");
+        }
+        return text;
+    }
+
+    mutable std::mutex mutex;
+    ValidationPolicy policy;
+    // messageIdNumber, plus the text for messages whose number is 0
+    using MessageKey = std::pair<std::int32_t, std::string>;
+    std::map<MessageKey, ValidationMessageStatistics> messages;
+    std::set<std::int32_t> suppressedIds;
+    std::set<std::string, std::less<>> suppressedNames;
+    std::set<std::string, std::less<>> suppressedTexts;
+    std::uint64_t rateLimited = 0;
+    std::chrono::steady_clock::time_point lastSummary = std::chrono::steady_clock::now();
+};
+
+} // namespace nr::rhi
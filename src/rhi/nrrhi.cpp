@@ -1,6 +1,5 @@
 module;
 
-// #include <vk_mem_alloc.h>
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vulkan_raii.hpp>
 
@@ -17,41 +16,161 @@ concept hasCustomSetupInitialFlags = requires(T *t) {
     { t->setupInitialFlags() } -> std::same_as<void>;
 };
 
+// optional Derived hook run once the logical device exists, concurrently with swapchain creation (e.g. shader/pipeline warm-up)
+template <typename T>
+concept hasCustomWarmUp = requires(T *t) {
+    { t->warmUp() } -> std::same_as<void>;
+};
+
 namespace nr::rhi
 {
 
-template <typename Derived> void Device<Derived>::initialize(std::string const &_appName, std::string const &_engineName)
+template <typename Derived> void Device<Derived>::setupStage(std::string const &_appName, std::string const &_engineName, DisplayMode mode)
 {
+    startupTimeline.restart();
+    auto stage = startupTimeline.stage("setup flags");
     appName = _appName;
     engineName = _engineName;
+    displayMode = mode;
     setupInitialFlags();
     if constexpr (hasCustomSetupInitialFlags<Derived>)
     {
         static_cast<Derived *>(this)->setupInitialFlags();
     }
+}
+
+template <typename Derived> void Device<Derived>::instanceStage()
+{
+    auto stage = startupTimeline.stage("instance");
     instance = makeInstance();
     if constexpr (isDebugMode())
     {
         debugUtilsMessenger = vk::raii::DebugUtilsMessengerEXT(instance, makeDebugUtilsMessengerCreateInfoEXT());
     }
-    physicalDevice = selectPhysicalDevice(instance);
-    device = makeDevice();
+}
+
+template <typename Derived> void Device<Derived>::deviceStage()
+{
+    {
+        auto stage = startupTimeline.stage("physical device");
+        SelectedPhysicalDevice selected = selectPhysicalDevice(instance, {.requiredExtensions = deviceEnabledExtensions,
+                                                                          .optionalExtensions = deviceOptionalExtensions,
+                                                                          .requiredFeatures = &deviceEnabledFeatures,
+                                                                          .preferredDevice = preferredDevice,
+                                                                          .cacheDirectory = cacheDirectory});
+        physicalDevice = std::move(selected.physicalDevice);
+        capabilities = std::move(selected.capabilities);
+    }
+    {
+        auto stage = startupTimeline.stage("logical device");
+        device = makeDevice();
+        queues.emplace(device, queueFamilyDict, queueIndexDict);
+    }
+    auto stage = startupTimeline.stage("allocator");
+    memory.emplace(instance, physicalDevice, device);
+    transfer.emplace(device, *memory, *queues);
+    bindless.emplace(device, physicalDevice, deviceEnabledFeatures.get<vk::PhysicalDeviceVulkan12Features>());
+    resources.emplace(device, *memory);
+}
+
+template <typename Derived> void Device<Derived>::warmUpStage()
+{
+    auto stage = startupTimeline.stage("pipeline warm-up");
+    pipelineCache.emplace(device, physicalDevice, cacheDirectory);
+    pipelines.emplace(device, *resources, *pipelineCache);
+    if constexpr (hasCustomWarmUp<Derived>)
+    {
+        static_cast<Derived *>(this)->warmUp();
+    }
+}
+
+template <typename Derived> void Device<Derived>::presentationStage(Surface &&window)
+{
+    auto stage = startupTimeline.stage(isHeadless() ? "offscreen chain" : "surface + swapchain");
+    if (isHeadless())
+    {
+        offscreenChain = makeOffscreenChain();
+        return;
+    }
     std::apply(
         [this](Surface &&s, SwapChain &&sc) {
             surface = std::move(s);
             swapChain = std::move(sc);
         },
-        makeSurfaceAndSwapChain());
+        makeSurfaceAndSwapChain(std::move(window)));
+}
+
+template <typename Derived> void Device<Derived>::initialize(std::string const &_appName, std::string const &_engineName, DisplayMode mode)
+{
+    setupStage(_appName, _engineName, mode);
+    instanceStage();
+    deviceStage();
+    warmUpStage();
+    presentationStage(isHeadless() ? Surface{} : makeWindow());
+    startupTimeline.report("serial device bring-up");
+}
+
+// Stage graph:
+//   setup flags -> instance -> physical device -> logical device -> allocator -+-> pipeline warm-up ----+-> done
+//               \-> window (calling thread) ----------------------------------+-> surface + swapchain -+
+// GLFW requires window creation on the main thread, so the window is made on the caller while the device chain runs on a worker.
+template <typename Derived> std::future<void> Device<Derived>::initializeAsync(std::string const &_appName, std::string const &_engineName, DisplayMode mode)
+{
+    setupStage(_appName, _engineName, mode);
+    std::shared_future<void> instanceReady = std::async(std::launch::async, [this] { instanceStage(); }).share();
+    std::shared_future<void> deviceReady = std::async(std::launch::async, [this, instanceReady] {
+                                               instanceReady.get();
+                                               deviceStage();
+                                           }).share();
+    std::shared_future<void> warmUpDone = std::async(std::launch::async, [this, deviceReady] {
+                                              deviceReady.get();
+                                              warmUpStage();
+                                          }).share();
+    Surface window = isHeadless() ? Surface{} : makeWindow();
+    std::shared_future<void> presentationReady = std::async(std::launch::async, [this, deviceReady, window = std::move(window)]() mutable {
+                                                     deviceReady.get();
+                                                     presentationStage(std::move(window));
+                                                 }).share();
+    return std::async(std::launch::async, [this, warmUpDone, presentationReady] {
+        warmUpDone.get();
+        presentationReady.get();
+        startupTimeline.report("concurrent device bring-up");
+    });
 }
 
 template <typename Derived> void Device<Derived>::setupInitialFlags()
 {
-    uint32_t glfwCount = 0;
-    const char **glfwExt = glfwGetRequiredInstanceExtensions(&glfwCount);
-    for (uint32_t i = 0; i < glfwCount; ++i)
+    if (isHeadless())
+    {
+        std::erase(deviceEnabledExtensions, std::string{VK_KHR_SWAPCHAIN_EXTENSION_NAME});
+    }
+    else
     {
-        instanceEnabledExtensions.push_back(glfwExt[i]);
+        (void)Surface::glfwContext();
+        uint32_t glfwCount = 0;
+        const char **glfwExt = glfwGetRequiredInstanceExtensions(&glfwCount);
+        for (uint32_t i = 0; i < glfwCount; ++i)
+        {
+            instanceEnabledExtensions.push_back(glfwExt[i]);
+        }
     }
+    // timeline semaphores drive all queue synchronization (nr.rhi.queue), submission goes through vkQueueSubmit2
+    deviceEnabledFeatures.get<vk::PhysicalDeviceVulkan12Features>().timelineSemaphore = vk::True;
+    deviceEnabledFeatures.get<vk::PhysicalDeviceVulkan13Features>().synchronization2 = vk::True;
+    // the GPU profiler recycles its timestamp pools from the host (nr.rhi.profiler)
+    deviceEnabledFeatures.get<vk::PhysicalDeviceVulkan12Features>().hostQueryReset = vk::True;
+    // the descriptor indexing the bindless heap cannot work without (nr.rhi.descriptor); the rest is enabled in
+    // makeDevice where supported
+    deviceEnabledFeatures.get<vk::PhysicalDeviceVulkan12Features>()
+        .setRuntimeDescriptorArray(vk::True)
+        .setDescriptorBindingPartiallyBound(vk::True)
+        .setDescriptorBindingUpdateUnusedWhilePending(vk::True)
+        .setDescriptorBindingSampledImageUpdateAfterBind(vk::True);
+#if defined(_MSC_VER)
+#pragma warning(suppress : 4996) // getenv: read once at setup, before any thread could modify the environment
+#endif
+    if (const char *env = std::getenv("NR_DEVICE"); env && preferredDevice.empty())
+        preferredDevice = env;
     if constexpr (isDebugMode())
     {
         if (std::ranges::none_of(instanceEnabledLayers, [](std::string const &layer) { return layer == "VK_LAYER_KHRONOS_validation"; }))
@@ -68,16 +187,38 @@ template <typename Derived> void Device<Derived>::setupInitialFlags()
 template <typename Derived> vk::raii::Instance Device<Derived>::makeInstance(const uint32_t apiVersion) const
 {
     const vk::ApplicationInfo applicationInfo(appName.c_str(), 1, engineName.c_str(), 1, apiVersion);
-    std::vector<char const *> enabledLayers = gatherLayers(instanceEnabledLayers);
-    std::vector<char const *> enabledExtensions = gatherInstanceExtensions(instanceEnabledExtensions);
+    ScratchScope scratch;
+    std::pmr::vector<char const *> enabledLayers = gatherLayers(instanceEnabledLayers, scratch.resource());
+    std::pmr::vector<char const *> enabledExtensions = gatherInstanceExtensions(instanceEnabledExtensions, scratch.resource());
     return vk::raii::Instance(context, vk::InstanceCreateInfo({}, &applicationInfo, enabledLayers, enabledExtensions));
 }
 
 template <typename Derived> vk::raii::Device Device<Derived>::makeDevice()
 {
-    std::vector<char const *> enabledExtensions = deviceEnabledExtensions | std::ranges::to<std::set<std::string_view>>() | std::views::transform([](auto const &ext) { return ext.data(); }) | std::ranges::to<std::vector<char const *>>();
+    // required extensions were checked by selectPhysicalDevice; optional ones (ray tracing, absent on software ICDs such as lavapipe) are dropped if missing
+    ScratchScope scratch;
+    std::pmr::set<std::string_view> uniqueExtensions(deviceEnabledExtensions.begin(), deviceEnabledExtensions.end(), scratch.resource());
+    for (std::string const &ext : deviceOptionalExtensions)
+    {
+        if (capabilities.hasExtension(ext))
+            uniqueExtensions.insert(ext);
+        else
+            nrInfo(nr::LogLevel::warning)("Device extension '{}' is not supported and will be disabled.", ext);
+    }
+    std::pmr::vector<char const *> enabledExtensions(scratch.resource());
+    for (std::string_view ext : uniqueExtensions)
+        enabledExtensions.push_back(ext.data());
+
+    // optional descriptor indexing: storage descriptors the heap can update after bind, non-uniform indexing for shaders
+    vk::PhysicalDeviceVulkan12Features const &supported12 = capabilities.features12;
+    deviceEnabledFeatures.get<vk::PhysicalDeviceVulkan12Features>()
+        .setDescriptorBindingStorageImageUpdateAfterBind(supported12.descriptorBindingStorageImageUpdateAfterBind)
+        .setDescriptorBindingStorageBufferUpdateAfterBind(supported12.descriptorBindingStorageBufferUpdateAfterBind)
+        .setShaderSampledImageArrayNonUniformIndexing(supported12.shaderSampledImageArrayNonUniformIndexing)
+        .setShaderStorageImageArrayNonUniformIndexing(supported12.shaderStorageImageArrayNonUniformIndexing)
+        .setShaderStorageBufferArrayNonUniformIndexing(supported12.shaderStorageBufferArrayNonUniformIndexing);
 
-    auto queueFamilyProperties = physicalDevice.getQueueFamilyProperties();
+    auto const &queueFamilyProperties = capabilities.queueFamilies;
 
     {
         // record the index of each queue family
@@ -108,70 +249,269 @@ template <typename Derived> vk::raii::Device Device<Derived>::makeDevice()
 
         std::ranges::for_each(results, [this](auto const &pair) { queueFamilyDict[static_cast<size_t>(pair.first)] = pair.second; });
     }
-    constexpr float queuePriority = 1.0f;
-    std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos = queueFamilyProperties | std::views::enumerate | std::views::transform([&](auto &&p) {
-                                                                  auto &&[i, _] = p;
-                                                                  return vk::DeviceQueueCreateInfo({}, static_cast<uint32_t>(i), 1, &queuePriority);
+    // hand out queue indices of each family to the kinds mapped onto it, in QueueKind order, clamped to queueCount;
+    // a kind that finds its family exhausted shares queue 0 of that family. That is the normal case for single-queue
+    // requests (the defaults put graphics, compute and transfer on one family on many devices), so only a kind that
+    // asked for several queues is told it got fewer
+    std::vector<std::vector<float>> familyPriorities(queueFamilyProperties.size());
+    for (auto &&[kindIndex, priorities] : std::views::enumerate(queuePriorities))
+    {
+        const size_t family = queueFamilyDict[kindIndex];
+        const uint32_t capacity = queueFamilyProperties[family].queueCount;
+        auto &indices = queueIndexDict[kindIndex];
+        indices.clear();
+        for (float priority : priorities)
+        {
+            if (familyPriorities[family].size() >= capacity)
+            {
+                if (priorities.size() > 1)
+                    nrInfo(nr::LogLevel::warning)("Queue kind {} requested {} queues but family {} only has {} left; clamped to {}.", kindIndex, priorities.size(), family, capacity, std::max<size_t>(indices.size(), 1));
+                break;
+            }
+            indices.push_back(static_cast<uint32_t>(familyPriorities[family].size()));
+            familyPriorities[family].push_back(std::clamp(priority, 0.0f, 1.0f));
+        }
+        if (indices.empty() && !priorities.empty())
+            indices.push_back(0);
+    }
+    // families nobody asked for still get one queue, as before
+    std::ranges::for_each(familyPriorities, [](auto &fp) {
+        if (fp.empty())
+            fp.push_back(1.0f);
+    });
+    std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos = familyPriorities | std::views::enumerate | std::views::transform([](auto &&p) {
+                                                                  auto &&[i, priorities] = p;
+                                                                  return vk::DeviceQueueCreateInfo({}, static_cast<uint32_t>(i), priorities);
                                                               }) |
                                                               std::ranges::to<std::vector>();
-    vk::DeviceCreateInfo deviceCreateInfo(vk::DeviceCreateFlags(), queueCreateInfos, {} /* EnabledLayerNames is deprecated and ignored.*/, enabledExtensions, nullptr);
+    vk::DeviceCreateInfo deviceCreateInfo(vk::DeviceCreateFlags(), queueCreateInfos, {} /* EnabledLayerNames is deprecated and ignored.*/, enabledExtensions, nullptr, &deviceEnabledFeatures.get<vk::PhysicalDeviceFeatures2>());
 
     return vk::raii::Device(physicalDevice, deviceCreateInfo);
 }
 
-template <typename Derived> std::tuple<Surface, SwapChain> Device<Derived>::makeSurfaceAndSwapChain()
+template <typename Derived> OffscreenChain Device<Derived>::makeOffscreenChain(const uint32_t imageCount)
 {
+    OffscreenChain result;
+    result.resources = &*resources;
+    const ImageDesc imageDesc{.createInfo = vk::ImageCreateInfo({}, vk::ImageType::e2D, result.format, vk::Extent3D(result.extent, 1), 1, 1, vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal,
+                                                                vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eColorAttachment, vk::SharingMode::eExclusive, {}, vk::ImageLayout::eUndefined),
+                              .renderTarget = true};
+
+    const vk::ImageViewCreateInfo imageViewCreateInfo({}, {}, vk::ImageViewType::e2D, result.format, {}, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+    for (uint32_t i = 0; i < imageCount; ++i)
+    {
+        const ImageId image = result.images.emplace_back(resources->createImage(imageDesc));
+        result.imageViews.push_back(resources->createImageView(image, imageViewCreateInfo));
+    }
+    return result;
+}
+
+template <typename Derived> Surface Device<Derived>::makeWindow() const
+{
+    auto stage = startupTimeline.stage("window");
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     Surface resultSurface;
     resultSurface.handle.reset(glfwCreateWindow(resultSurface.extent.width, resultSurface.extent.height, appName.c_str(), nullptr, nullptr));
+    return resultSurface;
+}
+
+template <typename Derived> std::tuple<Surface, SwapChain> Device<Derived>::makeSurfaceAndSwapChain()
+{
+    return makeSurfaceAndSwapChain(makeWindow());
+}
+
+template <typename Derived> std::tuple<Surface, SwapChain> Device<Derived>::makeSurfaceAndSwapChain(Surface &&window)
+{
+    Surface resultSurface = std::move(window);
     VkSurfaceKHR rawSurface;
     vk::detail::resultCheck(static_cast<vk::Result>(glfwCreateWindowSurface(*instance, resultSurface.handle.get(), nullptr, &rawSurface)), "Failed to create window surface");
 
     resultSurface.surface = vk::raii::SurfaceKHR(instance, rawSurface);
 
-    nrAssert(physicalDevice.getSurfaceSupportKHR(static_cast<uint32_t>(queueFamilyDict[static_cast<size_t>(QueueKind::compute)]), resultSurface.surface))("Queue does not support present");
-    std::vector<vk::SurfaceFormatKHR> formats = physicalDevice.getSurfaceFormatsKHR(resultSurface.surface);
-    nrAssert(!formats.empty())("No available surface formats");
-
-    auto selectedFormat = [&formats]() -> vk::SurfaceFormatKHR {
-        auto it = std::ranges::find_if(formats, [](const auto &f) { return f.format == vk::Format::eB8G8R8A8Srgb; });
-        if (it != formats.end())
-            return *it;
-
-        it = std::ranges::find_if(formats, [](const auto &f) { return f.format == vk::Format::eR8G8B8A8Srgb; });
-        if (it != formats.end())
-            return *it;
-        nrInfo(nr::LogLevel::warning)("Your device does not support basic sRGB format. You may need to convert output color space manually.");
-        return formats.front();
-    }();
-    resultSurface.format = selectedFormat.format;
-
-    vk::SurfaceCapabilitiesKHR surfaceCapabilities = physicalDevice.getSurfaceCapabilitiesKHR(resultSurface.surface);
-    // auto property = physicalDevice.getImageFormatProperties(resultSurface.format, vk::ImageType::e2D, vk::ImageTiling::eLinear, vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eStorage);
-    vk::SwapchainCreateInfoKHR swapChainCreateInfo(vk::SwapchainCreateFlagsKHR(), resultSurface.surface, std::clamp(3u, surfaceCapabilities.minImageCount, surfaceCapabilities.maxImageCount), selectedFormat.format, selectedFormat.colorSpace, resultSurface.extent, 1,
-                                                   vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eColorAttachment, vk::SharingMode::eExclusive, {}, vk::SurfaceTransformFlagBitsKHR::eIdentity, vk::CompositeAlphaFlagBitsKHR::eOpaque, vk::PresentModeKHR::eMailbox, vk::False);
-    SwapChain resultSwapChain;
-    resultSwapChain.swapChain = {device, swapChainCreateInfo};
-    resultSwapChain.swapChainImages = resultSwapChain.swapChain.getImages();
-    vk::ImageViewCreateInfo imageViewCreateInfo({}, {}, vk::ImageViewType::e2D, selectedFormat.format, {}, {vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
-    resultSwapChain.imageViews = resultSwapChain.swapChainImages | std::views::transform([&](const auto &img) {
-                                     imageViewCreateInfo.image = img;
-                                     return vk::raii::ImageView(device, imageViewCreateInfo);
-                                 }) |
-                                 std::ranges::to<std::vector>();
+    // frames are presented from the graphics queue
+    SwapChain resultSwapChain(device, physicalDevice, *resultSurface.surface, (*queues)[QueueKind::graphics], resultSurface.extent, presentPolicy);
+    resultSurface.format = resultSwapChain.format();
     return {std::move(resultSurface), std::move(resultSwapChain)};
 }
 
-void application()
+void application(bool headless, bool asyncInit, uint32_t framesInFlight, bool watchShaders)
+{
+    Device<void> device;
+    if (asyncInit)
+        device.initializeAsync("HelloVulkan", "VKEngine", headless ? DisplayMode::headless : DisplayMode::window).get();
+    else
+        device.initialize("HelloVulkan", "VKEngine", headless ? DisplayMode::headless : DisplayMode::window);
+
+    Queue &graphicsQueue = (*device.queues)[QueueKind::graphics];
+    FrameRing frames(device.device, *device.queues, graphicsQueue.queueFamilyIndex(), framesInFlight);
+    GpuProfiler profiler(device.device, device.physicalDevice, graphicsQueue, frames.framesInFlight(), device.capabilities.hasExtension(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME));
+
+    // the frame target is rebound to the acquired image every frame; the graph derives the clear's barriers from it
+    RenderGraph graph(device.device, *device.memory);
+    const ImageHandle backBuffer = headless ? graph.importImage("backbuffer", {}, {}, device.offscreenChain.format, device.offscreenChain.extent, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferSrcOptimal)
+                                            : graph.importImage("backbuffer", {}, {}, device.surface.format, device.surface.extent, vk::ImageLayout::eUndefined, vk::ImageLayout::ePresentSrcKHR);
+    uint32_t frame = 0;
+    graph.addPass("clear", [&frame, backBuffer](vk::raii::CommandBuffer const &cmd, RenderGraph const &resources) {
+             const float t = static_cast<float>(frame % 256) / 255.0f;
+             cmd.clearColorImage(resources.image(backBuffer), vk::ImageLayout::eTransferDstOptimal, vk::ClearColorValue(std::array<float, 4>{t, 0.2f, 1.0f - t, 1.0f}), vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1});
+         })
+        .write(backBuffer, Access::transferWrite);
+    graph.compile();
+    graph.report();
+    if (watchShaders)
+        device.pipelines->watch();
+
+    constexpr uint32_t frameCount = 1000;
+    const auto start = std::chrono::steady_clock::now();
+    // time spent minimized is left out of the ms/frame figure
+    std::chrono::steady_clock::duration paused{};
+    // counts presented frames only; a skipped acquire does not advance it
+    while (frame < frameCount)
+    {
+        int width = 0, height = 0;
+        if (!headless)
+        {
+            GLFWwindow *window = device.surface.handle.get();
+            glfwPollEvents();
+            glfwGetFramebufferSize(window, &width, &height);
+            if ((width == 0 || height == 0) && !glfwWindowShouldClose(window))
+            {
+                // minimized: there is nothing to present to, so block on events instead of spinning
+                const auto pauseStart = std::chrono::steady_clock::now();
+                do
+                {
+                    glfwWaitEvents();
+                    glfwGetFramebufferSize(window, &width, &height);
+                } while ((width == 0 || height == 0) && !glfwWindowShouldClose(window));
+                paused += std::chrono::steady_clock::now() - pauseStart;
+            }
+            if (glfwWindowShouldClose(window))
+                break;
+        }
+        FrameContext &frameContext = frames.beginFrame();
+        device.resources->recycle();
+        // shaders rebuilt in the background since the last frame replace their pipelines before anything is recorded
+        device.pipelines->commit(graphicsQueue.lastEnqueuedPoint());
+        profiler.beginFrame(frameContext.frameNumber);
+        auto traceZone = nrZone("frame");
+        // acquire before anything is submitted so a skipped frame (minimized, out of date) leaves no work behind
+        AcquiredImage target;
+        if (headless)
+        {
+            target.index = device.offscreenChain.acquireNextImage();
+            target.image = device.offscreenChain.image(target.index);
+        }
+        else
+        {
+            device.swapChain.resize({static_cast<uint32_t>(width), static_cast<uint32_t>(height)});
+            std::optional<AcquiredImage> acquired = device.swapChain.acquire(*frameContext.imageAvailable);
+            if (!acquired)
+                continue;
+            target = *acquired;
+        }
+        const vk::Image image = target.image;
+        // uploads issued since the last frame become visible to this frame's graphics work
+        auto recordZone = nrZone("record");
+        device.transfer->flush();
+        device.transfer->submitAcquires(QueueKind::graphics, frameContext.commands(0));
+
+        auto &cmd = frameContext.commands(0).acquire();
+        cmd.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+        graph.setImportedImage(backBuffer, image);
+        graph.execute(cmd, &profiler);
+        cmd.end();
+
+        const vk::CommandBuffer cmdHandle = *cmd;
+        const vk::SemaphoreSubmitInfo acquireWait(*frameContext.imageAvailable, 0, vk::PipelineStageFlagBits2::eTransfer);
+        const vk::SemaphoreSubmitInfo renderSignal(target.renderFinished, 0, vk::PipelineStageFlagBits2::eAllCommands);
+        SubmitDesc submitDesc{.commandBuffers = {&cmdHandle, 1}};
+        if (!headless)
+        {
+            submitDesc.extraWaits = {&acquireWait, 1};
+            submitDesc.extraSignals = {&renderSignal, 1};
+        }
+        frameContext.signalOn(graphicsQueue.submit(submitDesc));
+        if (!headless)
+            device.swapChain.present(target);
+        ++frame;
+    }
+    device.queues->waitIdle();
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start - paused;
+    device.pipelineCache->report();
+    device.memory->report();
+    profiler.flush();
+    profiler.report();
+    ValidationMessages::instance().report();
+    nrInfo()("{} frames in {:.2f} ms ({:.3f} ms/frame, {}, {} frames in flight)", frame, elapsed.count(), frame ? elapsed.count() / frame : 0.0, headless ? "headless" : "windowed", frames.framesInFlight());
+}
+// Draw-recording throughput from 1 thread to every job-system slot. Until nr.rhi has shader pipelines a "draw" records
+// the per-draw state a real draw sets (push constants, viewport, scissor); the cost measured is the same CPU-side
+// command encoding that scales with thread count. Run with VK_ICD_FILENAMES pointing at lavapipe for CI numbers.
+void recordingBenchmark(bool headless, uint32_t drawsPerFrame)
 {
     Device<void> device;
-    device.initialize("HelloVulkan", "VKEngine");
+    device.initialize("RecordingBenchmark", "VKEngine", headless ? DisplayMode::headless : DisplayMode::window);
+    Queue &graphicsQueue = (*device.queues)[QueueKind::graphics];
+    const vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eAll, 0, sizeof(std::array<float, 16>));
+    vk::raii::PipelineLayout pipelineLayout(device.device, vk::PipelineLayoutCreateInfo({}, {}, pushConstantRange));
+
+    const uint32_t maxThreads = JobSystem::instance().slotCount();
+    std::vector<uint32_t> threadCounts;
+    for (uint32_t t = 1; t < maxThreads; t *= 2)
+    {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(maxThreads);
+
+    constexpr uint32_t jobCount = 64;
+    constexpr uint32_t frameCount = 60;
+    double baseline = 0.0;
+    for (uint32_t threads : threadCounts)
+    {
+        ParallelRecorder recorder(threads);
+        FrameRing frames(device.device, *device.queues, graphicsQueue.queueFamilyIndex(), 2, recorder.threadCount());
+        std::vector<RecordJob> jobs;
+        for (uint32_t j = 0; j < jobCount; ++j)
+        {
+            const uint32_t first = drawsPerFrame * j / jobCount;
+            const uint32_t last = drawsPerFrame * (j + 1) / jobCount;
+            jobs.emplace_back([first, last, layout = *pipelineLayout](vk::raii::CommandBuffer &cmd) {
+                for (uint32_t draw = first; draw < last; ++draw)
+                {
+                    std::array<float, 16> transform{};
+                    transform.fill(static_cast<float>(draw));
+                    cmd.pushConstants<float>(layout, vk::ShaderStageFlagBits::eAll, 0, transform);
+                    cmd.setViewport(0, vk::Viewport(0.0f, 0.0f, 1920.0f, 1080.0f, 0.0f, 1.0f));
+                    cmd.setScissor(0, vk::Rect2D({static_cast<int32_t>(draw % 1920), 0}, {1, 1}));
+                }
+            });
+        }
+
+        std::chrono::duration<double, std::milli> recording{};
+        for (uint32_t frame = 0; frame < frameCount; ++frame)
+        {
+            FrameContext &frameContext = frames.beginFrame();
+            const auto begin = std::chrono::steady_clock::now();
+            std::vector<vk::CommandBuffer> secondaries = recorder.record(frameContext, jobs);
+            auto &primary = frameContext.commands(0).acquire();
+            primary.begin({vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+            primary.executeCommands(secondaries);
+            primary.end();
+            recording += std::chrono::steady_clock::now() - begin;
+            const vk::CommandBuffer primaryHandle = *primary;
+            frameContext.signalOn(graphicsQueue.submit({.commandBuffers = {&primaryHandle, 1}}));
+        }
+        frames.waitIdle();
+
+        const double msPerFrame = recording.count() / frameCount;
+        if (baseline == 0.0)
+            baseline = msPerFrame;
+        nrInfo()("recording: {:>3} threads  {:>8.3f} ms/frame  {:>10.0f} draws/ms  speedup {:.2f}x", recorder.concurrency(), msPerFrame, drawsPerFrame / msPerFrame, baseline / msPerFrame);
+    }
 }
-void rhiTest()
+
+void rhiTest(bool headless, bool asyncInit, uint32_t framesInFlight, bool watchShaders)
 {
-    using namespace std;
-    auto foo = [](const int x) { return x + 1; };
-    // print("hello from rhiTest:{}\n", foo(1));
-    application();
+    application(headless, asyncInit, framesInFlight, watchShaders);
 }
 } // namespace nr::rhi
\ No newline at end of file
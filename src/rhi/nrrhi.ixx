@@ -3,10 +3,32 @@ module;
 #include <vulkan/vulkan_raii.hpp>
 export module nr.rhi;
 import nr.rhi.vk;
+export import nr.rhi.pipelineCache;
+export import nr.rhi.queue;
+export import nr.rhi.frame;
+export import nr.rhi.record;
+export import nr.rhi.memory;
+export import nr.rhi.transfer;
+export import nr.rhi.descriptor;
+export import nr.rhi.renderGraph;
+export import nr.rhi.swapChain;
+export import nr.rhi.profiler;
+export import nr.rhi.validation;
+export import nr.rhi.timeline;
+export import nr.rhi.resources;
+export import nr.rhi.pipelineLibrary;
 import nr.utils;
+import std;
 export namespace nr::rhi
 {
 
+enum class DisplayMode
+{
+    window,
+    // no GLFW window, no VkSurfaceKHR: frames are rendered into an OffscreenChain
+    headless
+};
+
 struct Surface
 {
     class GlfwContext final
@@ -26,38 +48,162 @@ struct Surface
         {
             glfwTerminate();
         }
-    } inline static glfwCtx;
+    };
+    // created on first use so that headless runs never touch GLFW (glfwInit fails without a display)
+    static GlfwContext &glfwContext()
+    {
+        static GlfwContext ctx;
+        return ctx;
+    }
 
     std::unique_ptr<GLFWwindow, decltype(&glfwDestroyWindow)> handle{nullptr, &glfwDestroyWindow};
     vk::Extent2D extent{1920, 1080};
     vk::raii::SurfaceKHR surface = {nullptr};
     vk::Format format;
-    Surface()
-    {
-        (void)&glfwCtx;
-    }
+    Surface() = default;
     Surface(const Surface &) = delete;
     Surface &operator=(const Surface &) = delete;
     Surface(Surface &&) = default;
     Surface &operator=(Surface &&) = default;
 };
 
-struct SwapChain
+// Ring of pooled images standing in for the swapchain in DisplayMode::headless
+struct OffscreenChain
 {
-    vk::raii::SwapchainKHR swapChain = {nullptr};
-    std::vector<vk::Image> swapChainImages;
-    std::vector<vk::raii::ImageView> imageViews;
-    SwapChain() = default;
-    SwapChain(const SwapChain &) = delete;
-    SwapChain &operator=(const SwapChain &) = delete;
-    SwapChain(SwapChain &&) = default;
-    SwapChain &operator=(SwapChain &&) = default;
+    vk::Extent2D extent{1920, 1080};
+    vk::Format format = vk::Format::eR8G8B8A8Unorm;
+    ResourcePools *resources = nullptr;
+    std::vector<ImageId> images;
+    std::vector<ImageViewId> imageViews;
+    uint32_t nextImage = 0;
+
+    OffscreenChain() = default;
+    OffscreenChain(const OffscreenChain &) = delete;
+    OffscreenChain &operator=(const OffscreenChain &) = delete;
+    OffscreenChain(OffscreenChain &&other) noexcept
+    {
+        *this = std::move(other);
+    }
+    OffscreenChain &operator=(OffscreenChain &&other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            resources = std::exchange(other.resources, nullptr);
+            images = std::move(other.images);
+            imageViews = std::move(other.imageViews);
+            extent = other.extent;
+            format = other.format;
+            nextImage = std::exchange(other.nextImage, 0);
+        }
+        return *this;
+    }
+    ~OffscreenChain()
+    {
+        release();
+    }
+
+    [[nodiscard]] vk::Image image(uint32_t index) const
+    {
+        return resources->image(images[index]);
+    }
+
+    // round-robin over the ring; the FrameRing guarantees the image is no longer in use
+    uint32_t acquireNextImage()
+    {
+        uint32_t index = nextImage;
+        nextImage = (nextImage + 1) % static_cast<uint32_t>(images.size());
+        return index;
+    }
+
+  private:
+    // the device is idle by the time a chain goes away; views first, they must not outlive their images
+    void release()
+    {
+        if (!resources)
+            return;
+        for (ImageViewId view : imageViews)
+            resources->release(view);
+        for (ImageId image : images)
+            resources->release(image);
+        resources->recycle();
+        imageViews.clear();
+        images.clear();
+    }
 };
 
-struct Command
+// Wall-clock breakdown of device bring-up; stages may be recorded concurrently from several threads
+class StartupTimeline
 {
-    vk::raii::CommandPool commandPool = {nullptr};
-    std::vector<vk::raii::CommandBuffer> commandBuffers;
+  public:
+    using Clock = std::chrono::steady_clock;
+    class Stage
+    {
+      public:
+        Stage(StartupTimeline &timeline, std::string_view name) : timeline(timeline), name(name), begin(Clock::now())
+        {
+        }
+        Stage(const Stage &) = delete;
+        Stage &operator=(const Stage &) = delete;
+        ~Stage()
+        {
+            timeline.record(name, begin, Clock::now());
+        }
+
+      private:
+        StartupTimeline &timeline;
+        std::string_view name;
+        Clock::time_point begin;
+    };
+
+    [[nodiscard]] Stage stage(std::string_view name)
+    {
+        return Stage(*this, name);
+    }
+    void restart()
+    {
+        std::scoped_lock lock(mutex);
+        origin = Clock::now();
+        records.clear();
+    }
+    void report(std::string_view title) const
+    {
+        std::scoped_lock lock(mutex);
+        using Ms = std::chrono::duration<double, std::milli>;
+        std::vector<std::thread::id> threads;
+        std::string table;
+        double serialSum = 0.0;
+        Clock::time_point last = origin;
+        for (auto const &r : records)
+        {
+            auto it = std::ranges::find(threads, r.thread);
+            if (it == threads.end())
+                it = threads.insert(threads.end(), r.thread);
+            const double duration = Ms(r.end - r.begin).count();
+            serialSum += duration;
+            last = std::max(last, r.end);
+            table += std::format("\n    {:<22} start {:>8.2f} ms  took {:>8.2f} ms  thread #{}", r.name, Ms(r.begin - origin).count(), duration, std::distance(threads.begin(), it));
+        }
+        nrInfo()("{}: {:.2f} ms wall, {:.2f} ms summed over stages{}", title, Ms(last - origin).count(), serialSum, table);
+    }
+
+  private:
+    struct Record
+    {
+        std::string_view name;
+        Clock::time_point begin;
+        Clock::time_point end;
+        std::thread::id thread;
+    };
+    void record(std::string_view name, Clock::time_point begin, Clock::time_point end)
+    {
+        std::scoped_lock lock(mutex);
+        records.push_back({name, begin, end, std::this_thread::get_id()});
+    }
+
+    mutable std::mutex mutex;
+    Clock::time_point origin = Clock::now();
+    std::vector<Record> records;
 };
 
 template <typename Derived> class Device
@@ -70,25 +216,72 @@ template <typename Derived> class Device
     vk::raii::DebugUtilsMessengerEXT debugUtilsMessenger = {nullptr};
     vk::raii::PhysicalDevice physicalDevice = {nullptr};
     vk::raii::Device device = {nullptr};
+    std::optional<QueueSystem> queues;
+    std::optional<PipelineCache> pipelineCache;
+    std::optional<MemoryAllocator> memory;
+    std::optional<TransferManager> transfer;
+    std::optional<BindlessHeap> bindless;
+    std::optional<ResourcePools> resources;
+    // destroyed before the pools and the cache it builds into
+    std::optional<PipelineLibrary> pipelines;
     Surface surface;
     SwapChain swapChain;
+    OffscreenChain offscreenChain;
     Device() = default;
     Device(Device &) = delete;
     Device &operator=(Device &) = delete;
-    void initialize(std::string const &appName = {"DefaultApp"}, std::string const &_engineName = {"DefaultEngine"});
+    void initialize(std::string const &appName = {"DefaultApp"}, std::string const &_engineName = {"DefaultEngine"}, DisplayMode mode = DisplayMode::window);
+    // Runs independent bring-up stages concurrently. Must be called from the main thread (GLFW window creation);
+    // the Device must not be used or destroyed until the returned future is ready. get() rethrows stage failures.
+    [[nodiscard]] std::future<void> initializeAsync(std::string const &appName = {"DefaultApp"}, std::string const &_engineName = {"DefaultEngine"}, DisplayMode mode = DisplayMode::window);
     vk::raii::Instance makeInstance(uint32_t apiVersion = VK_API_VERSION_1_4) const;
     vk::raii::Device makeDevice();
+    Surface makeWindow() const;
     std::tuple<Surface, SwapChain> makeSurfaceAndSwapChain();
+    std::tuple<Surface, SwapChain> makeSurfaceAndSwapChain(Surface &&window);
+    // imageCount must be at least the number of frames in flight
+    OffscreenChain makeOffscreenChain(uint32_t imageCount = FrameRing::maxFramesInFlight);
+    bool isHeadless() const
+    {
+        return displayMode == DisplayMode::headless;
+    }
+    size_t queueFamilyIndex(QueueKind kind) const
+    {
+        return queueFamilyDict[static_cast<size_t>(kind)];
+    }
     ~Device() = default;
 
   protected:
+    void setupStage(std::string const &appName, std::string const &engineName, DisplayMode mode);
+    void instanceStage();
+    void deviceStage();
+    void warmUpStage();
+    void presentationStage(Surface &&window);
+    mutable StartupTimeline startupTimeline;
+    DisplayMode displayMode = DisplayMode::window;
+    PresentPolicy presentPolicy = PresentPolicy::lowLatency;
+    // where persistent caches (pipeline cache blobs, ...) are stored
+    std::filesystem::path cacheDirectory{"cache"};
     void setupInitialFlags();
     std::vector<std::string> instanceEnabledLayers{};
     std::vector<std::string> instanceEnabledExtensions{};
     // std::vector<std::string> physicalDeviceFeatures{};
-    std::vector<std::string> deviceEnabledExtensions{VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME, VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME, VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME, VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+    // devices without a required extension or feature are never selected; optional extensions are enabled where present
+    std::vector<std::string> deviceEnabledExtensions{VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+    std::vector<std::string> deviceOptionalExtensions{VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME, VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME, VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME,
+                                                       VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME};
+    DeviceFeatureChain deviceEnabledFeatures{};
+    // GPU index or name substring; defaults to the NR_DEVICE environment variable
+    std::string preferredDevice;
+    DeviceCapabilities capabilities;
     std::array<size_t, static_cast<size_t>(QueueKind::size)> queueFamilyDict{};
+    // Requested queues per QueueKind, one priority in [0, 1] each; Derived::setupInitialFlags may change them.
+    // makeDevice clamps the requests to the family's queueCount and records the granted indices in queueIndexDict.
+    std::array<std::vector<float>, static_cast<size_t>(QueueKind::size)> queuePriorities{{{1.0f}, {1.0f}, {1.0f}, {}, {}, {}}};
+    std::array<std::vector<uint32_t>, static_cast<size_t>(QueueKind::size)> queueIndexDict{};
 };
 
-void rhiTest();
+// watchShaders rebuilds the device's shader pipelines while the loop runs whenever their sources change
+void rhiTest(bool headless = false, bool asyncInit = true, uint32_t framesInFlight = 2, bool watchShaders = false);
+void recordingBenchmark(bool headless = true, uint32_t drawsPerFrame = 100000);
 } // namespace nr::rhi
@@ -0,0 +1,6 @@
+// Single translation unit holding the VulkanMemoryAllocator implementation.
+// Vulkan entry points are fetched at runtime through the vk::raii dispatcher (see Device::makeAllocator).
+#define VMA_IMPLEMENTATION
+#define VMA_STATIC_VULKAN_FUNCTIONS 0
+#define VMA_DYNAMIC_VULKAN_FUNCTIONS 1
+#include <vk_mem_alloc.h>
@@ -1,6 +1,7 @@
 module;
 #include <vulkan/vulkan_raii.hpp>
 export module nr.rhi.vk;
+import nr.rhi.validation;
 import nr.utils;
 import std;
 export namespace nr::rhi
@@ -17,133 +18,501 @@ enum class QueueKind : size_t
     size
 };
 
-[[nodiscard]] vk::raii::PhysicalDevice selectPhysicalDevice(vk::raii::Instance const &instance)
+using DeviceFeatureChain = vk::StructureChain<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan11Features, vk::PhysicalDeviceVulkan12Features, vk::PhysicalDeviceVulkan13Features>;
+
+// What selection and device creation need to know about a GPU. Everything except the properties is expensive to
+// enumerate on some drivers, so it is cached on disk per device and driver version.
+struct DeviceCapabilities
 {
-    vk::raii::PhysicalDevices physicalDevices(instance);
-    nrAssert(!physicalDevices.empty())("No Available GPU!!!!!");
-    vk::raii::PhysicalDevice bestDevice = physicalDevices.front();
-    vk::PhysicalDeviceProperties bestProps = bestDevice.getProperties();
+    vk::PhysicalDeviceProperties properties;
+    vk::PhysicalDeviceFeatures features;
+    vk::PhysicalDeviceVulkan11Features features11;
+    vk::PhysicalDeviceVulkan12Features features12;
+    vk::PhysicalDeviceVulkan13Features features13;
+    vk::PhysicalDeviceMemoryProperties memory;
+    std::vector<vk::ExtensionProperties> extensions;
+    std::vector<vk::QueueFamilyProperties> queueFamilies;
+    bool fromCache = false;
 
-    for (const auto &device : physicalDevices)
+    [[nodiscard]] bool hasExtension(std::string_view name) const
     {
-        vk::PhysicalDeviceProperties props = device.getProperties();
-        if (props.deviceType == vk::PhysicalDeviceType::eDiscreteGpu)
-        {
-            if (bestProps.deviceType != vk::PhysicalDeviceType::eDiscreteGpu || props.limits.maxImageDimension2D > bestProps.limits.maxImageDimension2D)
-            {
-                bestDevice = device;
-                bestProps = props;
-            }
-        }
-        else if (bestProps.deviceType != vk::PhysicalDeviceType::eDiscreteGpu)
+        return std::ranges::any_of(extensions, [name](vk::ExtensionProperties const &ep) { return name == ep.extensionName; });
+    }
+    [[nodiscard]] vk::DeviceSize largestDeviceLocalHeap() const
+    {
+        vk::DeviceSize largest = 0;
+        for (vk::MemoryHeap const &heap : std::span(memory.memoryHeaps.data(), memory.memoryHeapCount))
         {
-            if (props.limits.maxImageDimension2D > bestProps.limits.maxImageDimension2D)
-            {
-                bestDevice = device;
-                bestProps = props;
-            }
+            if (heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+                largest = std::max(largest, heap.size);
         }
+        return largest;
     }
-    return bestDevice;
-}
+    // a family that has `flags` and none of `excluded`, e.g. async compute = compute without graphics
+    [[nodiscard]] bool hasFamily(vk::QueueFlags flags, vk::QueueFlags excluded = {}) const
+    {
+        return std::ranges::any_of(queueFamilies, [&](vk::QueueFamilyProperties const &qf) { return (qf.queueFlags & flags) == flags && !(qf.queueFlags & excluded); });
+    }
+};
 
-[[nodiscard]] std::vector<char const *> gatherLayers(std::vector<std::string> const &layers)
+struct DeviceRequirements
 {
-    auto uniqueLayers = layers | std::ranges::to<std::set<std::string_view>>();
+    std::vector<std::string> requiredExtensions;
+    // enabled when present and worth score, e.g. ray tracing
+    std::vector<std::string> optionalExtensions;
+    DeviceFeatureChain const *requiredFeatures = nullptr;
+    // index into vkEnumeratePhysicalDevices or a substring of the device name; wins over the score when suitable
+    std::string preferredDevice;
+    std::filesystem::path cacheDirectory;
+};
 
-    const std::vector<vk::LayerProperties> &layerProperties = vk::enumerateInstanceLayerProperties();
-    std::vector<char const *> enabledLayers;
+struct DeviceScore
+{
+    std::int64_t score = 0;
+    std::vector<std::string> missing;
+    [[nodiscard]] bool suitable() const
+    {
+        return missing.empty();
+    }
+};
 
-    for (auto const &layer : uniqueLayers)
+struct SelectedPhysicalDevice
+{
+    vk::raii::PhysicalDevice physicalDevice = {nullptr};
+    DeviceCapabilities capabilities;
+};
+
+// Feature bits by name. The structs cannot be walked as VkBool32 arrays: the 1.2 and 1.3 ones end in
+// padding with indeterminate contents.
+template <typename T> struct FeatureField
+{
+    vk::Bool32 T::*member;
+    std::string_view name;
+};
+#define NR_FEATURE(T, name) FeatureField<vk::T>{&vk::T::name, #name}
+constexpr std::array vulkan10Features{
+    NR_FEATURE(PhysicalDeviceFeatures, robustBufferAccess),
+    NR_FEATURE(PhysicalDeviceFeatures, fullDrawIndexUint32),
+    NR_FEATURE(PhysicalDeviceFeatures, imageCubeArray),
+    NR_FEATURE(PhysicalDeviceFeatures, independentBlend),
+    NR_FEATURE(PhysicalDeviceFeatures, geometryShader),
+    NR_FEATURE(PhysicalDeviceFeatures, tessellationShader),
+    NR_FEATURE(PhysicalDeviceFeatures, sampleRateShading),
+    NR_FEATURE(PhysicalDeviceFeatures, dualSrcBlend),
+    NR_FEATURE(PhysicalDeviceFeatures, logicOp),
+    NR_FEATURE(PhysicalDeviceFeatures, multiDrawIndirect),
+    NR_FEATURE(PhysicalDeviceFeatures, drawIndirectFirstInstance),
+    NR_FEATURE(PhysicalDeviceFeatures, depthClamp),
+    NR_FEATURE(PhysicalDeviceFeatures, depthBiasClamp),
+    NR_FEATURE(PhysicalDeviceFeatures, fillModeNonSolid),
+    NR_FEATURE(PhysicalDeviceFeatures, depthBounds),
+    NR_FEATURE(PhysicalDeviceFeatures, wideLines),
+    NR_FEATURE(PhysicalDeviceFeatures, largePoints),
+    NR_FEATURE(PhysicalDeviceFeatures, alphaToOne),
+    NR_FEATURE(PhysicalDeviceFeatures, multiViewport),
+    NR_FEATURE(PhysicalDeviceFeatures, samplerAnisotropy),
+    NR_FEATURE(PhysicalDeviceFeatures, textureCompressionETC2),
+    NR_FEATURE(PhysicalDeviceFeatures, textureCompressionASTC_LDR),
+    NR_FEATURE(PhysicalDeviceFeatures, textureCompressionBC),
+    NR_FEATURE(PhysicalDeviceFeatures, occlusionQueryPrecise),
+    NR_FEATURE(PhysicalDeviceFeatures, pipelineStatisticsQuery),
+    NR_FEATURE(PhysicalDeviceFeatures, vertexPipelineStoresAndAtomics),
+    NR_FEATURE(PhysicalDeviceFeatures, fragmentStoresAndAtomics),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderTessellationAndGeometryPointSize),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderImageGatherExtended),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderStorageImageExtendedFormats),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderStorageImageMultisample),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderStorageImageReadWithoutFormat),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderStorageImageWriteWithoutFormat),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderUniformBufferArrayDynamicIndexing),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderSampledImageArrayDynamicIndexing),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderStorageBufferArrayDynamicIndexing),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderStorageImageArrayDynamicIndexing),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderClipDistance),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderCullDistance),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderFloat64),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderInt64),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderInt16),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderResourceResidency),
+    NR_FEATURE(PhysicalDeviceFeatures, shaderResourceMinLod),
+    NR_FEATURE(PhysicalDeviceFeatures, sparseBinding),
+    NR_FEATURE(PhysicalDeviceFeatures, sparseResidencyBuffer),
+    NR_FEATURE(PhysicalDeviceFeatures, sparseResidencyImage2D),
+    NR_FEATURE(PhysicalDeviceFeatures, sparseResidencyImage3D),
+    NR_FEATURE(PhysicalDeviceFeatures, sparseResidency2Samples),
+    NR_FEATURE(PhysicalDeviceFeatures, sparseResidency4Samples),
+    NR_FEATURE(PhysicalDeviceFeatures, sparseResidency8Samples),
+    NR_FEATURE(PhysicalDeviceFeatures, sparseResidency16Samples),
+    NR_FEATURE(PhysicalDeviceFeatures, sparseResidencyAliased),
+    NR_FEATURE(PhysicalDeviceFeatures, variableMultisampleRate),
+    NR_FEATURE(PhysicalDeviceFeatures, inheritedQueries)};
+constexpr std::array vulkan11Features{
+    NR_FEATURE(PhysicalDeviceVulkan11Features, storageBuffer16BitAccess),
+    NR_FEATURE(PhysicalDeviceVulkan11Features, uniformAndStorageBuffer16BitAccess),
+    NR_FEATURE(PhysicalDeviceVulkan11Features, storagePushConstant16),
+    NR_FEATURE(PhysicalDeviceVulkan11Features, storageInputOutput16),
+    NR_FEATURE(PhysicalDeviceVulkan11Features, multiview),
+    NR_FEATURE(PhysicalDeviceVulkan11Features, multiviewGeometryShader),
+    NR_FEATURE(PhysicalDeviceVulkan11Features, multiviewTessellationShader),
+    NR_FEATURE(PhysicalDeviceVulkan11Features, variablePointersStorageBuffer),
+    NR_FEATURE(PhysicalDeviceVulkan11Features, variablePointers),
+    NR_FEATURE(PhysicalDeviceVulkan11Features, protectedMemory),
+    NR_FEATURE(PhysicalDeviceVulkan11Features, samplerYcbcrConversion),
+    NR_FEATURE(PhysicalDeviceVulkan11Features, shaderDrawParameters)};
+constexpr std::array vulkan12Features{
+    NR_FEATURE(PhysicalDeviceVulkan12Features, samplerMirrorClampToEdge),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, drawIndirectCount),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, storageBuffer8BitAccess),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, uniformAndStorageBuffer8BitAccess),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, storagePushConstant8),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderBufferInt64Atomics),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderSharedInt64Atomics),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderFloat16),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderInt8),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, descriptorIndexing),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderInputAttachmentArrayDynamicIndexing),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderUniformTexelBufferArrayDynamicIndexing),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderStorageTexelBufferArrayDynamicIndexing),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderUniformBufferArrayNonUniformIndexing),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderSampledImageArrayNonUniformIndexing),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderStorageBufferArrayNonUniformIndexing),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderStorageImageArrayNonUniformIndexing),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderInputAttachmentArrayNonUniformIndexing),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderUniformTexelBufferArrayNonUniformIndexing),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderStorageTexelBufferArrayNonUniformIndexing),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, descriptorBindingUniformBufferUpdateAfterBind),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, descriptorBindingSampledImageUpdateAfterBind),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, descriptorBindingStorageImageUpdateAfterBind),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, descriptorBindingStorageBufferUpdateAfterBind),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, descriptorBindingUniformTexelBufferUpdateAfterBind),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, descriptorBindingStorageTexelBufferUpdateAfterBind),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, descriptorBindingUpdateUnusedWhilePending),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, descriptorBindingPartiallyBound),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, descriptorBindingVariableDescriptorCount),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, runtimeDescriptorArray),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, samplerFilterMinmax),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, scalarBlockLayout),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, imagelessFramebuffer),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, uniformBufferStandardLayout),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderSubgroupExtendedTypes),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, separateDepthStencilLayouts),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, hostQueryReset),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, timelineSemaphore),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, bufferDeviceAddress),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, bufferDeviceAddressCaptureReplay),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, bufferDeviceAddressMultiDevice),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, vulkanMemoryModel),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, vulkanMemoryModelDeviceScope),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, vulkanMemoryModelAvailabilityVisibilityChains),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderOutputViewportIndex),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, shaderOutputLayer),
+    NR_FEATURE(PhysicalDeviceVulkan12Features, subgroupBroadcastDynamicId)};
+constexpr std::array vulkan13Features{
+    NR_FEATURE(PhysicalDeviceVulkan13Features, robustImageAccess),
+    NR_FEATURE(PhysicalDeviceVulkan13Features, inlineUniformBlock),
+    NR_FEATURE(PhysicalDeviceVulkan13Features, descriptorBindingInlineUniformBlockUpdateAfterBind),
+    NR_FEATURE(PhysicalDeviceVulkan13Features, pipelineCreationCacheControl),
+    NR_FEATURE(PhysicalDeviceVulkan13Features, privateData),
+    NR_FEATURE(PhysicalDeviceVulkan13Features, shaderDemoteToHelperInvocation),
+    NR_FEATURE(PhysicalDeviceVulkan13Features, shaderTerminateInvocation),
+    NR_FEATURE(PhysicalDeviceVulkan13Features, subgroupSizeControl),
+    NR_FEATURE(PhysicalDeviceVulkan13Features, computeFullSubgroups),
+    NR_FEATURE(PhysicalDeviceVulkan13Features, synchronization2),
+    NR_FEATURE(PhysicalDeviceVulkan13Features, textureCompressionASTC_HDR),
+    NR_FEATURE(PhysicalDeviceVulkan13Features, shaderZeroInitializeWorkgroupMemory),
+    NR_FEATURE(PhysicalDeviceVulkan13Features, dynamicRendering),
+    NR_FEATURE(PhysicalDeviceVulkan13Features, shaderIntegerDotProduct),
+    NR_FEATURE(PhysicalDeviceVulkan13Features, maintenance4)};
+#undef NR_FEATURE
+
+// appends the name of every feature `required` enables and `supported` lacks
+template <typename T, size_t N> void appendMissingFeatures(std::array<FeatureField<T>, N> const &fields, T const &required, T const &supported, std::vector<std::string> &missing)
+{
+    for (FeatureField<T> const &field : fields)
     {
-        nrAssert(std::ranges::any_of(layerProperties, [layer](vk::LayerProperties const &lp) { return layer == lp.layerName; }))("Requested layer '{}' is not available.", layer);
-        enabledLayers.push_back(layer.data());
+        if (required.*field.member && !(supported.*field.member))
+            missing.push_back(std::format("feature {}", field.name));
     }
-    return enabledLayers;
 }
 
-[[nodiscard]] std::vector<char const *> gatherInstanceExtensions(std::vector<std::string> const &extensions)
+[[nodiscard]] DeviceScore scoreDevice(DeviceCapabilities const &capabilities, DeviceRequirements const &requirements)
 {
-    auto uniqueExtensions = extensions | std::ranges::to<std::set<std::string_view>>();
+    DeviceScore result;
+    for (std::string const &extension : requirements.requiredExtensions)
+    {
+        if (!capabilities.hasExtension(extension))
+            result.missing.push_back(extension);
+    }
+    if (requirements.requiredFeatures)
+    {
+        DeviceFeatureChain const &required = *requirements.requiredFeatures;
+        appendMissingFeatures(vulkan10Features, required.get<vk::PhysicalDeviceFeatures2>().features, capabilities.features, result.missing);
+        appendMissingFeatures(vulkan11Features, required.get<vk::PhysicalDeviceVulkan11Features>(), capabilities.features11, result.missing);
+        appendMissingFeatures(vulkan12Features, required.get<vk::PhysicalDeviceVulkan12Features>(), capabilities.features12, result.missing);
+        appendMissingFeatures(vulkan13Features, required.get<vk::PhysicalDeviceVulkan13Features>(), capabilities.features13, result.missing);
+    }
+    if (!capabilities.hasFamily(vk::QueueFlagBits::eGraphics))
+        result.missing.push_back("graphics queue");
 
-    const std::vector<vk::ExtensionProperties> &extensionProperties = vk::enumerateInstanceExtensionProperties();
-    std::vector<char const *> enabledExtensions;
-    for (auto const &extension : uniqueExtensions)
+    // device class dominates; within a class the biggest VRAM wins, async queues and optional extensions break ties
+    switch (capabilities.properties.deviceType)
     {
-        nrAssert(std::any_of(extensionProperties.begin(), extensionProperties.end(), [extension](vk::ExtensionProperties const &ep) { return extension == ep.extensionName; }))("Requested extension '{}' is not available.", extension);
-        nrAssert(true)("Requested extension '{}' is not available.", extension);
-        enabledExtensions.push_back(extension.data());
+    case vk::PhysicalDeviceType::eDiscreteGpu:
+        result.score += 4'000'000;
+        break;
+    case vk::PhysicalDeviceType::eIntegratedGpu:
+        result.score += 3'000'000;
+        break;
+    case vk::PhysicalDeviceType::eVirtualGpu:
+        result.score += 2'000'000;
+        break;
+    case vk::PhysicalDeviceType::eCpu:
+        result.score += 1'000'000;
+        break;
+    default:
+        break;
     }
-    return enabledExtensions;
+    result.score += static_cast<std::int64_t>(capabilities.largestDeviceLocalHeap() >> 20);
+    if (capabilities.hasFamily(vk::QueueFlagBits::eCompute, vk::QueueFlagBits::eGraphics))
+        result.score += 4096;
+    if (capabilities.hasFamily(vk::QueueFlagBits::eTransfer, vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute))
+        result.score += 4096;
+    result.score += 2048 * std::ranges::count_if(requirements.optionalExtensions, [&](std::string const &extension) { return capabilities.hasExtension(extension); });
+    return result;
 }
 
-VKAPI_ATTR vk::Bool32 VKAPI_CALL debugUtilsMessengerCallback(vk::DebugUtilsMessageSeverityFlagBitsEXT messageSeverity, vk::DebugUtilsMessageTypeFlagsEXT messageTypes, const vk::DebugUtilsMessengerCallbackDataEXT *pCallbackData, void * /*pUserData*/)
+} // namespace nr::rhi
+
+namespace nr::rhi::detail
+{
+struct DeviceCapabilitiesFilePrefix
+{
+    static constexpr std::uint32_t expectedMagic = 0x4344524e; // "NRDC"
+    std::uint32_t magic = expectedMagic;
+    // struct layouts in the blob follow the Vulkan headers the cache was written with
+    std::uint32_t headerVersion = VK_HEADER_VERSION_COMPLETE;
+    std::uint32_t vendorID = 0;
+    std::uint32_t deviceID = 0;
+    std::uint32_t driverVersion = 0;
+    std::uint32_t apiVersion = 0;
+    std::array<std::uint8_t, VK_UUID_SIZE> pipelineCacheUUID{};
+    std::uint32_t extensionCount = 0;
+    std::uint32_t queueFamilyCount = 0;
+    std::uint64_t dataSize = 0;
+    std::uint64_t checksum = 0;
+};
+
+inline std::filesystem::path deviceCapabilitiesPath(std::filesystem::path const &directory, vk::PhysicalDeviceProperties const &properties)
+{
+    return directory / std::format("device-{:04x}-{:04x}-{:08x}.nrdc", properties.vendorID, properties.deviceID, properties.driverVersion);
+}
+
+template <typename T> void appendBytes(std::vector<std::byte> &blob, std::span<const T> values)
+{
+    auto bytes = std::as_bytes(values);
+    blob.insert(blob.end(), bytes.begin(), bytes.end());
+}
+
+inline bool loadDeviceCapabilities(std::filesystem::path const &path, DeviceCapabilities &capabilities)
 {
-    if constexpr (isDebugMode())
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    DeviceCapabilitiesFilePrefix prefix;
+    vk::PhysicalDeviceProperties const &props = capabilities.properties;
+    if (!file.read(reinterpret_cast<char *>(&prefix), sizeof(prefix)) || prefix.magic != DeviceCapabilitiesFilePrefix::expectedMagic || prefix.headerVersion != VK_HEADER_VERSION_COMPLETE || prefix.vendorID != props.vendorID ||
+        prefix.deviceID != props.deviceID || prefix.driverVersion != props.driverVersion || prefix.apiVersion != props.apiVersion || !std::ranges::equal(prefix.pipelineCacheUUID, props.pipelineCacheUUID))
+        return false;
+
+    // the sizes come from the file itself: check them against each other and the file before allocating
+    constexpr size_t fixedSize = sizeof(capabilities.features) + sizeof(capabilities.features11) + sizeof(capabilities.features12) + sizeof(capabilities.features13) + sizeof(capabilities.memory);
+    const std::uint64_t expectedSize = fixedSize + std::uint64_t{prefix.extensionCount} * sizeof(vk::ExtensionProperties) + std::uint64_t{prefix.queueFamilyCount} * sizeof(vk::QueueFamilyProperties);
+    std::error_code ec;
+    const std::uintmax_t fileSize = std::filesystem::file_size(path, ec);
+    if (ec || prefix.dataSize != expectedSize || prefix.dataSize != fileSize - sizeof(prefix))
+    {
+        nrInfo(LogLevel::warning)("Device capability cache '{}' is corrupted and will be rebuilt.", path.string());
+        return false;
+    }
+    std::vector<std::byte> blob(prefix.dataSize);
+    if (!file.read(reinterpret_cast<char *>(blob.data()), static_cast<std::streamsize>(blob.size())) || fnv1a64(blob) != prefix.checksum)
     {
-        switch (static_cast<uint32_t>(pCallbackData->messageIdNumber))
+        nrInfo(LogLevel::warning)("Device capability cache '{}' is corrupted and will be rebuilt.", path.string());
+        return false;
+    }
+    size_t offset = 0;
+    auto read = [&](void *dst, size_t size) {
+        std::memcpy(dst, blob.data() + offset, size);
+        offset += size;
+    };
+    read(&capabilities.features, sizeof(capabilities.features));
+    read(&capabilities.features11, sizeof(capabilities.features11));
+    read(&capabilities.features12, sizeof(capabilities.features12));
+    read(&capabilities.features13, sizeof(capabilities.features13));
+    read(&capabilities.memory, sizeof(capabilities.memory));
+    capabilities.extensions.resize(prefix.extensionCount);
+    read(capabilities.extensions.data(), capabilities.extensions.size() * sizeof(vk::ExtensionProperties));
+    capabilities.queueFamilies.resize(prefix.queueFamilyCount);
+    read(capabilities.queueFamilies.data(), capabilities.queueFamilies.size() * sizeof(vk::QueueFamilyProperties));
+    return true;
+}
+
+inline void saveDeviceCapabilities(std::filesystem::path const &path, DeviceCapabilities const &capabilities)
+{
+    std::vector<std::byte> blob;
+    appendBytes(blob, std::span(&capabilities.features, 1));
+    appendBytes(blob, std::span(&capabilities.features11, 1));
+    appendBytes(blob, std::span(&capabilities.features12, 1));
+    appendBytes(blob, std::span(&capabilities.features13, 1));
+    appendBytes(blob, std::span(&capabilities.memory, 1));
+    appendBytes(blob, std::span(capabilities.extensions));
+    appendBytes(blob, std::span(capabilities.queueFamilies));
+
+    vk::PhysicalDeviceProperties const &props = capabilities.properties;
+    DeviceCapabilitiesFilePrefix prefix;
+    prefix.vendorID = props.vendorID;
+    prefix.deviceID = props.deviceID;
+    prefix.driverVersion = props.driverVersion;
+    prefix.apiVersion = props.apiVersion;
+    std::ranges::copy(props.pipelineCacheUUID, prefix.pipelineCacheUUID.begin());
+    prefix.extensionCount = static_cast<std::uint32_t>(capabilities.extensions.size());
+    prefix.queueFamilyCount = static_cast<std::uint32_t>(capabilities.queueFamilies.size());
+    prefix.dataSize = blob.size();
+    prefix.checksum = fnv1a64(blob);
+
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    std::filesystem::path tmpPath = path;
+    tmpPath += ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(&prefix), sizeof(prefix));
+        file.write(reinterpret_cast<const char *>(blob.data()), static_cast<std::streamsize>(blob.size()));
+        if (!file)
         {
-        case 0:
-            // Validation Warning: Override layer has override paths set to C:/VulkanSDK/<version>/Bin
-            return vk::False;
-        case 0x822806fa:
-            // Validation Warning: vkCreateInstance(): to enable extension VK_EXT_debug_utils, but this extension is intended to support use by applications when
-            // debugging and it is strongly recommended that it be otherwise avoided.
-            return vk::False;
-        case 0xe8d1a9fe:
-            // Validation Performance Warning: Using debug builds of the validation layers *will* adversely affect performance.
-            return vk::False;
+            nrInfo(LogLevel::warning)("Failed to write device capability cache '{}'", tmpPath.string());
+            return;
         }
     }
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec)
+        nrInfo(LogLevel::warning)("Failed to replace device capability cache '{}': {}", path.string(), ec.message());
+}
+} // namespace nr::rhi::detail
 
-    const auto severityStr = vk::to_string(messageSeverity);
-    const auto typesStr = vk::to_string(messageTypes);
+export namespace nr::rhi
+{
 
-    const char *idName = pCallbackData->pMessageIdName ? pCallbackData->pMessageIdName : "";
-    const char *message = pCallbackData->pMessage ? pCallbackData->pMessage : "";
+// Properties are always queried (they identify the cache entry); the rest comes from the cache when it matches.
+[[nodiscard]] DeviceCapabilities queryDeviceCapabilities(vk::raii::PhysicalDevice const &physicalDevice, std::filesystem::path const &cacheDirectory)
+{
+    DeviceCapabilities capabilities;
+    capabilities.properties = physicalDevice.getProperties();
+    const std::filesystem::path path = detail::deviceCapabilitiesPath(cacheDirectory, capabilities.properties);
+    if (!cacheDirectory.empty() && detail::loadDeviceCapabilities(path, capabilities))
+    {
+        capabilities.fromCache = true;
+        return capabilities;
+    }
 
-    print("{}: {}:\n"
-          "\tmessageIDName   = <{}>\n"
-          "\tmessageIdNumber = {}\n"
-          "\tmessage         = <{}>",
-          severityStr, typesStr, idName, pCallbackData->messageIdNumber, message);
+    auto features = physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan11Features, vk::PhysicalDeviceVulkan12Features, vk::PhysicalDeviceVulkan13Features>();
+    capabilities.features = features.get<vk::PhysicalDeviceFeatures2>().features;
+    capabilities.features11 = features.get<vk::PhysicalDeviceVulkan11Features>().setPNext(nullptr);
+    capabilities.features12 = features.get<vk::PhysicalDeviceVulkan12Features>().setPNext(nullptr);
+    capabilities.features13 = features.get<vk::PhysicalDeviceVulkan13Features>().setPNext(nullptr);
+    capabilities.memory = physicalDevice.getMemoryProperties();
+    capabilities.extensions = physicalDevice.enumerateDeviceExtensionProperties();
+    capabilities.queueFamilies = physicalDevice.getQueueFamilyProperties();
+    if (!cacheDirectory.empty())
+        detail::saveDeviceCapabilities(path, capabilities);
+    return capabilities;
+}
+
+[[nodiscard]] SelectedPhysicalDevice selectPhysicalDevice(vk::raii::Instance const &instance, DeviceRequirements const &requirements)
+{
+    vk::raii::PhysicalDevices physicalDevices(instance);
+    if (physicalDevices.empty())
+        nrInfo(LogLevel::error)("No Available GPU!!!!!");
 
-    auto queueLabels = std::span(pCallbackData->pQueueLabels, pCallbackData->queueLabelCount);
-    if (!queueLabels.empty())
+    std::vector<DeviceCapabilities> capabilities;
+    std::vector<DeviceScore> scores;
+    std::string table;
+    for (auto &&[i, physicalDevice] : std::views::enumerate(physicalDevices))
     {
-        std::print("\tQueue Labels:");
-        for (const auto &lbl : queueLabels)
+        DeviceCapabilities const &caps = capabilities.emplace_back(queryDeviceCapabilities(physicalDevice, requirements.cacheDirectory));
+        DeviceScore const &score = scores.emplace_back(scoreDevice(caps, requirements));
+        std::string missing;
+        for (std::string const &m : score.missing)
         {
-            std::print("\t\tlabelName = <{}>", lbl.pLabelName ? lbl.pLabelName : "");
+            missing += std::format("{}{}", missing.empty() ? "  missing: " : ", ", m);
         }
+        table += std::format("\n    #{} {:<40} {:<14} score {:>9}{}{}", i, std::string_view(caps.properties.deviceName.data()), vk::to_string(caps.properties.deviceType), score.suitable() ? std::to_string(score.score) : "-",
+                             caps.fromCache ? "  (cached)" : "", missing);
     }
 
-    auto cmdBufLabels = std::span(pCallbackData->pCmdBufLabels, pCallbackData->cmdBufLabelCount);
-    if (!cmdBufLabels.empty())
+    std::optional<size_t> best;
+    if (!requirements.preferredDevice.empty())
     {
-        std::print("\tCommandBuffer Labels:");
-        for (const auto &lbl : cmdBufLabels)
+        size_t index = 0;
+        std::string_view preferred = requirements.preferredDevice;
+        const bool isIndex = std::from_chars(preferred.data(), preferred.data() + preferred.size(), index).ptr == preferred.data() + preferred.size();
+        for (size_t i = 0; i < capabilities.size() && !best; ++i)
         {
-            std::print("\t\tlabelName = <{}>", lbl.pLabelName ? lbl.pLabelName : "");
+            if (scores[i].suitable() && (isIndex ? i == index : std::string_view(capabilities[i].properties.deviceName.data()).contains(preferred)))
+                best = i;
         }
+        if (!best)
+            nrInfo(LogLevel::warning)("Preferred device '{}' is not available or not suitable; falling back to the best score.", preferred);
+    }
+    const bool overridden = best.has_value();
+    for (size_t i = 0; i < capabilities.size() && !overridden; ++i)
+    {
+        if (scores[i].suitable() && (!best || scores[i].score > scores[*best].score))
+            best = i;
     }
+    if (!best)
+        nrInfo(LogLevel::error)("No GPU satisfies the renderer's requirements:{}", table);
+    nrInfo()("physical devices:{}\n  selected #{}", table, *best);
+    return {std::move(physicalDevices[*best]), std::move(capabilities[*best])};
+}
+
+// The returned pointers live in `layers`; the list and its temporaries are allocated from `resource`. No scope of its
+// own: rewinding one here would take the caller's result with it when `resource` is the same scratch arena.
+[[nodiscard]] std::pmr::vector<char const *> gatherLayers(std::vector<std::string> const &layers, std::pmr::memory_resource *resource)
+{
+    std::pmr::set<std::string_view> uniqueLayers(layers.begin(), layers.end(), resource);
 
-    auto objects = std::span(pCallbackData->pObjects, pCallbackData->objectCount);
-    if (!objects.empty())
+    const std::vector<vk::LayerProperties> &layerProperties = vk::enumerateInstanceLayerProperties();
+    std::pmr::vector<char const *> enabledLayers(resource);
+
+    for (auto const &layer : uniqueLayers)
     {
-        std::print("\tObjects:");
-        for (size_t i = 0; i < objects.size(); ++i)
-        {
-            const auto &obj = objects[i];
-            std::print("\t\tObject {}", i);
-            std::print("\t\t\tobjectType   = {}", vk::to_string(obj.objectType));
-            std::print("\t\t\tobjectHandle = {}", obj.objectHandle);
-            if (obj.pObjectName)
-            {
-                std::print("\t\t\tobjectName   = <{}>", obj.pObjectName);
-            }
-        }
+        nrAssert(std::ranges::any_of(layerProperties, [layer](vk::LayerProperties const &lp) { return layer == lp.layerName; }))("Requested layer '{}' is not available.", layer);
+        enabledLayers.push_back(layer.data());
+    }
+    return enabledLayers;
+}
+
+// allocates like gatherLayers
+[[nodiscard]] std::pmr::vector<char const *> gatherInstanceExtensions(std::vector<std::string> const &extensions, std::pmr::memory_resource *resource)
+{
+    std::pmr::set<std::string_view> uniqueExtensions(extensions.begin(), extensions.end(), resource);
+
+    const std::vector<vk::ExtensionProperties> &extensionProperties = vk::enumerateInstanceExtensionProperties();
+    std::pmr::vector<char const *> enabledExtensions(resource);
+    for (auto const &extension : uniqueExtensions)
+    {
+        nrAssert(std::any_of(extensionProperties.begin(), extensionProperties.end(), [extension](vk::ExtensionProperties const &ep) { return extension == ep.extensionName; }))("Requested extension '{}' is not available.", extension);
+        nrAssert(true)("Requested extension '{}' is not available.", extension);
+        enabledExtensions.push_back(extension.data());
     }
+    return enabledExtensions;
+}
+
+// aggregation, rate limiting and suppression live in ValidationMessages (nr.rhi.validation)
+VKAPI_ATTR vk::Bool32 VKAPI_CALL debugUtilsMessengerCallback(vk::DebugUtilsMessageSeverityFlagBitsEXT messageSeverity, vk::DebugUtilsMessageTypeFlagsEXT messageTypes, const vk::DebugUtilsMessengerCallbackDataEXT *pCallbackData, void * /*pUserData*/)
+{
+    ValidationMessages::instance().submit(messageSeverity, messageTypes, *pCallbackData);
     return vk::False;
 }
 
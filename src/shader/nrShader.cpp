@@ -0,0 +1,380 @@
+module;
+
+#include <slang-com-ptr.h>
+#include <slang.h>
+
+module nr.shader;
+
+import std;
+import nr.utils;
+
+namespace
+{
+nr::shader::ShaderCompilerOptions &pendingShaderCompilerOptions()
+{
+    static nr::shader::ShaderCompilerOptions options;
+    return options;
+}
+
+std::optional<std::vector<std::byte>> readBytes(std::filesystem::path const &path)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        return std::nullopt;
+    const std::streamoff size = file.tellg();
+    if (size < 0)
+        return std::nullopt;
+    std::vector<std::byte> bytes(static_cast<size_t>(size));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char *>(bytes.data()), static_cast<std::streamsize>(bytes.size())))
+        return std::nullopt;
+    return bytes;
+}
+
+std::uint64_t hashString(std::string_view text, std::uint64_t seed)
+{
+    // the terminator keeps ("ab", "c") and ("a", "bc") apart
+    return nr::fnv1a64(std::as_bytes(std::span(text.data(), text.size() + 1)), seed);
+}
+
+std::uint64_t hashFile(std::filesystem::path const &path)
+{
+    const std::optional<std::vector<std::byte>> bytes = readBytes(path);
+    return bytes ? nr::fnv1a64(*bytes) : 0;
+}
+
+template <typename T> void writeValue(std::ofstream &file, T const &value)
+{
+    file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+template <typename T> bool readValue(std::ifstream &file, T &value)
+{
+    return static_cast<bool>(file.read(reinterpret_cast<char *>(&value), sizeof(value)));
+}
+} // namespace
+
+namespace nr::shader
+{
+
+ShaderCompiler &ShaderCompiler::instance()
+{
+    static ShaderCompiler compiler(pendingShaderCompilerOptions());
+    return compiler;
+}
+
+void ShaderCompiler::configure(ShaderCompilerOptions options)
+{
+    pendingShaderCompilerOptions() = std::move(options);
+}
+
+ShaderCompiler::ShaderCompiler(ShaderCompilerOptions options) : compilerOptions(std::move(options)), version(spGetBuildTagString())
+{
+}
+
+ShaderCompiler::~ShaderCompiler() = default;
+
+std::string_view ShaderCompiler::compilerVersion() const
+{
+    return version;
+}
+
+std::optional<CompiledShader> ShaderCompiler::compile(ShaderRequest const &request)
+{
+    auto zone = nrZone("compile shader");
+    std::filesystem::path resolved = request.source;
+    for (auto it = compilerOptions.searchPaths.begin(); !std::filesystem::exists(resolved) && it != compilerOptions.searchPaths.end(); ++it)
+        resolved = *it / request.source;
+    const std::optional<std::vector<std::byte>> source = readBytes(resolved);
+    if (!source)
+    {
+        nrInfo(LogLevel::warning)("Shader source '{}' was not found.", request.source.string());
+        failed.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+
+    const std::uint64_t key = requestKey(request, *source);
+    if (std::optional<CompiledShader> cached = load(key))
+    {
+        cacheHits.fetch_add(1, std::memory_order_relaxed);
+        return cached;
+    }
+
+    ShaderRequest resolvedRequest = request;
+    resolvedRequest.source = resolved;
+    const auto start = std::chrono::steady_clock::now();
+    std::optional<CompiledShader> result = compileWithSlang(resolvedRequest, std::string(reinterpret_cast<const char *>(source->data()), source->size()));
+    compileNanoseconds.fetch_add(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()), std::memory_order_relaxed);
+    if (!result)
+    {
+        failed.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+    compiled.fetch_add(1, std::memory_order_relaxed);
+    store(key, *result);
+    return result;
+}
+
+std::vector<std::optional<CompiledShader>> ShaderCompiler::compileAll(std::span<const ShaderRequest> requests, JobSystem &jobs)
+{
+    std::vector<std::optional<CompiledShader>> results(requests.size());
+    // one request per piece: compile times vary by orders of magnitude, so let idle threads pick them off one by one
+    jobs.parallelFor(
+        0, requests.size(),
+        [&](std::size_t first, std::size_t last) {
+            for (std::size_t i = first; i < last; ++i)
+                results[i] = compile(requests[i]);
+        },
+        1);
+    return results;
+}
+
+Task<std::optional<CompiledShader>> ShaderCompiler::compileAsync(ShaderRequest request, JobSystem &jobs)
+{
+    co_await resumeOn(jobs);
+    co_return compile(request);
+}
+
+ShaderCompilerStatistics ShaderCompiler::statistics() const
+{
+    return {cacheHits.load(), compiled.load(), failed.load(), static_cast<double>(compileNanoseconds.load()) / 1e6};
+}
+
+void ShaderCompiler::report() const
+{
+    const ShaderCompilerStatistics s = statistics();
+    nrInfo()("shader compiler (slang {}): {} cache hits, {} compiled, {} failed, {:.2f} ms compiling", version, s.cacheHits, s.compiled, s.failed, s.compileMilliseconds);
+}
+
+std::uint64_t ShaderCompiler::requestKey(ShaderRequest const &request, std::span<const std::byte> source) const
+{
+    std::uint64_t key = fnv1a64(source);
+    key = hashString(request.source.generic_string(), key);
+    key = hashString(request.entryPoint, key);
+    for (ShaderDefine const &define : request.defines)
+        key = hashString(define.value, hashString(define.name, key));
+    key = hashString(request.profile, key);
+    return hashString(version, key);
+}
+
+std::filesystem::path ShaderCompiler::cachePath(std::uint64_t key) const
+{
+    return compilerOptions.cacheDirectory / std::format("{:016x}.spv", key);
+}
+
+// nothing on a miss, a torn file, or when any recorded include changed since the entry was written
+std::optional<CompiledShader> ShaderCompiler::load(std::uint64_t key) const
+{
+    std::ifstream file(cachePath(key), std::ios::binary);
+    if (!file)
+        return std::nullopt;
+    // every size below is read from the entry itself; nothing is allocated before it is known to fit in the file
+    std::error_code ec;
+    const std::uintmax_t fileSize = std::filesystem::file_size(cachePath(key), ec);
+    if (ec)
+        return std::nullopt;
+    auto remaining = [&] { return fileSize - static_cast<std::uintmax_t>(file.tellg()); };
+    detail::ShaderCacheFilePrefix prefix;
+    if (!readValue(file, prefix) || prefix.magic != detail::ShaderCacheFilePrefix::expectedMagic || prefix.version != detail::ShaderCacheFilePrefix::expectedVersion || prefix.key != key)
+        return std::nullopt;
+
+    CompiledShader shader;
+    shader.fromCache = true;
+    for (std::uint32_t i = 0; i < prefix.dependencyCount; ++i)
+    {
+        std::uint32_t length = 0;
+        std::uint64_t contentHash = 0;
+        if (!readValue(file, length) || length > remaining())
+            return std::nullopt;
+        std::string path(length, '\0');
+        if (!file.read(path.data(), length) || !readValue(file, contentHash))
+            return std::nullopt;
+        if (hashFile(path) != contentHash)
+            return std::nullopt;
+        shader.dependencies.emplace_back(std::move(path));
+    }
+    if (std::uintmax_t{prefix.spirvWords} * sizeof(std::uint32_t) > remaining())
+    {
+        nrInfo(LogLevel::warning)("Shader cache entry '{}' is corrupted and will be rebuilt.", cachePath(key).string());
+        return std::nullopt;
+    }
+    shader.spirv.resize(prefix.spirvWords);
+    if (!file.read(reinterpret_cast<char *>(shader.spirv.data()), static_cast<std::streamsize>(shader.spirv.size() * sizeof(std::uint32_t))) || fnv1a64(std::as_bytes(std::span(shader.spirv))) != prefix.checksum)
+    {
+        nrInfo(LogLevel::warning)("Shader cache entry '{}' is corrupted and will be rebuilt.", cachePath(key).string());
+        return std::nullopt;
+    }
+    return shader;
+}
+
+// written beside the final name and renamed over it, so readers never see a partial entry
+void ShaderCompiler::store(std::uint64_t key, CompiledShader const &shader) const
+{
+    const std::filesystem::path path = cachePath(key);
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    std::filesystem::path tmpPath = path;
+    tmpPath += std::format(".{}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        detail::ShaderCacheFilePrefix prefix;
+        prefix.key = key;
+        prefix.dependencyCount = static_cast<std::uint32_t>(shader.dependencies.size());
+        prefix.spirvWords = static_cast<std::uint32_t>(shader.spirv.size());
+        prefix.checksum = fnv1a64(std::as_bytes(std::span(shader.spirv)));
+        writeValue(file, prefix);
+        for (std::filesystem::path const &dependency : shader.dependencies)
+        {
+            const std::string name = dependency.generic_string();
+            writeValue(file, static_cast<std::uint32_t>(name.size()));
+            file.write(name.data(), static_cast<std::streamsize>(name.size()));
+            writeValue(file, hashFile(dependency));
+        }
+        file.write(reinterpret_cast<const char *>(shader.spirv.data()), static_cast<std::streamsize>(shader.spirv.size() * sizeof(std::uint32_t)));
+        if (!file)
+        {
+            nrInfo(LogLevel::warning)("Failed to write shader cache entry '{}'.", tmpPath.string());
+            return;
+        }
+    }
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec)
+        nrInfo(LogLevel::warning)("Failed to replace shader cache entry '{}': {}", path.string(), ec.message());
+}
+
+std::optional<CompiledShader> ShaderCompiler::compileWithSlang(ShaderRequest const &request, std::string const &source)
+{
+    // global sessions are not thread-safe: each thread that compiles creates its own on its first miss
+    thread_local Slang::ComPtr<slang::IGlobalSession> globalSession;
+    if (!globalSession && SLANG_FAILED(slang::createGlobalSession(globalSession.writeRef())))
+    {
+        nrInfo(LogLevel::warning)("Failed to create a Slang global session.");
+        return std::nullopt;
+    }
+
+    slang::TargetDesc target{};
+    target.format = SLANG_SPIRV;
+    target.profile = globalSession->findProfile(request.profile.c_str());
+
+    std::vector<std::string> searchPathNames{request.source.parent_path().string()};
+    for (std::filesystem::path const &path : compilerOptions.searchPaths)
+        searchPathNames.push_back(path.string());
+    const std::vector<char const *> searchPaths = searchPathNames | std::views::transform([](std::string const &s) { return s.c_str(); }) | std::ranges::to<std::vector>();
+    const std::vector<slang::PreprocessorMacroDesc> macros =
+        request.defines | std::views::transform([](ShaderDefine const &d) { return slang::PreprocessorMacroDesc{d.name.c_str(), d.value.c_str()}; }) | std::ranges::to<std::vector>();
+
+    slang::SessionDesc sessionDesc{};
+    sessionDesc.targets = &target;
+    sessionDesc.targetCount = 1;
+    sessionDesc.searchPaths = searchPaths.data();
+    sessionDesc.searchPathCount = static_cast<SlangInt>(searchPaths.size());
+    sessionDesc.preprocessorMacros = macros.data();
+    sessionDesc.preprocessorMacroCount = static_cast<SlangInt>(macros.size());
+    Slang::ComPtr<slang::ISession> session;
+    if (SLANG_FAILED(globalSession->createSession(sessionDesc, session.writeRef())))
+    {
+        nrInfo(LogLevel::warning)("Failed to create a Slang session for '{}'.", request.source.string());
+        return std::nullopt;
+    }
+
+    Slang::ComPtr<slang::IBlob> diagnostics;
+    auto reportDiagnostics = [&] {
+        if (diagnostics && diagnostics->getBufferSize() > 0)
+            nrInfo(LogLevel::warning)("{} ({}):\n{}", request.source.string(), request.entryPoint, std::string_view(static_cast<const char *>(diagnostics->getBufferPointer()), diagnostics->getBufferSize()));
+    };
+
+    const std::string moduleName = request.source.stem().string();
+    const std::string sourcePath = request.source.string();
+    slang::IModule *module = session->loadModuleFromSourceString(moduleName.c_str(), sourcePath.c_str(), source.c_str(), diagnostics.writeRef());
+    reportDiagnostics();
+    if (!module)
+        return std::nullopt;
+
+    Slang::ComPtr<slang::IEntryPoint> entryPoint;
+    if (SLANG_FAILED(module->findEntryPointByName(request.entryPoint.c_str(), entryPoint.writeRef())))
+    {
+        nrInfo(LogLevel::warning)("'{}' has no entry point '{}'.", request.source.string(), request.entryPoint);
+        return std::nullopt;
+    }
+
+    const std::array<slang::IComponentType *, 2> components{module, entryPoint.get()};
+    Slang::ComPtr<slang::IComponentType> composed;
+    const SlangResult composeResult = session->createCompositeComponentType(components.data(), static_cast<SlangInt>(components.size()), composed.writeRef(), diagnostics.writeRef());
+    reportDiagnostics();
+    if (SLANG_FAILED(composeResult))
+        return std::nullopt;
+
+    Slang::ComPtr<slang::IComponentType> linked;
+    const SlangResult linkResult = composed->link(linked.writeRef(), diagnostics.writeRef());
+    reportDiagnostics();
+    if (SLANG_FAILED(linkResult))
+        return std::nullopt;
+
+    Slang::ComPtr<slang::IBlob> code;
+    const SlangResult codeResult = linked->getEntryPointCode(0, 0, code.writeRef(), diagnostics.writeRef());
+    reportDiagnostics();
+    if (SLANG_FAILED(codeResult))
+        return std::nullopt;
+
+    CompiledShader result;
+    result.spirv.resize(code->getBufferSize() / sizeof(std::uint32_t));
+    std::memcpy(result.spirv.data(), code->getBufferPointer(), result.spirv.size() * sizeof(std::uint32_t));
+    for (SlangInt32 i = 0; i < module->getDependencyFileCount(); ++i)
+        result.dependencies.emplace_back(module->getDependencyFilePath(i));
+    return result;
+}
+
+std::string spirvEntryPointName(std::span<const std::uint32_t> spirv)
+{
+    constexpr std::size_t headerWords = 5;
+    constexpr std::uint32_t opEntryPoint = 15;
+    for (std::size_t i = headerWords; i < spirv.size();)
+    {
+        const std::uint32_t wordCount = spirv[i] >> 16;
+        if (wordCount == 0 || i + wordCount > spirv.size())
+            break;
+        // execution model, function id, then the name as a nul-terminated literal
+        if ((spirv[i] & 0xffff) == opEntryPoint && wordCount > 3)
+        {
+            const std::string_view name(reinterpret_cast<const char *>(&spirv[i + 3]), (wordCount - 3) * sizeof(std::uint32_t));
+            return std::string(name.substr(0, name.find('\0')));
+        }
+        i += wordCount;
+    }
+    return {};
+}
+
+void shaderBenchmark(std::filesystem::path const &directory)
+{
+    std::vector<ShaderRequest> requests;
+    std::error_code ec;
+    for (auto const &entry : std::filesystem::recursive_directory_iterator(directory, ec))
+    {
+        if (entry.is_regular_file() && entry.path().extension() == ".slang")
+            requests.push_back({.source = entry.path()});
+    }
+    if (requests.empty())
+    {
+        nrInfo(LogLevel::warning)("No .slang files under '{}'.", directory.string());
+        return;
+    }
+
+    ShaderCompiler &compiler = ShaderCompiler::instance();
+    std::filesystem::remove_all(compiler.options().cacheDirectory, ec);
+    auto run = [&] {
+        const auto start = std::chrono::steady_clock::now();
+        static_cast<void>(compiler.compileAll(requests));
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+    const ShaderCompilerStatistics initial = compiler.statistics();
+    const double cold = run();
+    const ShaderCompilerStatistics afterCold = compiler.statistics();
+    const double warm = run();
+    const ShaderCompilerStatistics afterWarm = compiler.statistics();
+    nrInfo()("shaders, {} entry points on {} threads (slang {})\n"
+             "  cold  {:>9.2f} ms, {} compiled, {} failed\n"
+             "  warm  {:>9.2f} ms, {} cache hits{}",
+             requests.size(), JobSystem::instance().slotCount(), compiler.compilerVersion(), cold, afterCold.compiled - initial.compiled, afterCold.failed - initial.failed, warm, afterWarm.cacheHits - afterCold.cacheHits,
+             afterWarm.compiled == afterCold.compiled ? "" : " (COMPILER INVOKED ON WARM START)");
+}
+
+} // namespace nr::shader
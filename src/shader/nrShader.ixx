@@ -0,0 +1,121 @@
+module;
+export module nr.shader;
+import nr.utils;
+import std;
+
+namespace detail
+{
+// Header of a cached entry point. The key only covers what is known before compiling (source text, entry point,
+// defines, profile, compiler); the includes a compile pulled in are listed after the header with the hash of their
+// contents, so an edited include invalidates the entry without the compiler having to run to find out.
+struct ShaderCacheFilePrefix
+{
+    static constexpr std::uint32_t expectedMagic = 0x4853524e; // "NRSH"
+    static constexpr std::uint32_t expectedVersion = 1;
+    std::uint32_t magic = expectedMagic;
+    std::uint32_t version = expectedVersion;
+    std::uint64_t key = 0;
+    std::uint32_t dependencyCount = 0;
+    std::uint32_t spirvWords = 0;
+    std::uint64_t checksum = 0;
+};
+} // namespace detail
+
+export namespace nr::shader
+{
+
+struct ShaderDefine
+{
+    std::string name;
+    std::string value;
+    bool operator==(ShaderDefine const &) const = default;
+};
+
+// one entry point of one Slang source file
+struct ShaderRequest
+{
+    std::filesystem::path source;
+    std::string entryPoint = "main";
+    std::vector<ShaderDefine> defines;
+    std::string profile = "spirv_1_6";
+    bool operator==(ShaderRequest const &) const = default;
+};
+
+struct CompiledShader
+{
+    std::vector<std::uint32_t> spirv;
+    // the source file followed by every file it included, as reported by the compiler
+    std::vector<std::filesystem::path> dependencies;
+    bool fromCache = false;
+};
+
+struct ShaderCompilerOptions
+{
+    std::vector<std::filesystem::path> searchPaths{"shaders"};
+    std::filesystem::path cacheDirectory{"cache/shaders"};
+};
+
+struct ShaderCompilerStatistics
+{
+    std::uint64_t cacheHits = 0;
+    std::uint64_t compiled = 0;
+    std::uint64_t failed = 0;
+    double compileMilliseconds = 0.0;
+};
+
+// Compiles Slang entry points to SPIR-V through a content-hashed disk cache. A request is looked up first; only a miss
+// reaches Slang, whose global session is created on the first miss, so a warm start never starts the compiler. Slang's
+// global session is not thread-safe, so every thread that compiles creates one of its own; compileAll() spreads a cold
+// build over all job-system workers. Diagnostics go to nrInfo as
+// warnings and a failed compile returns std::nullopt, so callers can keep whatever they had.
+class ShaderCompiler
+{
+  public:
+    static ShaderCompiler &instance();
+    // only has an effect before the first instance() call
+    static void configure(ShaderCompilerOptions options);
+
+    ShaderCompiler(const ShaderCompiler &) = delete;
+    ShaderCompiler &operator=(const ShaderCompiler &) = delete;
+    ~ShaderCompiler();
+
+    [[nodiscard]] std::optional<CompiledShader> compile(ShaderRequest const &request);
+    // results in request order
+    [[nodiscard]] std::vector<std::optional<CompiledShader>> compileAll(std::span<const ShaderRequest> requests, JobSystem &jobs = JobSystem::instance());
+    // compile() on a worker; the awaiting coroutine continues there
+    [[nodiscard]] Task<std::optional<CompiledShader>> compileAsync(ShaderRequest request, JobSystem &jobs = JobSystem::instance());
+
+    // Slang build tag; part of every cache key
+    [[nodiscard]] std::string_view compilerVersion() const;
+    [[nodiscard]] ShaderCompilerOptions const &options() const
+    {
+        return compilerOptions;
+    }
+    [[nodiscard]] ShaderCompilerStatistics statistics() const;
+    void report() const;
+
+  private:
+    explicit ShaderCompiler(ShaderCompilerOptions options);
+
+    [[nodiscard]] std::uint64_t requestKey(ShaderRequest const &request, std::span<const std::byte> source) const;
+    [[nodiscard]] std::filesystem::path cachePath(std::uint64_t key) const;
+    [[nodiscard]] std::optional<CompiledShader> load(std::uint64_t key) const;
+    void store(std::uint64_t key, CompiledShader const &shader) const;
+    [[nodiscard]] std::optional<CompiledShader> compileWithSlang(ShaderRequest const &request, std::string const &source);
+
+    ShaderCompilerOptions compilerOptions;
+    std::string version;
+    std::atomic<std::uint64_t> cacheHits = 0;
+    std::atomic<std::uint64_t> compiled = 0;
+    std::atomic<std::uint64_t> failed = 0;
+    std::atomic<std::uint64_t> compileNanoseconds = 0;
+};
+
+// name of the first OpEntryPoint in `spirv`, which need not be the requested one: Slang may rename it on the way
+[[nodiscard]] std::string spirvEntryPointName(std::span<const std::uint32_t> spirv);
+
+// Compiles the `main` entry point of every .slang file under `directory` twice: cold with the cache directory emptied,
+// then warm. The cold pass runs on all job-system slots; the warm one has to be served entirely from the cache.
+void shaderBenchmark(std::filesystem::path const &directory = "shaders");
+
+} // namespace nr::shader
@@ -0,0 +1,257 @@
+module;
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+export module nr.shader.watcher;
+import nr.utils;
+import std;
+
+export namespace nr::shader
+{
+
+struct ShaderWatcherOptions
+{
+    std::vector<std::filesystem::path> roots{"shaders"};
+    // changes closer together than this are delivered as one batch; editors often save a file in several steps
+    std::chrono::milliseconds debounce{50};
+    // scan period of the polling fallback
+    std::chrono::milliseconds pollInterval{250};
+    bool forcePolling = false;
+};
+
+// Watches the shader source trees on a thread of its own and hands `onChange` the canonical paths of the files that
+// changed, debounced into batches. On Linux this is inotify with one watch per directory, subdirectories being added
+// as they appear; elsewhere, or if inotify cannot be set up, modification times are polled. The callback runs on the
+// watcher thread and should only hand the work off.
+class ShaderWatcher
+{
+  public:
+    using Callback = std::move_only_function<void(std::span<const std::filesystem::path> changed)>;
+
+    ShaderWatcher(ShaderWatcherOptions options, Callback onChange) : options(std::move(options)), onChange(std::move(onChange))
+    {
+        for (std::filesystem::path &root : this->options.roots)
+            root = std::filesystem::weakly_canonical(root);
+#ifdef __linux__
+        if (!this->options.forcePolling)
+        {
+            descriptor = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (descriptor < 0)
+                nrInfo(LogLevel::warning)("inotify is unavailable, polling the shader sources instead.");
+        }
+        if (descriptor >= 0)
+        {
+            for (std::filesystem::path const &root : this->options.roots)
+                watchTree(root, nullptr);
+            thread = std::jthread([this](std::stop_token stop) { runInotify(stop); });
+            return;
+        }
+#endif
+        thread = std::jthread([this](std::stop_token stop) { runPolling(stop); });
+    }
+    ShaderWatcher(const ShaderWatcher &) = delete;
+    ShaderWatcher &operator=(const ShaderWatcher &) = delete;
+    ~ShaderWatcher()
+    {
+        thread.request_stop();
+        if (thread.joinable())
+            thread.join();
+#ifdef __linux__
+        if (descriptor >= 0)
+            ::close(descriptor);
+#endif
+    }
+
+    [[nodiscard]] bool usesInotify() const
+    {
+        return descriptor >= 0;
+    }
+
+  private:
+    using Snapshot = std::map<std::filesystem::path, std::filesystem::file_time_type>;
+
+    Snapshot scan() const
+    {
+        Snapshot files;
+        for (std::filesystem::path const &root : options.roots)
+        {
+            std::error_code ec;
+            for (auto it = std::filesystem::recursive_directory_iterator(root, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+            {
+                if (it->is_regular_file(ec))
+                    files.emplace(it->path(), it->last_write_time(ec));
+            }
+        }
+        return files;
+    }
+
+    void deliver(std::set<std::filesystem::path> &changed)
+    {
+        const std::vector<std::filesystem::path> batch(changed.begin(), changed.end());
+        changed.clear();
+        onChange(batch);
+    }
+
+    void runPolling(std::stop_token stop)
+    {
+        std::mutex mutex;
+        std::condition_variable_any wake;
+        Snapshot previous = scan();
+        std::unique_lock lock(mutex);
+        while (!wake.wait_for(lock, stop, options.pollInterval, [] { return false; }) && !stop.stop_requested())
+        {
+            Snapshot current = scan();
+            std::set<std::filesystem::path> changed;
+            for (auto const &[path, time] : current)
+            {
+                auto it = previous.find(path);
+                if (it == previous.end() || it->second != time)
+                    changed.insert(path);
+            }
+            for (auto const &[path, time] : previous)
+            {
+                if (!current.contains(path))
+                    changed.insert(path);
+            }
+            previous = std::move(current);
+            if (!changed.empty())
+                deliver(changed);
+        }
+    }
+
+#ifdef __linux__
+    // adds a watch on `directory` and every directory below it; files found on the way count as changed, for a tree
+    // that was moved in or checked out faster than the watches were added
+    void watchTree(std::filesystem::path const &directory, std::set<std::filesystem::path> *changed)
+    {
+        constexpr std::uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+        auto add = [&](std::filesystem::path const &path) {
+            const int watch = ::inotify_add_watch(descriptor, path.c_str(), mask);
+            if (watch >= 0)
+                directories[watch] = path;
+        };
+        add(directory);
+        std::error_code ec;
+        for (auto it = std::filesystem::recursive_directory_iterator(directory, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+        {
+            if (it->is_directory(ec))
+                add(it->path());
+            else if (changed)
+                changed->insert(it->path());
+        }
+    }
+
+    void runInotify(std::stop_token stop)
+    {
+        alignas(inotify_event) std::array<char, 16 * 1024> buffer;
+        std::set<std::filesystem::path> changed;
+        auto lastEvent = std::chrono::steady_clock::now();
+        while (!stop.stop_requested())
+        {
+            // wake up regularly to notice the stop request, sooner while a batch is waiting out its debounce
+            pollfd readable{descriptor, POLLIN, 0};
+            if (::poll(&readable, 1, changed.empty() ? 100 : static_cast<int>(options.debounce.count())) > 0)
+            {
+                for (::ssize_t length; (length = ::read(descriptor, buffer.data(), buffer.size())) > 0;)
+                {
+                    for (char *p = buffer.data(); p < buffer.data() + length;)
+                    {
+                        auto const *event = reinterpret_cast<inotify_event const *>(p);
+                        p += sizeof(inotify_event) + event->len;
+                        if (event->mask & IN_Q_OVERFLOW)
+                        {
+                            // events were dropped: everything may have changed
+                            for (auto const &entry : scan())
+                                changed.insert(entry.first);
+                            continue;
+                        }
+                        auto directory = directories.find(event->wd);
+                        if (directory == directories.end())
+                            continue;
+                        if (event->mask & IN_IGNORED)
+                        {
+                            directories.erase(directory);
+                            continue;
+                        }
+                        if (event->len == 0)
+                            continue;
+                        const std::filesystem::path path = directory->second / event->name;
+                        if (event->mask & IN_ISDIR)
+                        {
+                            if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                                watchTree(path, &changed);
+                            continue;
+                        }
+                        // a created file is reported again once it has been written and closed
+                        if (event->mask & IN_CREATE)
+                            continue;
+                        changed.insert(path);
+                    }
+                    lastEvent = std::chrono::steady_clock::now();
+                }
+            }
+            if (!changed.empty() && std::chrono::steady_clock::now() - lastEvent >= options.debounce)
+                deliver(changed);
+        }
+    }
+
+    std::unordered_map<int, std::filesystem::path> directories;
+#endif
+
+    ShaderWatcherOptions options;
+    Callback onChange;
+    int descriptor = -1;
+    // last, so it stops before anything it uses goes away
+    std::jthread thread;
+};
+
+// Maps each source file to the units (pipelines, materials, ...) built from it, so a change rebuilds only the units
+// whose sources or includes it touches. Paths are compared in canonical form. Not thread-safe.
+template <typename Unit> class ShaderDependencyGraph
+{
+  public:
+    // replaces whatever `unit` depended on before
+    void set(Unit unit, std::span<const std::filesystem::path> files)
+    {
+        erase(unit);
+        for (std::filesystem::path const &file : files)
+        {
+            std::vector<Unit> &units = dependents[std::filesystem::weakly_canonical(file)];
+            if (!std::ranges::contains(units, unit))
+                units.push_back(unit);
+        }
+    }
+
+    void erase(Unit unit)
+    {
+        std::erase_if(dependents, [&](auto &entry) {
+            std::erase(entry.second, unit);
+            return entry.second.empty();
+        });
+    }
+
+    // every unit depending on at least one of `changed`, each once
+    [[nodiscard]] std::vector<Unit> affected(std::span<const std::filesystem::path> changed) const
+    {
+        std::vector<Unit> units;
+        for (std::filesystem::path const &file : changed)
+        {
+            auto it = dependents.find(std::filesystem::weakly_canonical(file));
+            if (it == dependents.end())
+                continue;
+            for (Unit const &unit : it->second)
+            {
+                if (!std::ranges::contains(units, unit))
+                    units.push_back(unit);
+            }
+        }
+        return units;
+    }
+
+  private:
+    std::map<std::filesystem::path, std::vector<Unit>> dependents;
+};
+
+} // namespace nr::shader
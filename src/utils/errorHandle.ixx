@@ -1,21 +1,14 @@
 module;
 export module nr.utils:errorHandle;
+import :logger;
 import std;
 
-export namespace nr
-{
-enum class LogLevel
-{
-    info,
-    warning,
-    error,
-    number
-};
-} // namespace nr
-
 namespace detail
 {
 
+// dynamic initialization runs on the thread that goes on to call main()
+inline const std::thread::id mainThreadId = std::this_thread::get_id();
+
 struct Assert_t
 {
     bool condition;
@@ -29,6 +22,8 @@ struct Assert_t
     {
         if (!condition)
         {
+            // keep the report after whatever was logged before it
+            Logger::instance().flush();
             auto formatted = std::format(fmt, std::forward<Args>(args)...);
             std::print(std::cerr,
                        "[nrAssert] FAILED\n"
@@ -51,21 +46,32 @@ struct Info_t
     {
     }
 
+    // filtered before anything is formatted; the sinks run on the logger thread. An error waits for its own output to
+    // be written before ending the process. Only the main thread runs static destructors on the way out: elsewhere
+    // they would join the job worker or logger thread raising the error, so other threads end with quick_exit.
     template <typename... Args> inline void operator()(std::format_string<Args...> fmt, Args &&...args) const noexcept
     {
-        auto formatted = std::format(fmt, std::forward<Args>(args)...);
-        std::array<std::string, static_cast<size_t>(nr::LogLevel::number)> levelDict{"INFO", "WARNING", "ERROR"};
-        bool isError = level == nr::LogLevel::error;
-        std::print(isError ? std::cerr : std::cout,
-                   "[nr {}]\n"
-                   "  msg  : {}\n"
-                   "  file : {}\t\t"
-                   "  line : {}\n"
-                   "  func : {}\n",
-                   levelDict[static_cast<size_t>(level)], formatted, loc.file_name(), loc.line(), loc.function_name());
-        std::cout.flush();
-        if (isError)
-            std::exit(1);
+        if (level != nr::LogLevel::error && level < nr::compiledLogLevel())
+            return;
+        Logger &logger = Logger::instance();
+        if (!logger.enabled(level))
+            return;
+        std::string message = std::format(fmt, std::forward<Args>(args)...);
+        if (level == nr::LogLevel::error && logger.onLoggerThread())
+        {
+            // raised by a sink: the queue cannot drain any more, so report straight to stderr
+            std::print(std::cerr, "[error] {} ({}:{})\n", message, loc.file_name(), loc.line());
+            std::cerr.flush();
+            std::quick_exit(1);
+        }
+        logger.push({level, loc, std::chrono::system_clock::now(), std::this_thread::get_id(), std::move(message)});
+        if (level == nr::LogLevel::error)
+        {
+            logger.flush();
+            if (std::this_thread::get_id() == mainThreadId)
+                std::exit(1);
+            std::quick_exit(1);
+        }
     }
 };
 } // namespace detail
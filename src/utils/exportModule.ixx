@@ -1,5 +1,13 @@
 module;
 export module nr.utils;
+export import :logger;
 export import :errorHandle;
 export import :staticUtils;
-export import :math;
\ No newline at end of file
+export import :math;
+export import :simd;
+export import :culling;
+export import :trace;
+export import :jobs;
+export import :task;
+export import :memory;
+export import :handles;
\ No newline at end of file
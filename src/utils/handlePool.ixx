@@ -0,0 +1,152 @@
+module;
+export module nr.utils:handles;
+import :errorHandle;
+import std;
+
+export namespace nr
+{
+
+// 32-bit slot index plus the slot's generation when the handle was issued. Releasing a slot bumps its generation, so
+// a handle kept past its resource's release is recognised as stale instead of silently aliasing whatever reuses the
+// slot. Trivially copyable, 8 bytes, safe to pass between threads; Tag only keeps the kinds apart.
+template <typename Tag> struct Handle
+{
+    static constexpr std::uint32_t invalidIndex = ~0u;
+    std::uint32_t index = invalidIndex;
+    std::uint32_t generation = 0;
+
+    explicit operator bool() const
+    {
+        return index != invalidIndex;
+    }
+    bool operator==(Handle const &) const = default;
+};
+
+// Sparse set of SoA rows addressed by Handle<Tag>. Every column is one packed vector, so iterating a column walks
+// contiguous memory with no holes; insert appends a row, erase moves the last row into the gap. Handles go through a
+// sparse slot array (generation + row), so lookups are two indexed loads and never hash. Not thread-safe.
+template <typename Tag, typename... Columns> class HandlePool
+{
+  public:
+    using HandleType = Handle<Tag>;
+    template <std::size_t C> using Column = std::tuple_element_t<C, std::tuple<Columns...>>;
+
+    HandleType insert(Columns... values)
+    {
+        std::uint32_t index;
+        if (!freeSlots.empty())
+        {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            index = static_cast<std::uint32_t>(slots.size());
+            nrAssert(index != HandleType::invalidIndex)("Handle pool is full.");
+            slots.push_back({firstGeneration, 0});
+        }
+        Slot &slot = slots[index];
+        slot.row = static_cast<std::uint32_t>(rowHandles.size());
+        rowHandles.push_back({index, slot.generation});
+        std::apply([&](auto &...column) { (column.push_back(std::move(values)), ...); }, columns);
+        return rowHandles.back();
+    }
+
+    [[nodiscard]] bool contains(HandleType handle) const
+    {
+        return handle.index < slots.size() && slots[handle.index].generation == handle.generation;
+    }
+
+    // row of a live handle, std::nullopt for a stale or empty one
+    [[nodiscard]] std::optional<std::uint32_t> row(HandleType handle) const
+    {
+        if (!contains(handle))
+            return std::nullopt;
+        return slots[handle.index].row;
+    }
+
+    // column C of a live handle; null for a stale one
+    template <std::size_t C> [[nodiscard]] Column<C> *get(HandleType handle)
+    {
+        const std::optional<std::uint32_t> r = row(handle);
+        return r ? &std::get<C>(columns)[*r] : nullptr;
+    }
+    template <std::size_t C> [[nodiscard]] Column<C> const *get(HandleType handle) const
+    {
+        const std::optional<std::uint32_t> r = row(handle);
+        return r ? &std::get<C>(columns)[*r] : nullptr;
+    }
+
+    // removes the handle's row and returns its values; std::nullopt if the handle was stale
+    std::optional<std::tuple<Columns...>> erase(HandleType handle)
+    {
+        const std::optional<std::uint32_t> r = row(handle);
+        if (!r)
+            return std::nullopt;
+        std::tuple<Columns...> removed = std::apply([&](auto &...column) { return std::tuple<Columns...>(std::move(column[*r])...); }, columns);
+        const std::uint32_t last = static_cast<std::uint32_t>(rowHandles.size()) - 1;
+        if (*r != last)
+        {
+            std::apply([&](auto &...column) { ((column[*r] = std::move(column[last])), ...); }, columns);
+            rowHandles[*r] = rowHandles[last];
+            slots[rowHandles[*r].index].row = *r;
+        }
+        std::apply([](auto &...column) { (column.pop_back(), ...); }, columns);
+        rowHandles.pop_back();
+
+        Slot &slot = slots[handle.index];
+        // skip 0 on wrap-around so a default-constructed generation never matches
+        slot.generation = slot.generation == std::numeric_limits<std::uint32_t>::max() ? firstGeneration : slot.generation + 1;
+        freeSlots.push_back(handle.index);
+        return removed;
+    }
+
+    // dense column C, in row order; rows move on erase, so hold handles rather than row numbers
+    template <std::size_t C> [[nodiscard]] std::span<Column<C>> column()
+    {
+        return std::get<C>(columns);
+    }
+    template <std::size_t C> [[nodiscard]] std::span<const Column<C>> column() const
+    {
+        return std::get<C>(columns);
+    }
+    // handle of each row, parallel to the columns
+    [[nodiscard]] std::span<const HandleType> handles() const
+    {
+        return rowHandles;
+    }
+
+    [[nodiscard]] std::size_t size() const
+    {
+        return rowHandles.size();
+    }
+    [[nodiscard]] bool empty() const
+    {
+        return rowHandles.empty();
+    }
+    void reserve(std::size_t count)
+    {
+        std::apply([&](auto &...column) { (column.reserve(count), ...); }, columns);
+        rowHandles.reserve(count);
+        slots.reserve(count);
+    }
+
+    // bytes per live row across all columns plus its handle and slot
+    static constexpr std::size_t rowBytes = (sizeof(Columns) + ... + 0) + sizeof(HandleType) + 2 * sizeof(std::uint32_t);
+
+  private:
+    static constexpr std::uint32_t firstGeneration = 1;
+
+    struct Slot
+    {
+        std::uint32_t generation;
+        std::uint32_t row;
+    };
+
+    std::tuple<std::vector<Columns>...> columns;
+    std::vector<HandleType> rowHandles;
+    std::vector<Slot> slots;
+    std::vector<std::uint32_t> freeSlots;
+};
+
+} // namespace nr
@@ -0,0 +1,479 @@
+module;
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+export module nr.utils:jobs;
+import :trace;
+import std;
+
+export namespace nr
+{
+
+// Fork-join completion counter: every job run against it increments it, finishing decrements it, and
+// JobSystem::wait() returns once it is back at zero. The first exception thrown by one of its jobs is rethrown by wait().
+// A child counter holds its parent open while it has pending jobs and passes its first exception up, so waiting on the
+// parent covers everything its jobs forked. The parent has to outlive the child.
+class JobCounter
+{
+  public:
+    JobCounter() = default;
+    explicit JobCounter(JobCounter &parentCounter) : parent(&parentCounter)
+    {
+    }
+    JobCounter(const JobCounter &) = delete;
+    JobCounter &operator=(const JobCounter &) = delete;
+
+    [[nodiscard]] bool done() const
+    {
+        return pending.load(std::memory_order_acquire) == 0;
+    }
+
+  private:
+    friend class JobSystem;
+    JobCounter *parent = nullptr;
+    std::atomic<std::uint32_t> pending = 0;
+    std::atomic<bool> failed = false;
+    std::exception_ptr error;
+};
+
+struct JobSystemOptions
+{
+    // the thread that waits helps out, so one core is left for it
+    std::uint32_t workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    // worker i runs on core i + 1 only, away from the main thread on core 0
+    bool pinWorkers = false;
+};
+
+} // namespace nr
+
+namespace detail
+{
+
+struct Job
+{
+    std::move_only_function<void()> function;
+    nr::JobCounter *counter;
+};
+
+// Bumped every time a counter drains or a job is queued. Waiters sleep on this instead of the counter: the waiter may
+// destroy the counter as soon as it reads zero, so the releasing thread must not touch it after the decrement.
+inline std::atomic<std::uint32_t> waiterEpoch = 0;
+inline std::atomic<std::uint32_t> waiterSleepers = 0;
+
+// Chase-Lev deque (Le, Pop, Cohen, Zappa Nardelli, "Correct and Efficient Work-Stealing for Weak Memory Models"). The
+// owning worker pushes and pops at the bottom, thieves take from the top. Outgrown rings are kept until destruction
+// because a thief may still be reading one.
+class WorkStealingDeque
+{
+  public:
+    WorkStealingDeque()
+    {
+        rings.push_back(std::make_unique<Ring>(1024));
+        ring.store(rings.back().get(), std::memory_order_relaxed);
+    }
+
+    void push(Job *job)
+    {
+        const std::int64_t b = bottom.load(std::memory_order_relaxed);
+        const std::int64_t t = top.load(std::memory_order_acquire);
+        Ring *r = ring.load(std::memory_order_relaxed);
+        if (b - t > r->mask)
+            r = grow(r, t, b);
+        r->put(b, job);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    Job *pop()
+    {
+        const std::int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Ring *r = ring.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        Job *job = r->get(b);
+        if (t == b)
+        {
+            // last element: race the thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                job = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    Job *steal()
+    {
+        std::int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const std::int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+        Job *job = ring.load(std::memory_order_acquire)->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return job;
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct Ring
+    {
+        explicit Ring(std::int64_t capacity) : mask(capacity - 1), slots(std::make_unique<std::atomic<Job *>[]>(static_cast<std::size_t>(capacity)))
+        {
+        }
+        std::int64_t mask;
+        std::unique_ptr<std::atomic<Job *>[]> slots;
+
+        Job *get(std::int64_t i) const
+        {
+            return slots[static_cast<std::size_t>(i & mask)].load(std::memory_order_relaxed);
+        }
+        void put(std::int64_t i, Job *job)
+        {
+            slots[static_cast<std::size_t>(i & mask)].store(job, std::memory_order_relaxed);
+        }
+    };
+
+    Ring *grow(Ring *old, std::int64_t t, std::int64_t b)
+    {
+        rings.push_back(std::make_unique<Ring>((old->mask + 1) * 2));
+        Ring *r = rings.back().get();
+        for (std::int64_t i = t; i < b; ++i)
+            r->put(i, old->get(i));
+        ring.store(r, std::memory_order_release);
+        return r;
+    }
+
+    std::atomic<std::int64_t> top = 0;
+    std::atomic<std::int64_t> bottom = 0;
+    std::atomic<Ring *> ring = nullptr;
+    // owner-only
+    std::vector<std::unique_ptr<Ring>> rings;
+};
+
+// the pool and index of the worker running on this thread; other threads share the external slot
+thread_local void const *jobWorkerOwner = nullptr;
+thread_local std::uint32_t jobWorkerIndex = 0;
+
+inline nr::JobSystemOptions &pendingJobSystemOptions()
+{
+    static nr::JobSystemOptions options;
+    return options;
+}
+
+inline void pinCurrentThread(std::uint32_t core)
+{
+    const std::uint32_t cores = std::max(std::thread::hardware_concurrency(), 1u);
+#if defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << (core % std::min(cores, 64u)));
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % cores, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    static_cast<void>(core);
+    static_cast<void>(cores);
+#endif
+}
+
+} // namespace detail
+
+export namespace nr
+{
+
+// Fixed pool of workers, each with its own work-stealing deque. Jobs run from a worker go to its deque and are
+// popped LIFO there, while idle workers steal FIFO from the others; jobs run from any other thread go through a shared
+// injection queue. Waiting never blocks a thread that could help: wait() runs pending jobs until the counter drains and
+// only then sleeps. Idle workers spin briefly, then sleep until new work arrives.
+class JobSystem
+{
+  public:
+    // process-wide pool, created on first use with the options given to configure()
+    static JobSystem &instance()
+    {
+        static JobSystem system(detail::pendingJobSystemOptions());
+        return system;
+    }
+    // only has an effect before the first instance() call
+    static void configure(JobSystemOptions options)
+    {
+        detail::pendingJobSystemOptions() = options;
+    }
+
+    explicit JobSystem(JobSystemOptions options = {}) : deques(options.workerCount), workerTotal(options.workerCount)
+    {
+        for (auto &deque : deques)
+            deque = std::make_unique<detail::WorkStealingDeque>();
+        for (std::uint32_t i = 0; i < options.workerCount; ++i)
+            workers.emplace_back([this, i, pin = options.pinWorkers] { workerLoop(i, pin); });
+    }
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+    ~JobSystem()
+    {
+        stopping.store(true);
+        epoch.fetch_add(1);
+        epoch.notify_all();
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    [[nodiscard]] std::uint32_t workerCount() const
+    {
+        return workerTotal;
+    }
+    // per-thread resources indexed by currentSlot() need this many entries: one per worker plus the external slot
+    [[nodiscard]] std::uint32_t slotCount() const
+    {
+        return workerCount() + 1;
+    }
+    // worker index on a worker of this pool, workerCount() on every other thread
+    [[nodiscard]] std::uint32_t currentSlot() const
+    {
+        return detail::jobWorkerOwner == this ? detail::jobWorkerIndex : workerCount();
+    }
+
+    void run(JobCounter &counter, std::move_only_function<void()> function)
+    {
+        retain(counter);
+        auto *job = new detail::Job{std::move(function), &counter};
+        if (detail::jobWorkerOwner == this)
+        {
+            deques[detail::jobWorkerIndex]->push(job);
+        }
+        else
+        {
+            std::scoped_lock lock(injectionMutex);
+            injected.push_back(job);
+            injectedCount.fetch_add(1, std::memory_order_release);
+        }
+        epoch.fetch_add(1, std::memory_order_seq_cst);
+        if (sleepers.load(std::memory_order_seq_cst))
+            epoch.notify_one();
+        // a thread asleep in wait() may be the only one left to run it, as in a pool without workers
+        detail::waiterEpoch.fetch_add(1, std::memory_order_seq_cst);
+        if (detail::waiterSleepers.load(std::memory_order_seq_cst))
+            detail::waiterEpoch.notify_all();
+    }
+    // run() without a counter to wait on, for work that reports back by itself (a resumed coroutine)
+    void post(std::move_only_function<void()> function)
+    {
+        run(detached, std::move(function));
+    }
+
+    // Holds `counter` open for work that is not a job, such as a suspended coroutine; pair every retain() with one
+    // release(). The first pending entry of a child counter takes a reference on its parent, the last gives it back.
+    static void retain(JobCounter &counter)
+    {
+        if (counter.pending.fetch_add(1, std::memory_order_relaxed) == 0 && counter.parent)
+            retain(*counter.parent);
+    }
+    static void release(JobCounter &counter)
+    {
+        // last touch of the counter: the waiter may destroy it as soon as it reads zero
+        JobCounter *parent = counter.parent;
+        if (counter.pending.fetch_sub(1, std::memory_order_seq_cst) == 1)
+        {
+            detail::waiterEpoch.fetch_add(1, std::memory_order_seq_cst);
+            if (detail::waiterSleepers.load(std::memory_order_seq_cst))
+                detail::waiterEpoch.notify_all();
+            if (parent)
+                release(*parent);
+        }
+    }
+
+    // runs other jobs until `counter` drains, then rethrows the first exception one of its jobs threw
+    void wait(JobCounter &counter)
+    {
+        const std::uint32_t slot = currentSlot();
+        for (std::uint32_t idle = 0; !counter.done();)
+        {
+            if (detail::Job *job = findJob(slot))
+            {
+                execute(job);
+                idle = 0;
+            }
+            else if (++idle < 64)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                // only long jobs are left; sleep until some counter drains or a job is queued, then look again. A job
+                // injected before the epoch was read is still in the queue, so check that too.
+                const std::uint32_t seen = detail::waiterEpoch.load(std::memory_order_seq_cst);
+                detail::waiterSleepers.fetch_add(1, std::memory_order_seq_cst);
+                if (!counter.done() && injectedCount.load(std::memory_order_seq_cst) == 0)
+                    detail::waiterEpoch.wait(seen, std::memory_order_seq_cst);
+                detail::waiterSleepers.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        if (counter.failed.load(std::memory_order_acquire))
+            std::rethrow_exception(counter.error);
+    }
+
+    // Calls body(first, last) over disjoint subranges covering [begin, end), in parallel. Lazy binary splitting: a
+    // range hands its upper half to the pool only while the running thread has nothing queued, otherwise it runs
+    // `grain` items itself, so the number of jobs follows how many threads are actually free. `grain` bounds how small
+    // a handed-off range gets, not how many there are; 0 picks about 16 pieces per thread.
+    template <typename F> void parallelFor(std::size_t begin, std::size_t end, F &&body, std::size_t grain = 0)
+    {
+        if (begin >= end)
+            return;
+        if (grain == 0)
+            grain = std::max<std::size_t>(1, (end - begin) / (static_cast<std::size_t>(slotCount()) * 16));
+        JobCounter counter;
+        auto runRange = [this, &body, &counter, grain](auto &self, std::size_t first, std::size_t last) -> void {
+            while (last - first > grain)
+            {
+                if (localQueueEmpty())
+                {
+                    const std::size_t middle = first + (last - first) / 2;
+                    run(counter, [&self, middle, last] { self(self, middle, last); });
+                    last = middle;
+                }
+                else
+                {
+                    body(first, first + grain);
+                    first += grain;
+                }
+            }
+            body(first, last);
+        };
+        try
+        {
+            runRange(runRange, begin, end);
+        }
+        catch (...)
+        {
+            // the spawned halves still reference this frame
+            wait(counter);
+            throw;
+        }
+        wait(counter);
+    }
+
+  private:
+    bool localQueueEmpty() const
+    {
+        return detail::jobWorkerOwner == this ? deques[detail::jobWorkerIndex]->empty() : injectedCount.load(std::memory_order_relaxed) == 0;
+    }
+
+    detail::Job *findJob(std::uint32_t slot)
+    {
+        if (slot < workerCount())
+        {
+            if (detail::Job *job = deques[slot]->pop())
+                return job;
+        }
+        if (injectedCount.load(std::memory_order_acquire) > 0)
+        {
+            std::scoped_lock lock(injectionMutex);
+            if (!injected.empty())
+            {
+                detail::Job *job = injected.front();
+                injected.pop_front();
+                injectedCount.fetch_sub(1, std::memory_order_relaxed);
+                return job;
+            }
+        }
+        const std::uint32_t count = workerCount();
+        for (std::uint32_t i = 1; i <= count; ++i)
+        {
+            const std::uint32_t victim = (slot + i) % count;
+            if (victim == slot)
+                continue;
+            if (detail::Job *job = deques[victim]->steal())
+                return job;
+        }
+        return nullptr;
+    }
+
+    static void fail(JobCounter &counter, std::exception_ptr error)
+    {
+        for (JobCounter *c = &counter; c; c = c->parent)
+        {
+            if (c->failed.exchange(true, std::memory_order_acq_rel))
+                break;
+            c->error = error;
+        }
+    }
+
+    static void execute(detail::Job *job)
+    {
+        JobCounter &counter = *job->counter;
+        try
+        {
+            job->function();
+        }
+        catch (...)
+        {
+            fail(counter, std::current_exception());
+        }
+        delete job;
+        release(counter);
+    }
+
+    void workerLoop(std::uint32_t index, bool pin)
+    {
+        detail::jobWorkerOwner = this;
+        detail::jobWorkerIndex = index;
+        if (pin)
+            detail::pinCurrentThread(index + 1);
+        setTraceThreadName(std::format("job worker {}", index));
+        std::uint32_t idle = 0;
+        while (!stopping.load(std::memory_order_relaxed))
+        {
+            const std::uint64_t seen = epoch.load(std::memory_order_seq_cst);
+            if (detail::Job *job = findJob(index))
+            {
+                execute(job);
+                idle = 0;
+                continue;
+            }
+            if (++idle < 64)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            sleepers.fetch_add(1, std::memory_order_seq_cst);
+            epoch.wait(seen, std::memory_order_seq_cst);
+            sleepers.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    std::vector<std::unique_ptr<detail::WorkStealingDeque>> deques;
+    std::uint32_t workerTotal;
+    std::mutex injectionMutex;
+    std::deque<detail::Job *> injected;
+    std::atomic<std::uint32_t> injectedCount = 0;
+    std::atomic<std::uint64_t> epoch = 0;
+    std::atomic<std::uint32_t> sleepers = 0;
+    std::atomic<bool> stopping = false;
+    JobCounter detached;
+    std::vector<std::thread> workers;
+};
+
+// JobSystem::instance().parallelFor(...)
+template <typename F> void parallelFor(std::size_t begin, std::size_t end, F &&body, std::size_t grain = 0)
+{
+    JobSystem::instance().parallelFor(begin, end, std::forward<F>(body), grain);
+}
+
+} // namespace nr
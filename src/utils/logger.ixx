@@ -0,0 +1,339 @@
+module;
+export module nr.utils:logger;
+import std;
+
+export namespace nr
+{
+enum class LogLevel
+{
+    info,
+    warning,
+    error,
+    number
+};
+
+// NR_LOG_MIN_LEVEL (CMake cache variable, 0 info / 1 warning / 2 error) drops lower levels at compile time; errors
+// always get through since they end the process
+consteval LogLevel compiledLogLevel()
+{
+#if defined(NR_LOG_MIN_LEVEL)
+    return static_cast<LogLevel>(NR_LOG_MIN_LEVEL < 2 ? NR_LOG_MIN_LEVEL : 2);
+#else
+    return LogLevel::info;
+#endif
+}
+
+constexpr std::string_view logLevelName(LogLevel level)
+{
+    constexpr std::array<std::string_view, static_cast<size_t>(LogLevel::number)> names{"INFO", "WARNING", "ERROR"};
+    return names[static_cast<size_t>(level)];
+}
+
+struct LogRecord
+{
+    LogLevel level;
+    std::source_location loc;
+    std::chrono::system_clock::time_point time;
+    std::thread::id thread;
+    std::string message;
+};
+
+// Sinks run on the logger thread only, so they need no locking of their own
+class LogSink
+{
+  public:
+    virtual ~LogSink() = default;
+    virtual void write(LogRecord const &record) = 0;
+    // end of a batch; buffered output is pushed out here rather than per record
+    virtual void flush()
+    {
+    }
+};
+
+class ConsoleSink final : public LogSink
+{
+  public:
+    void write(LogRecord const &record) override
+    {
+        std::print(record.level == LogLevel::error ? std::cerr : std::cout,
+                   "[nr {}]\n"
+                   "  msg  : {}\n"
+                   "  file : {}\t\t"
+                   "  line : {}\n"
+                   "  func : {}\n",
+                   logLevelName(record.level), record.message, record.loc.file_name(), record.loc.line(), record.loc.function_name());
+    }
+    void flush() override
+    {
+        std::cout.flush();
+        std::cerr.flush();
+    }
+};
+
+// One line per record. When the file passes `maxBytes` it becomes name.1.ext, the previous name.1.ext becomes
+// name.2.ext and so on; files beyond `maxFiles` are deleted.
+class RotatingFileSink final : public LogSink
+{
+  public:
+    explicit RotatingFileSink(std::filesystem::path path, std::uintmax_t maxBytes = 4u << 20, std::uint32_t maxFiles = 3) : path(std::move(path)), maxBytes(maxBytes), maxFiles(std::max(maxFiles, 1u))
+    {
+        if (this->path.has_parent_path())
+            std::filesystem::create_directories(this->path.parent_path());
+        open(std::ios::app);
+    }
+
+    void write(LogRecord const &record) override
+    {
+        if (!out)
+            return;
+        const std::string line = std::format("{:%F %T} [{}] {} ({}:{}) [thread {}]\n", std::chrono::floor<std::chrono::milliseconds>(record.time), logLevelName(record.level), record.message, record.loc.file_name(),
+                                             record.loc.line(), record.thread);
+        if (written + line.size() > maxBytes && written > 0)
+            rotate();
+        out << line;
+        written += line.size();
+    }
+    void flush() override
+    {
+        out.flush();
+    }
+
+  private:
+    std::filesystem::path numbered(std::uint32_t index) const
+    {
+        std::filesystem::path result = path;
+        result.replace_filename(std::format("{}.{}{}", path.stem().string(), index, path.extension().string()));
+        return result;
+    }
+
+    void open(std::ios::openmode mode)
+    {
+        out.open(path, std::ios::binary | mode);
+        std::error_code error;
+        const std::uintmax_t size = std::filesystem::file_size(path, error);
+        written = error ? 0 : size;
+    }
+
+    void rotate()
+    {
+        out.close();
+        std::error_code error;
+        std::filesystem::remove(numbered(maxFiles), error);
+        for (std::uint32_t i = maxFiles; i > 1; --i)
+            std::filesystem::rename(numbered(i - 1), numbered(i), error);
+        std::filesystem::rename(path, numbered(1), error);
+        open(std::ios::trunc);
+    }
+
+    std::filesystem::path path;
+    std::uintmax_t maxBytes;
+    std::uint32_t maxFiles;
+    std::ofstream out;
+    std::uintmax_t written = 0;
+};
+} // namespace nr
+
+namespace detail
+{
+
+// Vyukov's intrusive MPSC queue: push is one exchange and never waits on other producers or the consumer; pop is
+// consumer-only. A producer preempted between its exchange and its link hides later nodes until it resumes.
+struct LogNode
+{
+    std::atomic<LogNode *> next = nullptr;
+    nr::LogRecord record;
+};
+
+class LogQueue
+{
+  public:
+    LogQueue() : head(&stub), tail(&stub)
+    {
+    }
+
+    void push(LogNode *node) noexcept
+    {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        LogNode *previous = head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    LogNode *pop() noexcept
+    {
+        LogNode *t = tail;
+        LogNode *next = t->next.load(std::memory_order_acquire);
+        if (t == &stub)
+        {
+            if (!next)
+                return nullptr;
+            tail = next;
+            t = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next)
+        {
+            tail = next;
+            return t;
+        }
+        if (t != head.load(std::memory_order_acquire))
+            return nullptr;
+        push(&stub);
+        next = t->next.load(std::memory_order_acquire);
+        if (next)
+        {
+            tail = next;
+            return t;
+        }
+        return nullptr;
+    }
+
+  private:
+    LogNode stub;
+    std::atomic<LogNode *> head;
+    LogNode *tail;
+};
+
+// Callers filter and format the message text on their own thread (arguments may be views into temporaries, so they
+// cannot cross threads), then hand the record over. The decoration, sink formatting and all I/O happen on the logger
+// thread, which flushes its sinks once per batch instead of once per message.
+class Logger
+{
+  public:
+    static Logger &instance()
+    {
+        static Logger logger;
+        return logger;
+    }
+
+    Logger(const Logger &) = delete;
+    Logger &operator=(const Logger &) = delete;
+    ~Logger()
+    {
+        stopping.store(true);
+        wake();
+        worker.join();
+    }
+
+    [[nodiscard]] bool enabled(nr::LogLevel level) const noexcept
+    {
+        return level == nr::LogLevel::error || level >= minimum.load(std::memory_order_relaxed);
+    }
+    void setLevel(nr::LogLevel level) noexcept
+    {
+        minimum.store(level, std::memory_order_relaxed);
+    }
+
+    void push(nr::LogRecord &&record)
+    {
+        queue.push(new LogNode{nullptr, std::move(record)});
+        pushed.fetch_add(1, std::memory_order_release);
+        wake();
+    }
+
+    // true inside a sink; flush() from there would wait for itself
+    [[nodiscard]] bool onLoggerThread() const noexcept
+    {
+        return std::this_thread::get_id() == worker.get_id();
+    }
+
+    // returns once everything pushed before the call has reached the sinks and they have been flushed
+    void flush()
+    {
+        const std::uint64_t target = pushed.load(std::memory_order_acquire);
+        for (std::uint64_t done = written.load(std::memory_order_acquire); done < target; done = written.load(std::memory_order_acquire))
+            written.wait(done, std::memory_order_acquire);
+    }
+
+    void addSink(std::unique_ptr<nr::LogSink> sink)
+    {
+        std::scoped_lock lock(sinkMutex);
+        sinks.push_back(std::move(sink));
+    }
+    void clearSinks()
+    {
+        std::scoped_lock lock(sinkMutex);
+        sinks.clear();
+    }
+
+  private:
+    Logger()
+    {
+        sinks.push_back(std::make_unique<nr::ConsoleSink>());
+        worker = std::thread([this] { run(); });
+    }
+
+    void wake() noexcept
+    {
+        signal.fetch_add(1, std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_seq_cst))
+            signal.notify_one();
+    }
+
+    void run()
+    {
+        std::uint64_t count = 0;
+        while (true)
+        {
+            const std::uint64_t seen = signal.load(std::memory_order_seq_cst);
+            if (LogNode *node = queue.pop())
+            {
+                std::scoped_lock lock(sinkMutex);
+                do
+                {
+                    for (auto &sink : sinks)
+                        sink->write(node->record);
+                    delete node;
+                    ++count;
+                } while ((node = queue.pop()));
+                for (auto &sink : sinks)
+                    sink->flush();
+                written.store(count, std::memory_order_release);
+                written.notify_all();
+                continue;
+            }
+            if (stopping.load() && count == pushed.load(std::memory_order_acquire))
+                return;
+            sleeping.store(true, std::memory_order_seq_cst);
+            signal.wait(seen, std::memory_order_seq_cst);
+            sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    LogQueue queue;
+    std::atomic<nr::LogLevel> minimum = nr::LogLevel::info;
+    std::atomic<std::uint64_t> pushed = 0;
+    std::atomic<std::uint64_t> written = 0;
+    std::atomic<std::uint64_t> signal = 0;
+    std::atomic<bool> sleeping = false;
+    std::atomic<bool> stopping = false;
+    std::mutex sinkMutex;
+    std::vector<std::unique_ptr<nr::LogSink>> sinks;
+    std::thread worker;
+};
+
+} // namespace detail
+
+export namespace nr
+{
+
+// messages below `level` are dropped before they are formatted; errors are never dropped
+inline void setLogLevel(LogLevel level)
+{
+    detail::Logger::instance().setLevel(level);
+}
+inline void addLogSink(std::unique_ptr<LogSink> sink)
+{
+    detail::Logger::instance().addSink(std::move(sink));
+}
+// removes every sink, including the default console one
+inline void clearLogSinks()
+{
+    detail::Logger::instance().clearSinks();
+}
+// blocks until everything logged so far has been written
+inline void flushLog()
+{
+    detail::Logger::instance().flush();
+}
+
+} // namespace nr
@@ -0,0 +1,426 @@
+module;
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#define NR_ARENA_ASAN
+#endif
+export module nr.utils:memory;
+import :errorHandle;
+import :logger;
+import :staticUtils;
+import std;
+
+export namespace nr
+{
+// Debug builds fill fresh arena memory with 0xCD and released memory with 0xDD, and under AddressSanitizer also
+// poison everything that is not currently allocated, so a pointer kept past its arena's reset faults right away
+consteval bool isArenaPoisoningEnabled()
+{
+    return isDebugMode();
+}
+
+struct ArenaStatistics
+{
+    std::size_t used = 0;
+    std::size_t capacity = 0;
+    // most bytes in use at once since construction; size the blocks from this
+    std::size_t highWater = 0;
+    std::size_t allocations = 0;
+    // bytes that did not fit and went to the upstream resource (FrameAllocator only)
+    std::size_t overflow = 0;
+};
+} // namespace nr
+
+namespace detail
+{
+
+constexpr std::byte arenaFreshPattern{0xCD};
+constexpr std::byte arenaReleasedPattern{0xDD};
+
+inline void arenaPoison(void *data, std::size_t size) noexcept
+{
+    if constexpr (nr::isArenaPoisoningEnabled())
+        std::memset(data, static_cast<int>(arenaReleasedPattern), size);
+#if defined(NR_ARENA_ASAN)
+    ASAN_POISON_MEMORY_REGION(data, size);
+#endif
+}
+
+inline void arenaUnpoison(void *data, std::size_t size) noexcept
+{
+#if defined(NR_ARENA_ASAN)
+    ASAN_UNPOISON_MEMORY_REGION(data, size);
+#endif
+    if constexpr (nr::isArenaPoisoningEnabled())
+        std::memset(data, static_cast<int>(arenaFreshPattern), size);
+}
+
+inline std::size_t alignOffset(std::byte const *base, std::size_t offset, std::size_t alignment) noexcept
+{
+    const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(base) + offset;
+    return offset + ((alignment - address % alignment) % alignment);
+}
+
+} // namespace detail
+
+export namespace nr
+{
+
+// Bump allocator over a list of blocks taken from `upstream`. Allocation is a pointer bump, deallocation does not
+// exist: rewind() to a mark() or reset() releases everything allocated since at once. Blocks are kept across resets,
+// so an arena that has seen its peak frame never touches the heap again. Single-threaded.
+class LinearArena
+{
+  public:
+    struct Marker
+    {
+        std::size_t block = 0;
+        std::size_t offset = 0;
+        std::size_t used = 0;
+    };
+
+    explicit LinearArena(std::size_t blockSize = 64u << 10, std::pmr::memory_resource *upstream = std::pmr::new_delete_resource()) : blockSize(blockSize), upstream(upstream)
+    {
+    }
+    LinearArena(const LinearArena &) = delete;
+    LinearArena &operator=(const LinearArena &) = delete;
+    ~LinearArena()
+    {
+        for (Block const &block : blocks)
+        {
+#if defined(NR_ARENA_ASAN)
+            ASAN_UNPOISON_MEMORY_REGION(block.data, block.size);
+#endif
+            upstream->deallocate(block.data, block.size, blockAlignment);
+        }
+    }
+
+    [[nodiscard]] void *allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t))
+    {
+        while (true)
+        {
+            if (current == blocks.size())
+            {
+                const std::size_t size = std::max(blockSize, bytes + alignment);
+                blocks.push_back({static_cast<std::byte *>(upstream->allocate(size, blockAlignment)), size});
+                detail::arenaPoison(blocks.back().data, size);
+            }
+            Block const &block = blocks[current];
+            const std::size_t begin = detail::alignOffset(block.data, offset, alignment);
+            if (begin + bytes <= block.size)
+            {
+                used += begin + bytes - offset;
+                offset = begin + bytes;
+                highWater = std::max(highWater, used);
+                ++allocations;
+                detail::arenaUnpoison(block.data + begin, bytes);
+                return block.data + begin;
+            }
+            // the rest of this block is wasted until the next rewind
+            ++current;
+            offset = 0;
+        }
+    }
+    template <typename T> [[nodiscard]] std::span<T> allocateArray(std::size_t count)
+    {
+        return {static_cast<T *>(allocate(count * sizeof(T), alignof(T))), count};
+    }
+
+    [[nodiscard]] Marker mark() const
+    {
+        return {current, offset, used};
+    }
+    // releases everything allocated after `marker`
+    void rewind(Marker marker)
+    {
+        for (std::size_t i = marker.block; i <= current && i < blocks.size(); ++i)
+        {
+            const std::size_t begin = i == marker.block ? marker.offset : 0;
+            const std::size_t end = i == current ? offset : blocks[i].size;
+            if (end > begin)
+                detail::arenaPoison(blocks[i].data + begin, end - begin);
+        }
+        current = marker.block;
+        offset = marker.offset;
+        used = marker.used;
+    }
+    void reset()
+    {
+        rewind({});
+    }
+
+    [[nodiscard]] ArenaStatistics statistics() const
+    {
+        std::size_t capacity = 0;
+        for (Block const &block : blocks)
+            capacity += block.size;
+        return {used, capacity, highWater, allocations, 0};
+    }
+
+  private:
+    static constexpr std::size_t blockAlignment = 64;
+
+    struct Block
+    {
+        std::byte *data;
+        std::size_t size;
+    };
+
+    std::size_t blockSize;
+    std::pmr::memory_resource *upstream;
+    std::vector<Block> blocks;
+    std::size_t current = 0;
+    std::size_t offset = 0;
+    std::size_t used = 0;
+    std::size_t highWater = 0;
+    std::size_t allocations = 0;
+};
+
+// Two fixed buffers used alternately: beginFrame() flips to the other one and resets it, so memory allocated during
+// frame N stays valid through frame N + 1 (long enough for the recorder threads and a frame in flight to read it).
+// Any thread may allocate; a request is one compare-exchange on the current buffer. Requests that do not fit go to
+// the upstream resource and are freed at the buffer's next reset, and the overflow shows up in the statistics.
+class FrameAllocator
+{
+  public:
+    explicit FrameAllocator(std::size_t capacity = 8u << 20, std::pmr::memory_resource *upstream = std::pmr::new_delete_resource()) : upstream(upstream)
+    {
+        for (Buffer &buffer : buffers)
+        {
+            buffer.data = static_cast<std::byte *>(upstream->allocate(capacity, blockAlignment));
+            buffer.capacity = capacity;
+            detail::arenaPoison(buffer.data, capacity);
+        }
+    }
+    FrameAllocator(const FrameAllocator &) = delete;
+    FrameAllocator &operator=(const FrameAllocator &) = delete;
+    ~FrameAllocator()
+    {
+        for (Buffer &buffer : buffers)
+        {
+            releaseOverflow(buffer);
+#if defined(NR_ARENA_ASAN)
+            ASAN_UNPOISON_MEMORY_REGION(buffer.data, buffer.capacity);
+#endif
+            upstream->deallocate(buffer.data, buffer.capacity, blockAlignment);
+        }
+    }
+
+    // not thread-safe against allocate(); call it at the frame boundary
+    void beginFrame()
+    {
+        currentIndex ^= 1;
+        Buffer &buffer = buffers[currentIndex];
+        const std::size_t end = std::min(buffer.offset.load(std::memory_order_relaxed), buffer.capacity);
+        detail::arenaPoison(buffer.data, end);
+        buffer.offset.store(0, std::memory_order_relaxed);
+        buffer.allocations.store(0, std::memory_order_relaxed);
+        releaseOverflow(buffer);
+    }
+
+    [[nodiscard]] void *allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t))
+    {
+        // whole shadow granules per allocation, so concurrent unpoisoning never shares a shadow byte
+        alignment = std::max<std::size_t>(alignment, 8);
+        bytes = (bytes + 7) & ~std::size_t(7);
+        Buffer &buffer = buffers[currentIndex];
+        std::size_t begin = 0;
+        std::size_t previous = buffer.offset.load(std::memory_order_relaxed);
+        do
+        {
+            begin = detail::alignOffset(buffer.data, previous, alignment);
+            if (begin + bytes > buffer.capacity)
+                return allocateOverflow(buffer, bytes, alignment);
+        } while (!buffer.offset.compare_exchange_weak(previous, begin + bytes, std::memory_order_relaxed));
+        buffer.allocations.fetch_add(1, std::memory_order_relaxed);
+        std::size_t high = buffer.highWater.load(std::memory_order_relaxed);
+        while (begin + bytes > high && !buffer.highWater.compare_exchange_weak(high, begin + bytes, std::memory_order_relaxed))
+        {
+        }
+        detail::arenaUnpoison(buffer.data + begin, bytes);
+        return buffer.data + begin;
+    }
+
+    // the buffer allocations currently go to
+    [[nodiscard]] ArenaStatistics statistics() const
+    {
+        Buffer const &buffer = buffers[currentIndex];
+        std::scoped_lock lock(overflowMutex);
+        return {std::min(buffer.offset.load(std::memory_order_relaxed), buffer.capacity), buffer.capacity, std::max(buffers[0].highWater.load(), buffers[1].highWater.load()), buffer.allocations.load(std::memory_order_relaxed),
+                buffer.overflowBytes};
+    }
+
+  private:
+    static constexpr std::size_t blockAlignment = 64;
+
+    struct Overflow
+    {
+        void *data;
+        std::size_t bytes;
+        std::size_t alignment;
+    };
+    struct Buffer
+    {
+        std::byte *data = nullptr;
+        std::size_t capacity = 0;
+        std::atomic<std::size_t> offset = 0;
+        std::atomic<std::size_t> allocations = 0;
+        std::atomic<std::size_t> highWater = 0;
+        // guarded by overflowMutex
+        std::vector<Overflow> overflow;
+        std::size_t overflowBytes = 0;
+    };
+
+    void *allocateOverflow(Buffer &buffer, std::size_t bytes, std::size_t alignment)
+    {
+        void *data = upstream->allocate(bytes, alignment);
+        std::scoped_lock lock(overflowMutex);
+        buffer.overflow.push_back({data, bytes, alignment});
+        buffer.overflowBytes += bytes;
+        buffer.allocations.fetch_add(1, std::memory_order_relaxed);
+        return data;
+    }
+    void releaseOverflow(Buffer &buffer)
+    {
+        std::scoped_lock lock(overflowMutex);
+        if (buffer.overflowBytes > 0)
+            nrInfo(LogLevel::warning)("Frame allocator overflowed by {} bytes; raise its capacity above {} bytes.", buffer.overflowBytes, buffer.capacity);
+        for (Overflow const &o : buffer.overflow)
+            upstream->deallocate(o.data, o.bytes, o.alignment);
+        buffer.overflow.clear();
+        buffer.overflowBytes = 0;
+    }
+
+    std::pmr::memory_resource *upstream;
+    std::array<Buffer, 2> buffers;
+    std::uint32_t currentIndex = 0;
+    mutable std::mutex overflowMutex;
+};
+
+// std::pmr adapter for LinearArena and FrameAllocator: deallocation is a no-op, the arena releases memory in bulk
+template <typename Arena> class ArenaResource final : public std::pmr::memory_resource
+{
+  public:
+    explicit ArenaResource(Arena &arena) : arena(&arena)
+    {
+    }
+
+  private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        return arena->allocate(bytes, alignment);
+    }
+    void do_deallocate(void *, std::size_t, std::size_t) override
+    {
+    }
+    bool do_is_equal(std::pmr::memory_resource const &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    Arena *arena;
+};
+
+// per-thread arena for temporaries; reached through ScratchScope
+inline LinearArena &scratchArena()
+{
+    thread_local LinearArena arena(256u << 10);
+    return arena;
+}
+
+// Marks the thread's scratch arena and rewinds to the mark on destruction, so a function's temporaries (and those of
+// the scopes it opens in turn) vanish when it returns. A frame loop opening one per frame resets the arena each frame.
+// Containers built on resource() must not outlive the scope, so a function that returns a container allocated from a
+// caller's resource must not open a scope of its own: when both are the scratch arena, its rewind frees the result.
+class ScratchScope
+{
+  public:
+    ScratchScope() : arena(&scratchArena()), marker(arena->mark()), arenaResource(*arena)
+    {
+    }
+    ScratchScope(const ScratchScope &) = delete;
+    ScratchScope &operator=(const ScratchScope &) = delete;
+    ~ScratchScope()
+    {
+        arena->rewind(marker);
+    }
+
+    [[nodiscard]] std::pmr::memory_resource *resource()
+    {
+        return &arenaResource;
+    }
+    [[nodiscard]] LinearArena &linearArena()
+    {
+        return *arena;
+    }
+
+  private:
+    LinearArena *arena;
+    LinearArena::Marker marker;
+    ArenaResource<LinearArena> arenaResource;
+};
+
+// The shape of vkrhi's gather helpers - dedupe names through a set, collect pointers in a vector, plus a few hundred
+// small pushes - on std::allocator, the scratch arena and the frame allocator. Times are the median per round.
+inline void memoryBenchmark(std::uint32_t rounds = 31, std::uint32_t iterations = 2000)
+{
+    std::vector<std::string> names;
+    for (std::uint32_t i = 0; i < 48; ++i)
+        names.push_back(std::format("VK_KHR_extension_name_{:02}", (i * 7) % 32));
+
+    auto fill = [&](std::uint32_t it, auto &unique, auto &pointers, auto &values) {
+        for (std::string const &name : names)
+            unique.insert(name);
+        for (std::string_view name : unique)
+            pointers.push_back(name.data());
+        for (std::uint32_t v = 0; v < 256; ++v)
+            values.push_back(v ^ it);
+        return pointers.size() + values.back();
+    };
+    auto median = [&](auto &&iteration) {
+        std::vector<double> times;
+        std::size_t checksum = 0;
+        for (std::uint32_t r = 0; r < rounds; ++r)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            for (std::uint32_t it = 0; it < iterations; ++it)
+                checksum += iteration(it);
+            times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        std::ranges::nth_element(times, times.begin() + times.size() / 2);
+        return std::pair{times[times.size() / 2], checksum};
+    };
+
+    const auto [heap, heapChecksum] = median([&](std::uint32_t it) {
+        std::set<std::string_view> unique;
+        std::vector<char const *> pointers;
+        std::vector<std::uint32_t> values;
+        return fill(it, unique, pointers, values);
+    });
+    const auto [scratch, scratchChecksum] = median([&](std::uint32_t it) {
+        ScratchScope scope;
+        std::pmr::set<std::string_view> unique(scope.resource());
+        std::pmr::vector<char const *> pointers(scope.resource());
+        std::pmr::vector<std::uint32_t> values(scope.resource());
+        return fill(it, unique, pointers, values);
+    });
+    FrameAllocator frame(1u << 20);
+    ArenaResource<FrameAllocator> frameResource(frame);
+    const auto [framed, frameChecksum] = median([&](std::uint32_t it) {
+        frame.beginFrame();
+        std::pmr::set<std::string_view> unique(&frameResource);
+        std::pmr::vector<char const *> pointers(&frameResource);
+        std::pmr::vector<std::uint32_t> values(&frameResource);
+        return fill(it, unique, pointers, values);
+    });
+
+    const ArenaStatistics scratchStats = scratchArena().statistics();
+    const ArenaStatistics frameStats = frame.statistics();
+    nrInfo()("allocators, {} iterations of set + 2 vectors{}\n"
+             "  std::allocator   {:.3f} ms\n"
+             "  scratch arena    {:.3f} ms ({:.2f}x), high water {} of {} bytes\n"
+             "  frame allocator  {:.3f} ms ({:.2f}x), high water {} of {} bytes",
+             iterations, heapChecksum == scratchChecksum && heapChecksum == frameChecksum ? "" : " (MISMATCH)", heap, scratch, heap / scratch, scratchStats.highWater, scratchStats.capacity, framed, heap / framed, frameStats.highWater,
+             frameStats.capacity);
+}
+
+} // namespace nr
@@ -0,0 +1,786 @@
+module;
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+// MSVC accepts any intrinsic without /arch. GCC and Clang only allow them in functions compiled for the instruction set,
+// so there every lane operation carries a target attribute and each level is entered through a flattened function of
+// that target into which the whole kernel is inlined; the rest of the program keeps the baseline ISA. That inlining
+// needs an optimized build, so unoptimized builds and other targets get the scalar kernels.
+#if defined(_MSC_VER) && !defined(__clang__) && defined(_M_X64)
+#include <immintrin.h>
+#include <intrin.h>
+#define NR_SIMD_X64
+#define NR_SIMD_TARGET(isa)
+#define NR_SIMD_ENTRY(isa)
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__) && defined(__OPTIMIZE__)
+#include <immintrin.h>
+#define NR_SIMD_X64
+#define NR_SIMD_GNU
+#define NR_SIMD_TARGET(isa) __attribute__((target(isa)))
+#define NR_SIMD_ENTRY(isa) __attribute__((target(isa), flatten))
+#endif
+#if defined(NR_SIMD_GNU)
+#define NR_SIMD_KERNEL __attribute__((always_inline)) inline
+#else
+#define NR_SIMD_KERNEL
+#endif
+export module nr.utils:simd;
+import :logger;
+import :errorHandle;
+import std;
+
+export namespace nr
+{
+
+enum class SimdLevel
+{
+    scalar,
+    sse4,
+    // AVX2 + FMA
+    avx2,
+    avx512,
+    number
+};
+
+constexpr std::string_view simdLevelName(SimdLevel level)
+{
+    constexpr std::array<std::string_view, static_cast<size_t>(SimdLevel::number)> names{"scalar", "SSE4.1", "AVX2", "AVX-512"};
+    return names[static_cast<size_t>(level)];
+}
+
+// highest level both the CPU and the OS (saved register state) support
+inline SimdLevel detectSimdLevel()
+{
+#if defined(NR_SIMD_GNU)
+    // the runtime's CPU model also checks that the OS saves the wider register state
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SimdLevel::avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return SimdLevel::avx2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return SimdLevel::sse4;
+#elif defined(NR_SIMD_X64)
+    std::array<int, 4> regs{};
+    __cpuid(regs.data(), 0);
+    const int maxLeaf = regs[0];
+    __cpuid(regs.data(), 1);
+    const bool sse41 = (regs[2] & (1 << 19)) != 0;
+    const bool fma = (regs[2] & (1 << 12)) != 0;
+    const bool osxsave = (regs[2] & (1 << 27)) != 0;
+    const bool avx = (regs[2] & (1 << 28)) != 0;
+    const std::uint64_t xcr0 = osxsave ? _xgetbv(0) : 0;
+    std::array<int, 4> leaf7{};
+    if (maxLeaf >= 7)
+        __cpuidex(leaf7.data(), 7, 0);
+    const bool avx2 = (leaf7[1] & (1 << 5)) != 0;
+    const bool avx512f = (leaf7[1] & (1 << 16)) != 0;
+    // XMM|YMM state, plus opmask and both ZMM halves for AVX-512
+    if (avx512f && (xcr0 & 0xe6) == 0xe6)
+        return SimdLevel::avx512;
+    if (avx2 && fma && avx && (xcr0 & 0x6) == 0x6)
+        return SimdLevel::avx2;
+    if (sse41)
+        return SimdLevel::sse4;
+#endif
+    return SimdLevel::scalar;
+}
+
+template <typename T, std::size_t Alignment> struct AlignedAllocator
+{
+    using value_type = T;
+    template <typename U> struct rebind
+    {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(AlignedAllocator<U, Alignment> const &) noexcept
+    {
+    }
+    T *allocate(std::size_t n)
+    {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+    void deallocate(T *p, std::size_t) noexcept
+    {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+    template <typename U> bool operator==(AlignedAllocator<U, Alignment> const &) const noexcept
+    {
+        return true;
+    }
+};
+
+// Structure-of-arrays batch: component c of element i lives at component(c)[i]. Every component array starts on a
+// cache line and is padded with zeros to a multiple of 16 elements, so kernels run whole registers of any width with
+// aligned loads and no tail loop.
+template <std::size_t Components> class FloatBatch
+{
+  public:
+    static constexpr std::size_t components = Components;
+    static constexpr std::size_t padding = 16;
+
+    FloatBatch() = default;
+    explicit FloatBatch(std::size_t count)
+    {
+        resize(count);
+    }
+
+    void resize(std::size_t count)
+    {
+        elementCount = count;
+        componentStride = (count + padding - 1) / padding * padding;
+        storage.assign(componentStride * Components, 0.0f);
+    }
+    [[nodiscard]] std::size_t size() const
+    {
+        return elementCount;
+    }
+    // elements per component array including the padding; what the kernels iterate over
+    [[nodiscard]] std::size_t stride() const
+    {
+        return componentStride;
+    }
+    [[nodiscard]] float *component(std::size_t c)
+    {
+        return storage.data() + c * componentStride;
+    }
+    [[nodiscard]] float const *component(std::size_t c) const
+    {
+        return storage.data() + c * componentStride;
+    }
+    [[nodiscard]] float &operator()(std::size_t c, std::size_t i)
+    {
+        return storage[c * componentStride + i];
+    }
+    [[nodiscard]] float operator()(std::size_t c, std::size_t i) const
+    {
+        return storage[c * componentStride + i];
+    }
+
+  private:
+    std::size_t elementCount = 0;
+    std::size_t componentStride = 0;
+    std::vector<float, AlignedAllocator<float, 64>> storage;
+};
+
+using Float3Batch = FloatBatch<3>;
+using Float4Batch = FloatBatch<4>;
+// x, y, z, w
+using QuatBatch = FloatBatch<4>;
+// column-major like glm: component c * 4 + r is column c, row r
+using Float4x4Batch = FloatBatch<16>;
+
+struct AabbBatch
+{
+    Float3Batch center;
+    Float3Batch extent;
+
+    AabbBatch() = default;
+    explicit AabbBatch(std::size_t count) : center(count), extent(count)
+    {
+    }
+    [[nodiscard]] std::size_t size() const
+    {
+        return center.size();
+    }
+};
+
+inline glm::mat4 matrixAt(Float4x4Batch const &batch, std::size_t i)
+{
+    glm::mat4 m;
+    for (glm::length_t c = 0; c < 4; ++c)
+        for (glm::length_t r = 0; r < 4; ++r)
+            m[c][r] = batch(static_cast<std::size_t>(c * 4 + r), i);
+    return m;
+}
+inline void setMatrix(Float4x4Batch &batch, std::size_t i, glm::mat4 const &m)
+{
+    for (glm::length_t c = 0; c < 4; ++c)
+        for (glm::length_t r = 0; r < 4; ++r)
+            batch(static_cast<std::size_t>(c * 4 + r), i) = m[c][r];
+}
+template <std::size_t N> void setVector(FloatBatch<N> &batch, std::size_t i, glm::vec<static_cast<glm::length_t>(N), float> const &v)
+{
+    for (glm::length_t c = 0; c < static_cast<glm::length_t>(N); ++c)
+        batch(static_cast<std::size_t>(c), i) = v[c];
+}
+inline void setQuat(QuatBatch &batch, std::size_t i, glm::quat const &q)
+{
+    batch(0, i) = q.x;
+    batch(1, i) = q.y;
+    batch(2, i) = q.z;
+    batch(3, i) = q.w;
+}
+
+} // namespace nr
+
+namespace detail
+{
+
+// One register of floats and the handful of operations the kernels need. The kernels are written once against this
+// interface and instantiated per instruction set; ScalarLanes is the portable fallback. run() calls
+// f.template operator()<Lanes>() compiled for the instruction set and is the only way kernels are entered.
+struct ScalarLanes
+{
+    using V = float;
+    static constexpr std::size_t width = 1;
+    static V load(float const *p)
+    {
+        return *p;
+    }
+    static void store(float *p, V v)
+    {
+        *p = v;
+    }
+    static V set1(float f)
+    {
+        return f;
+    }
+    static V add(V a, V b)
+    {
+        return a + b;
+    }
+    static V sub(V a, V b)
+    {
+        return a - b;
+    }
+    static V mul(V a, V b)
+    {
+        return a * b;
+    }
+    static V fmadd(V a, V b, V c)
+    {
+        return a * b + c;
+    }
+    static V abs(V a)
+    {
+        return std::abs(a);
+    }
+    static V min(V a, V b)
+    {
+        return std::min(a, b);
+    }
+    // bit l set when lane l is >= 0
+    static std::uint32_t nonNegativeMask(V a)
+    {
+        return a >= 0.0f ? 1u : 0u;
+    }
+    static void finish()
+    {
+    }
+    template <typename F> static decltype(auto) run(F &&f)
+    {
+        return f.template operator()<ScalarLanes>();
+    }
+};
+
+#if defined(NR_SIMD_X64)
+struct Sse4Lanes
+{
+    using V = __m128;
+    static constexpr std::size_t width = 4;
+    NR_SIMD_TARGET("sse4.1") static V load(float const *p)
+    {
+        return _mm_load_ps(p);
+    }
+    NR_SIMD_TARGET("sse4.1") static void store(float *p, V v)
+    {
+        _mm_store_ps(p, v);
+    }
+    NR_SIMD_TARGET("sse4.1") static V set1(float f)
+    {
+        return _mm_set1_ps(f);
+    }
+    NR_SIMD_TARGET("sse4.1") static V add(V a, V b)
+    {
+        return _mm_add_ps(a, b);
+    }
+    NR_SIMD_TARGET("sse4.1") static V sub(V a, V b)
+    {
+        return _mm_sub_ps(a, b);
+    }
+    NR_SIMD_TARGET("sse4.1") static V mul(V a, V b)
+    {
+        return _mm_mul_ps(a, b);
+    }
+    NR_SIMD_TARGET("sse4.1") static V fmadd(V a, V b, V c)
+    {
+        return _mm_add_ps(_mm_mul_ps(a, b), c);
+    }
+    NR_SIMD_TARGET("sse4.1") static V abs(V a)
+    {
+        return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);
+    }
+    NR_SIMD_TARGET("sse4.1") static V min(V a, V b)
+    {
+        return _mm_min_ps(a, b);
+    }
+    NR_SIMD_TARGET("sse4.1") static std::uint32_t nonNegativeMask(V a)
+    {
+        return static_cast<std::uint32_t>(_mm_movemask_ps(_mm_cmpge_ps(a, _mm_setzero_ps())));
+    }
+    NR_SIMD_TARGET("sse4.1") static void finish()
+    {
+    }
+    template <typename F> NR_SIMD_ENTRY("sse4.1") static decltype(auto) run(F &&f)
+    {
+        return f.template operator()<Sse4Lanes>();
+    }
+};
+
+struct Avx2Lanes
+{
+    using V = __m256;
+    static constexpr std::size_t width = 8;
+    NR_SIMD_TARGET("avx2,fma") static V load(float const *p)
+    {
+        return _mm256_load_ps(p);
+    }
+    NR_SIMD_TARGET("avx2,fma") static void store(float *p, V v)
+    {
+        _mm256_store_ps(p, v);
+    }
+    NR_SIMD_TARGET("avx2,fma") static V set1(float f)
+    {
+        return _mm256_set1_ps(f);
+    }
+    NR_SIMD_TARGET("avx2,fma") static V add(V a, V b)
+    {
+        return _mm256_add_ps(a, b);
+    }
+    NR_SIMD_TARGET("avx2,fma") static V sub(V a, V b)
+    {
+        return _mm256_sub_ps(a, b);
+    }
+    NR_SIMD_TARGET("avx2,fma") static V mul(V a, V b)
+    {
+        return _mm256_mul_ps(a, b);
+    }
+    NR_SIMD_TARGET("avx2,fma") static V fmadd(V a, V b, V c)
+    {
+        return _mm256_fmadd_ps(a, b, c);
+    }
+    NR_SIMD_TARGET("avx2,fma") static V abs(V a)
+    {
+        return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);
+    }
+    NR_SIMD_TARGET("avx2,fma") static V min(V a, V b)
+    {
+        return _mm256_min_ps(a, b);
+    }
+    NR_SIMD_TARGET("avx2,fma") static std::uint32_t nonNegativeMask(V a)
+    {
+        return static_cast<std::uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_GE_OQ)));
+    }
+    // the rest of the program is SSE-encoded; avoid the transition penalty
+    NR_SIMD_TARGET("avx2,fma") static void finish()
+    {
+        _mm256_zeroupper();
+    }
+    template <typename F> NR_SIMD_ENTRY("avx2,fma") static decltype(auto) run(F &&f)
+    {
+        return f.template operator()<Avx2Lanes>();
+    }
+};
+
+struct Avx512Lanes
+{
+    using V = __m512;
+    static constexpr std::size_t width = 16;
+    NR_SIMD_TARGET("avx512f") static V load(float const *p)
+    {
+        return _mm512_load_ps(p);
+    }
+    NR_SIMD_TARGET("avx512f") static void store(float *p, V v)
+    {
+        _mm512_store_ps(p, v);
+    }
+    NR_SIMD_TARGET("avx512f") static V set1(float f)
+    {
+        return _mm512_set1_ps(f);
+    }
+    NR_SIMD_TARGET("avx512f") static V add(V a, V b)
+    {
+        return _mm512_add_ps(a, b);
+    }
+    NR_SIMD_TARGET("avx512f") static V sub(V a, V b)
+    {
+        return _mm512_sub_ps(a, b);
+    }
+    NR_SIMD_TARGET("avx512f") static V mul(V a, V b)
+    {
+        return _mm512_mul_ps(a, b);
+    }
+    NR_SIMD_TARGET("avx512f") static V fmadd(V a, V b, V c)
+    {
+        return _mm512_fmadd_ps(a, b, c);
+    }
+    NR_SIMD_TARGET("avx512f") static V abs(V a)
+    {
+        return _mm512_abs_ps(a);
+    }
+    NR_SIMD_TARGET("avx512f") static V min(V a, V b)
+    {
+        return _mm512_min_ps(a, b);
+    }
+    NR_SIMD_TARGET("avx512f") static std::uint32_t nonNegativeMask(V a)
+    {
+        return _mm512_cmp_ps_mask(a, _mm512_setzero_ps(), _CMP_GE_OQ);
+    }
+    NR_SIMD_TARGET("avx512f") static void finish()
+    {
+        _mm256_zeroupper();
+    }
+    template <typename F> NR_SIMD_ENTRY("avx512f") static decltype(auto) run(F &&f)
+    {
+        return f.template operator()<Avx512Lanes>();
+    }
+};
+#endif
+
+#if defined(NR_SIMD_GNU)
+// the kernels only ever run inlined into their instruction set's entry function, so no vector crosses a call there
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+// out = a * b per element; out may alias a or b
+template <typename L> NR_SIMD_KERNEL void multiplyKernel(float const *a, float const *b, float *out, std::size_t stride)
+{
+    using V = typename L::V;
+    for (std::size_t i = 0; i < stride; i += L::width)
+    {
+        V m[16];
+        for (std::size_t k = 0; k < 16; ++k)
+            m[k] = L::load(a + k * stride + i);
+        for (std::size_t c = 0; c < 4; ++c)
+        {
+            const V b0 = L::load(b + (c * 4 + 0) * stride + i);
+            const V b1 = L::load(b + (c * 4 + 1) * stride + i);
+            const V b2 = L::load(b + (c * 4 + 2) * stride + i);
+            const V b3 = L::load(b + (c * 4 + 3) * stride + i);
+            for (std::size_t r = 0; r < 4; ++r)
+                L::store(out + (c * 4 + r) * stride + i, L::fmadd(m[12 + r], b3, L::fmadd(m[8 + r], b2, L::fmadd(m[4 + r], b1, L::mul(m[r], b0)))));
+        }
+    }
+    L::finish();
+}
+
+// out = m * v with v.w taken from `in` (Components 4) or 1 (Components 3, points)
+template <typename L, std::size_t Components> NR_SIMD_KERNEL void transformKernel(float const *m, float const *in, float *out, std::size_t stride)
+{
+    using V = typename L::V;
+    for (std::size_t i = 0; i < stride; i += L::width)
+    {
+        const V x = L::load(in + i), y = L::load(in + stride + i), z = L::load(in + 2 * stride + i);
+        const V w = Components == 4 ? L::load(in + 3 * stride + i) : L::set1(1.0f);
+        V result[Components];
+        for (std::size_t r = 0; r < Components; ++r)
+            result[r] = L::fmadd(L::load(m + (12 + r) * stride + i), w, L::fmadd(L::load(m + (8 + r) * stride + i), z, L::fmadd(L::load(m + (4 + r) * stride + i), y, L::mul(L::load(m + r * stride + i), x))));
+        for (std::size_t r = 0; r < Components; ++r)
+            L::store(out + r * stride + i, result[r]);
+    }
+    L::finish();
+}
+
+// Arvo: the new center is the transformed center, the new half extent row r is sum_k |m[k][r]| * extent[k]
+template <typename L> NR_SIMD_KERNEL void transformAabbKernel(float const *m, float const *center, float const *extent, float *outCenter, float *outExtent, std::size_t stride)
+{
+    using V = typename L::V;
+    for (std::size_t i = 0; i < stride; i += L::width)
+    {
+        const V cx = L::load(center + i), cy = L::load(center + stride + i), cz = L::load(center + 2 * stride + i);
+        const V ex = L::load(extent + i), ey = L::load(extent + stride + i), ez = L::load(extent + 2 * stride + i);
+        V c[3], e[3];
+        for (std::size_t r = 0; r < 3; ++r)
+        {
+            const V m0 = L::load(m + r * stride + i), m1 = L::load(m + (4 + r) * stride + i), m2 = L::load(m + (8 + r) * stride + i);
+            c[r] = L::fmadd(m2, cz, L::fmadd(m1, cy, L::fmadd(m0, cx, L::load(m + (12 + r) * stride + i))));
+            e[r] = L::fmadd(L::abs(m2), ez, L::fmadd(L::abs(m1), ey, L::mul(L::abs(m0), ex)));
+        }
+        for (std::size_t r = 0; r < 3; ++r)
+        {
+            L::store(outCenter + r * stride + i, c[r]);
+            L::store(outExtent + r * stride + i, e[r]);
+        }
+    }
+    L::finish();
+}
+
+// translate * mat4_cast(q) * scale like glm, from unit quaternions; null t/s mean no translation/scale
+template <typename L> NR_SIMD_KERNEL void composeKernel(float const *t, float const *q, float const *s, float *out, std::size_t stride)
+{
+    using V = typename L::V;
+    const V one = L::set1(1.0f), two = L::set1(2.0f), zero = L::set1(0.0f);
+    for (std::size_t i = 0; i < stride; i += L::width)
+    {
+        const V x = L::load(q + i), y = L::load(q + stride + i), z = L::load(q + 2 * stride + i), w = L::load(q + 3 * stride + i);
+        const V xx = L::mul(x, x), yy = L::mul(y, y), zz = L::mul(z, z);
+        const V xy = L::mul(x, y), xz = L::mul(x, z), yz = L::mul(y, z);
+        const V wx = L::mul(w, x), wy = L::mul(w, y), wz = L::mul(w, z);
+        const V r[9]{
+            L::sub(one, L::mul(two, L::add(yy, zz))), L::mul(two, L::add(xy, wz)), L::mul(two, L::sub(xz, wy)), // column 0
+            L::mul(two, L::sub(xy, wz)), L::sub(one, L::mul(two, L::add(xx, zz))), L::mul(two, L::add(yz, wx)), // column 1
+            L::mul(two, L::add(xz, wy)), L::mul(two, L::sub(yz, wx)), L::sub(one, L::mul(two, L::add(xx, yy))), // column 2
+        };
+        for (std::size_t c = 0; c < 3; ++c)
+        {
+            const V scale = s ? L::load(s + c * stride + i) : one;
+            for (std::size_t row = 0; row < 3; ++row)
+                L::store(out + (c * 4 + row) * stride + i, L::mul(r[c * 3 + row], scale));
+            L::store(out + (c * 4 + 3) * stride + i, zero);
+        }
+        for (std::size_t row = 0; row < 3; ++row)
+            L::store(out + (12 + row) * stride + i, t ? L::load(t + row * stride + i) : zero);
+        L::store(out + 15 * stride + i, one);
+    }
+    L::finish();
+}
+
+#if defined(NR_SIMD_GNU)
+#pragma GCC diagnostic pop
+#endif
+
+struct SimdKernels
+{
+    void (*multiply)(float const *, float const *, float *, std::size_t);
+    void (*transformPoints)(float const *, float const *, float *, std::size_t);
+    void (*transform)(float const *, float const *, float *, std::size_t);
+    void (*transformAabbs)(float const *, float const *, float const *, float *, float *, std::size_t);
+    void (*compose)(float const *, float const *, float const *, float *, std::size_t);
+};
+
+template <typename L> constexpr SimdKernels makeSimdKernels()
+{
+    return {
+        [](float const *a, float const *b, float *out, std::size_t stride) { L::run([&]<typename>() { multiplyKernel<L>(a, b, out, stride); }); },
+        [](float const *m, float const *in, float *out, std::size_t stride) { L::run([&]<typename>() { transformKernel<L, 3>(m, in, out, stride); }); },
+        [](float const *m, float const *in, float *out, std::size_t stride) { L::run([&]<typename>() { transformKernel<L, 4>(m, in, out, stride); }); },
+        [](float const *m, float const *center, float const *extent, float *outCenter, float *outExtent, std::size_t stride) {
+            L::run([&]<typename>() { transformAabbKernel<L>(m, center, extent, outCenter, outExtent, stride); });
+        },
+        [](float const *t, float const *q, float const *s, float *out, std::size_t stride) { L::run([&]<typename>() { composeKernel<L>(t, q, s, out, stride); }); },
+    };
+}
+
+inline SimdKernels const &simdKernels(nr::SimdLevel level)
+{
+#if defined(NR_SIMD_X64)
+    static constexpr std::array<SimdKernels, 4> table{makeSimdKernels<ScalarLanes>(), makeSimdKernels<Sse4Lanes>(), makeSimdKernels<Avx2Lanes>(), makeSimdKernels<Avx512Lanes>()};
+    return table[static_cast<size_t>(level)];
+#else
+    static constexpr SimdKernels scalar = makeSimdKernels<ScalarLanes>();
+    static_cast<void>(level);
+    return scalar;
+#endif
+}
+
+// Calls f.template operator()<Lanes>() with the lane type of `level`, for kernels outside this partition; f is inlined
+// into the instruction set's entry function
+template <typename F> decltype(auto) dispatchLanes(nr::SimdLevel level, F &&f)
+{
+    static_cast<void>(level);
+#if defined(NR_SIMD_X64)
+    switch (level)
+    {
+    case nr::SimdLevel::avx512:
+        return Avx512Lanes::run(f);
+    case nr::SimdLevel::avx2:
+        return Avx2Lanes::run(f);
+    case nr::SimdLevel::sse4:
+        return Sse4Lanes::run(f);
+    default:
+        break;
+    }
+#endif
+    return ScalarLanes::run(f);
+}
+
+inline std::atomic<nr::SimdLevel> &selectedSimdLevel()
+{
+    static std::atomic<nr::SimdLevel> level = nr::detectSimdLevel();
+    return level;
+}
+
+inline SimdKernels const &activeSimdKernels()
+{
+    return simdKernels(selectedSimdLevel().load(std::memory_order_relaxed));
+}
+
+} // namespace detail
+
+export namespace nr
+{
+
+[[nodiscard]] inline SimdLevel simdLevel()
+{
+    return detail::selectedSimdLevel().load(std::memory_order_relaxed);
+}
+// caps the kernels used from now on (benchmarks, A/B checks); levels the CPU lacks fall back to the detected one
+inline void setSimdLevel(SimdLevel level)
+{
+    detail::selectedSimdLevel().store(std::min(level, detectSimdLevel()), std::memory_order_relaxed);
+}
+
+// All batch operations work element-wise on batches of equal size; `out` is resized to match and may alias an input.
+
+// out[i] = a[i] * b[i]
+inline void multiply(Float4x4Batch const &a, Float4x4Batch const &b, Float4x4Batch &out)
+{
+    if (a.size() != b.size())
+    {
+        nrInfo(LogLevel::error)("Batch sizes differ: {} and {}.", a.size(), b.size());
+        return;
+    }
+    if (out.size() != a.size())
+        out.resize(a.size());
+    detail::activeSimdKernels().multiply(a.component(0), b.component(0), out.component(0), a.stride());
+}
+
+// out[i] = (m[i] * vec4(in[i], 1)).xyz
+inline void transformPoints(Float4x4Batch const &m, Float3Batch const &in, Float3Batch &out)
+{
+    if (m.size() != in.size())
+    {
+        nrInfo(LogLevel::error)("Batch sizes differ: {} and {}.", m.size(), in.size());
+        return;
+    }
+    if (out.size() != in.size())
+        out.resize(in.size());
+    detail::activeSimdKernels().transformPoints(m.component(0), in.component(0), out.component(0), m.stride());
+}
+
+// out[i] = m[i] * in[i]
+inline void transform(Float4x4Batch const &m, Float4Batch const &in, Float4Batch &out)
+{
+    if (m.size() != in.size())
+    {
+        nrInfo(LogLevel::error)("Batch sizes differ: {} and {}.", m.size(), in.size());
+        return;
+    }
+    if (out.size() != in.size())
+        out.resize(in.size());
+    detail::activeSimdKernels().transform(m.component(0), in.component(0), out.component(0), m.stride());
+}
+
+// world-space bounds of local center/half-extent boxes under affine transforms
+inline void transformAabbs(Float4x4Batch const &m, AabbBatch const &in, AabbBatch &out)
+{
+    if (m.size() != in.size())
+    {
+        nrInfo(LogLevel::error)("Batch sizes differ: {} and {}.", m.size(), in.size());
+        return;
+    }
+    if (out.size() != in.size())
+        out = AabbBatch(in.size());
+    detail::activeSimdKernels().transformAabbs(m.component(0), in.center.component(0), in.extent.component(0), out.center.component(0), out.extent.component(0), m.stride());
+}
+
+// out[i] = mat4_cast(q[i]) for unit quaternions
+inline void quaternionsToMatrices(QuatBatch const &rotation, Float4x4Batch &out)
+{
+    if (out.size() != rotation.size())
+        out.resize(rotation.size());
+    detail::activeSimdKernels().compose(nullptr, rotation.component(0), nullptr, out.component(0), rotation.stride());
+}
+
+// out[i] = translate(t[i]) * mat4_cast(r[i]) * scale(s[i]), the per-instance local transform update
+inline void composeTransforms(Float3Batch const &translation, QuatBatch const &rotation, Float3Batch const &scale, Float4x4Batch &out)
+{
+    if (translation.size() != rotation.size() || rotation.size() != scale.size())
+    {
+        nrInfo(LogLevel::error)("Batch sizes differ: {}, {} and {}.", translation.size(), rotation.size(), scale.size());
+        return;
+    }
+    if (out.size() != rotation.size())
+        out.resize(rotation.size());
+    detail::activeSimdKernels().compose(translation.component(0), rotation.component(0), scale.component(0), out.component(0), rotation.stride());
+}
+
+// Transform update for `instances` objects (compose TRS, multiply by a parent, transform the local AABB) at every
+// supported level, against the same work as a plain glm loop over AoS data. The largest difference to glm is checked so
+// a broken kernel doesn't report a good time.
+inline void simdMathBenchmark(std::size_t instances = 100000, std::uint32_t iterations = 50)
+{
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<glm::vec3> translations(instances), scales(instances), centers(instances), extents(instances);
+    std::vector<glm::quat> rotations(instances);
+    std::vector<glm::mat4> parents(instances);
+    Float3Batch translation(instances), scale(instances);
+    QuatBatch rotation(instances);
+    Float4x4Batch parent(instances);
+    AabbBatch local(instances);
+    for (std::size_t i = 0; i < instances; ++i)
+    {
+        translations[i] = glm::vec3(unit(rng), unit(rng), unit(rng)) * 100.0f;
+        scales[i] = glm::vec3(unit(rng), unit(rng), unit(rng)) + 1.5f;
+        rotations[i] = glm::normalize(glm::quat(unit(rng), unit(rng), unit(rng), unit(rng)));
+        parents[i] = glm::translate(glm::mat4(1.0f), glm::vec3(unit(rng), unit(rng), unit(rng)) * 10.0f);
+        centers[i] = glm::vec3(unit(rng), unit(rng), unit(rng));
+        extents[i] = glm::vec3(unit(rng), unit(rng), unit(rng)) + 1.0f;
+        setVector(translation, i, translations[i]);
+        setVector(scale, i, scales[i]);
+        setQuat(rotation, i, rotations[i]);
+        setMatrix(parent, i, parents[i]);
+        setVector(local.center, i, centers[i]);
+        setVector(local.extent, i, extents[i]);
+    }
+
+    auto timeNs = [&](auto &&body) {
+        body();
+        const auto start = std::chrono::steady_clock::now();
+        for (std::uint32_t it = 0; it < iterations; ++it)
+            body();
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (static_cast<double>(iterations) * static_cast<double>(instances));
+    };
+
+    std::vector<glm::mat4> worlds(instances);
+    std::vector<glm::vec3> worldCenters(instances), worldExtents(instances);
+    const double glmNs = timeNs([&] {
+        for (std::size_t i = 0; i < instances; ++i)
+        {
+            const glm::mat4 localMatrix = glm::scale(glm::translate(glm::mat4(1.0f), translations[i]) * glm::mat4_cast(rotations[i]), scales[i]);
+            worlds[i] = parents[i] * localMatrix;
+            const glm::mat3 linear(worlds[i]);
+            worldCenters[i] = glm::vec3(worlds[i] * glm::vec4(centers[i], 1.0f));
+            worldExtents[i] = glm::vec3(0.0f);
+            for (glm::length_t k = 0; k < 3; ++k)
+                worldExtents[i] += glm::abs(linear[k]) * extents[i][k];
+        }
+    });
+    std::string text = std::format("simd math, {} instances (compose + parent multiply + AABB), detected {}\n  glm AoS loop : {:.2f} ns/instance", instances, simdLevelName(detectSimdLevel()), glmNs);
+
+    const SimdLevel previous = simdLevel();
+    Float4x4Batch world;
+    AabbBatch bounds;
+    for (SimdLevel level = SimdLevel::scalar; level <= detectSimdLevel(); level = static_cast<SimdLevel>(static_cast<int>(level) + 1))
+    {
+        setSimdLevel(level);
+        const double ns = timeNs([&] {
+            composeTransforms(translation, rotation, scale, world);
+            multiply(parent, world, world);
+            transformAabbs(world, local, bounds);
+        });
+        float maxError = 0.0f;
+        for (std::size_t i = 0; i < instances; ++i)
+        {
+            const glm::mat4 m = matrixAt(world, i);
+            for (glm::length_t c = 0; c < 4; ++c)
+                for (glm::length_t r = 0; r < 4; ++r)
+                    maxError = std::max(maxError, std::abs(m[c][r] - worlds[i][c][r]));
+            for (glm::length_t r = 0; r < 3; ++r)
+            {
+                maxError = std::max(maxError, std::abs(bounds.center(static_cast<std::size_t>(r), i) - worldCenters[i][r]));
+                maxError = std::max(maxError, std::abs(bounds.extent(static_cast<std::size_t>(r), i) - worldExtents[i][r]));
+            }
+        }
+        text += std::format("\n  {:<13}: {:.2f} ns/instance, {:.2f}x glm, max error {:.2e}", simdLevelName(level), ns, glmNs / ns, maxError);
+    }
+    setSimdLevel(previous);
+    nrInfo()("{}", text);
+}
+
+} // namespace nr
@@ -1,5 +1,6 @@
 module;
 export module nr.utils:staticUtils;
+import std;
 
 export namespace nr
 {
@@ -12,4 +13,16 @@ consteval bool isDebugMode()
 #endif
 }
 
-} // namespace nr
\ No newline at end of file
+// FNV-1a, used to checksum and key on-disk caches
+constexpr std::uint64_t fnv1a64(std::span<const std::byte> data, std::uint64_t seed = 0xcbf29ce484222325ull)
+{
+    std::uint64_t hash = seed;
+    for (std::byte b : data)
+    {
+        hash ^= static_cast<std::uint64_t>(b);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+} // namespace nr
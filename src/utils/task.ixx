@@ -0,0 +1,270 @@
+module;
+export module nr.utils:task;
+import :jobs;
+import std;
+
+export namespace nr
+{
+template <typename T = void> class Task;
+} // namespace nr
+
+namespace detail
+{
+
+struct TaskPromiseBase
+{
+    // resumed by symmetric transfer when the task finishes, so a chain of awaits never grows the stack
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+        template <typename Promise> std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) const noexcept
+        {
+            return handle.promise().continuation;
+        }
+        void await_resume() const noexcept
+        {
+        }
+    };
+
+    std::suspend_always initial_suspend() const noexcept
+    {
+        return {};
+    }
+    FinalAwaiter final_suspend() const noexcept
+    {
+        return {};
+    }
+    void unhandled_exception() noexcept
+    {
+        error = std::current_exception();
+    }
+
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr error;
+};
+
+template <typename T> struct TaskPromise : TaskPromiseBase
+{
+    nr::Task<T> get_return_object() noexcept;
+    template <typename U = T> void return_value(U &&result)
+    {
+        value.emplace(std::forward<U>(result));
+    }
+    T result()
+    {
+        if (error)
+            std::rethrow_exception(error);
+        return std::move(*value);
+    }
+
+    std::optional<T> value;
+};
+
+template <> struct TaskPromise<void> : TaskPromiseBase
+{
+    nr::Task<void> get_return_object() noexcept;
+    void return_void() const noexcept
+    {
+    }
+    void result() const
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+
+// Fire-and-forget coroutine frame: starts immediately and frees itself at the end. Only used to bridge a Task to
+// something that is not a coroutine, the body must not throw.
+struct DetachedTask
+{
+    struct promise_type
+    {
+        DetachedTask get_return_object() const noexcept
+        {
+            return {};
+        }
+        std::suspend_never initial_suspend() const noexcept
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() const noexcept
+        {
+            return {};
+        }
+        void return_void() const noexcept
+        {
+        }
+        void unhandled_exception() const noexcept
+        {
+            std::terminate();
+        }
+    };
+};
+
+} // namespace detail
+
+export namespace nr
+{
+
+// Lazily started coroutine producing a T. Nothing runs until the task is awaited (or handed to syncWait()); the
+// awaiting coroutine is resumed on whichever thread the task finishes on, and exceptions thrown inside the task are
+// rethrown from the co_await. Tasks are move-only and own their frame.
+template <typename T> class [[nodiscard]] Task
+{
+  public:
+    using promise_type = detail::TaskPromise<T>;
+
+    Task() = default;
+    explicit Task(std::coroutine_handle<promise_type> coroutine) : handle(coroutine)
+    {
+    }
+    Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr))
+    {
+    }
+    Task &operator=(Task &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    [[nodiscard]] bool done() const
+    {
+        return !handle || handle.done();
+    }
+
+    auto operator co_await() noexcept
+    {
+        struct Awaiter
+        {
+            std::coroutine_handle<promise_type> handle;
+            bool await_ready() const noexcept
+            {
+                return !handle || handle.done();
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) const noexcept
+            {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+            T await_resume() const
+            {
+                return handle.promise().result();
+            }
+        };
+        return Awaiter{handle};
+    }
+
+    // runs the task to completion without retrieving the result, so the caller decides when an exception surfaces
+    auto whenReady() noexcept
+    {
+        struct Awaiter
+        {
+            std::coroutine_handle<promise_type> handle;
+            bool await_ready() const noexcept
+            {
+                return !handle || handle.done();
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) const noexcept
+            {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+            void await_resume() const noexcept
+            {
+            }
+        };
+        return Awaiter{handle};
+    }
+
+    // result of a finished task; rethrows its exception
+    T result()
+    {
+        return handle.promise().result();
+    }
+
+  private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Moves the awaiting coroutine onto a worker of `jobs`. Awaiting it from a worker requeues the coroutine behind the
+// work already there, which is how a long task yields.
+inline auto resumeOn(JobSystem &jobs = JobSystem::instance())
+{
+    struct Awaiter
+    {
+        JobSystem *system;
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> awaiting) const
+        {
+            system->post([awaiting] { awaiting.resume(); });
+        }
+        void await_resume() const noexcept
+        {
+        }
+    };
+    return Awaiter{&jobs};
+}
+
+// Blocks until `task` has finished and returns its result. The calling thread runs other jobs meanwhile, so this is
+// safe from a worker as well, but it belongs at the edges: coroutines should co_await instead.
+template <typename T> T syncWait(Task<T> task, JobSystem &jobs = JobSystem::instance())
+{
+    JobCounter counter;
+    JobSystem::retain(counter);
+    [](Task<T> &t, JobCounter &c) -> detail::DetachedTask {
+        co_await t.whenReady();
+        JobSystem::release(c);
+    }(task, counter);
+    jobs.wait(counter);
+    return task.result();
+}
+
+// Reads a whole file on a worker; the awaiting coroutine continues on that worker once the bytes are in memory.
+inline Task<std::vector<std::byte>> readFile(std::filesystem::path path, JobSystem &jobs = JobSystem::instance())
+{
+    co_await resumeOn(jobs);
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+        throw std::runtime_error(std::format("Failed to open {}.", path.string()));
+    const std::streamoff size = file.tellg();
+    if (size < 0)
+        throw std::runtime_error(std::format("Failed to get the size of {}.", path.string()));
+    std::vector<std::byte> bytes(static_cast<std::size_t>(size));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char *>(bytes.data()), static_cast<std::streamsize>(bytes.size())))
+        throw std::runtime_error(std::format("Failed to read {}.", path.string()));
+    co_return bytes;
+}
+
+} // namespace nr
+
+namespace detail
+{
+
+template <typename T> nr::Task<T> TaskPromise<T>::get_return_object() noexcept
+{
+    return nr::Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline nr::Task<void> TaskPromise<void>::get_return_object() noexcept
+{
+    return nr::Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+} // namespace detail
@@ -0,0 +1,467 @@
+module;
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define NR_TRACE_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define NR_TRACE_TSC
+#endif
+export module nr.utils:trace;
+import :errorHandle;
+import std;
+
+export namespace nr
+{
+// NR_TRACE_DISABLED (CMake option NR_ENABLE_TRACE=OFF) compiles every zone down to an empty object
+consteval bool isTraceEnabled()
+{
+#if defined(NR_TRACE_DISABLED)
+    return false;
+#else
+    return true;
+#endif
+}
+} // namespace nr
+
+namespace detail
+{
+
+// one closed zone; the name and the source location point at static strings, so nothing is copied on the hot path
+struct TraceEvent
+{
+    std::uint64_t begin;
+    std::uint64_t end;
+    const char *name;
+    std::source_location loc;
+};
+
+// TSC where available, steady_clock ticks otherwise; the session converts either through its calibration
+inline std::uint64_t traceTimestamp() noexcept
+{
+#if defined(NR_TRACE_TSC)
+    return __rdtsc();
+#else
+    return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+#if defined(_MSC_VER)
+#pragma warning(push)
+// the counters are padded to their own cache lines on purpose
+#pragma warning(disable : 4324)
+#endif
+// Single-producer single-consumer ring: the owning thread pushes, the session's flusher drains. A full ring drops the
+// event instead of waiting, so a slow disk never stalls the traced code.
+struct TraceBuffer
+{
+    static constexpr std::uint64_t capacity = 1 << 14;
+
+    alignas(64) std::atomic<std::uint64_t> head = 0;
+    // producer-side copy of tail, refreshed only when the ring looks full
+    std::uint64_t cachedTail = 0;
+    std::atomic<std::uint64_t> dropped = 0;
+    alignas(64) std::atomic<std::uint64_t> tail = 0;
+    alignas(64) std::array<TraceEvent, capacity> events;
+
+    // owned by the registry mutex
+    bool inUse = false;
+    std::uint32_t threadIndex = 0;
+    std::string threadName;
+
+    void push(TraceEvent const &event) noexcept
+    {
+        const std::uint64_t h = head.load(std::memory_order_relaxed);
+        if (h - cachedTail >= capacity)
+        {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (h - cachedTail >= capacity)
+            {
+                dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        events[h & (capacity - 1)] = event;
+        head.store(h + 1, std::memory_order_release);
+    }
+    bool drained() const noexcept
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+};
+#if defined(_MSC_VER)
+#pragma warning(pop)
+#endif
+
+// Buffers live as long as the process. A thread takes one on its first zone and hands it back when it exits; the next
+// new thread reuses it once the flusher has drained it, so short-lived threads don't grow memory.
+class TraceRegistry
+{
+  public:
+    static TraceRegistry &instance()
+    {
+        static TraceRegistry registry;
+        return registry;
+    }
+
+    TraceBuffer *acquire()
+    {
+        std::scoped_lock lock(mutex);
+        auto it = std::ranges::find_if(buffers, [](auto const &b) { return !b->inUse && b->drained(); });
+        if (it == buffers.end())
+            it = buffers.insert(buffers.end(), std::make_unique<TraceBuffer>());
+        TraceBuffer &buffer = **it;
+        buffer.inUse = true;
+        buffer.threadIndex = nextThreadIndex++;
+        buffer.threadName.clear();
+        return &buffer;
+    }
+    void release(TraceBuffer *buffer)
+    {
+        std::scoped_lock lock(mutex);
+        buffer->inUse = false;
+    }
+    void setThreadName(TraceBuffer *buffer, std::string_view name)
+    {
+        std::scoped_lock lock(mutex);
+        buffer->threadName = name;
+    }
+    template <typename F> void forEach(F &&f)
+    {
+        std::scoped_lock lock(mutex);
+        for (auto &buffer : buffers)
+            f(*buffer);
+    }
+
+  private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+    std::uint32_t nextThreadIndex = 0;
+};
+
+struct TraceThread
+{
+    TraceBuffer *buffer = nullptr;
+    ~TraceThread()
+    {
+        if (buffer)
+            TraceRegistry::instance().release(buffer);
+    }
+};
+thread_local TraceThread traceThread;
+
+inline TraceBuffer &threadTraceBuffer()
+{
+    if (!traceThread.buffer) [[unlikely]]
+        traceThread.buffer = TraceRegistry::instance().acquire();
+    return *traceThread.buffer;
+}
+
+// set while a TraceSession exists; zones outside a session only pay for this relaxed load
+inline std::atomic<bool> traceRecording = false;
+
+// a zone timed by another clock (GPU timestamps) and already placed on steady_clock; names are copied, unlike TraceEvent
+struct ExternalTraceEvent
+{
+    std::string track;
+    std::string name;
+    std::chrono::steady_clock::time_point begin;
+    std::chrono::steady_clock::time_point end;
+};
+
+// filled from any thread, drained by the session's flusher
+struct ExternalTraceQueue
+{
+    static constexpr std::size_t capacity = 1 << 16;
+
+    static ExternalTraceQueue &instance()
+    {
+        static ExternalTraceQueue queue;
+        return queue;
+    }
+
+    std::mutex mutex;
+    std::vector<ExternalTraceEvent> events;
+    std::uint64_t dropped = 0;
+};
+
+} // namespace detail
+
+export namespace nr
+{
+
+template <bool Enabled> class BasicTraceZone;
+
+template <> class BasicTraceZone<false>
+{
+  public:
+    BasicTraceZone(const char *, std::source_location) noexcept
+    {
+    }
+    BasicTraceZone(const BasicTraceZone &) = delete;
+    BasicTraceZone &operator=(const BasicTraceZone &) = delete;
+};
+
+// Costs two timestamps and one ring write while a session records, one relaxed load otherwise. A zone that is still
+// open when its session ends is dropped.
+template <> class BasicTraceZone<true>
+{
+  public:
+    BasicTraceZone(const char *name, std::source_location loc) noexcept : name(name), loc(loc), begin(detail::traceRecording.load(std::memory_order_relaxed) ? detail::traceTimestamp() : 0)
+    {
+    }
+    BasicTraceZone(const BasicTraceZone &) = delete;
+    BasicTraceZone &operator=(const BasicTraceZone &) = delete;
+    ~BasicTraceZone()
+    {
+        if (begin && detail::traceRecording.load(std::memory_order_relaxed))
+        {
+            const std::uint64_t end = detail::traceTimestamp();
+            detail::threadTraceBuffer().push({begin, end, name, loc});
+        }
+    }
+
+  private:
+    const char *name;
+    std::source_location loc;
+    std::uint64_t begin;
+};
+
+using TraceZone = BasicTraceZone<isTraceEnabled()>;
+
+// `auto zone = nrZone();` traces the enclosing scope under the calling function's name. `name` must be a string with
+// static storage duration (a literal); events keep the pointer, not a copy.
+[[nodiscard]] inline TraceZone nrZone(const char *name = nullptr, std::source_location loc = std::source_location::current())
+{
+    return TraceZone(name, loc);
+}
+
+// label for the calling thread in the trace viewer
+inline void setTraceThreadName(std::string_view name)
+{
+    if constexpr (isTraceEnabled())
+        detail::TraceRegistry::instance().setThreadName(&detail::threadTraceBuffer(), name);
+}
+
+// Adds a zone timed elsewhere, such as a pair of GPU timestamps placed on steady_clock, to the recording session.
+// Each `track` is its own process row beside the CPU threads. Any thread; a no-op while no session records.
+inline void traceExternalZone(std::string_view track, std::string_view name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+{
+    if constexpr (isTraceEnabled())
+    {
+        if (!detail::traceRecording.load(std::memory_order_relaxed))
+            return;
+        detail::ExternalTraceQueue &queue = detail::ExternalTraceQueue::instance();
+        std::scoped_lock lock(queue.mutex);
+        if (queue.events.size() < detail::ExternalTraceQueue::capacity)
+            queue.events.push_back({std::string(track), std::string(name), begin, end});
+        else
+            ++queue.dropped;
+    }
+}
+
+// Records zones from every thread while it lives and streams them to `path` as Chrome trace JSON (chrome://tracing,
+// ui.perfetto.dev). A background thread drains the per-thread rings every `flushInterval`; the rings hold 16k events
+// per thread, so the interval only has to be short enough that no thread closes more zones than that in between.
+// Timestamp ticks are converted to microseconds with a rate measured against steady_clock on the first flush.
+class TraceSession
+{
+  public:
+    explicit TraceSession(std::filesystem::path const &path, std::chrono::milliseconds flushInterval = std::chrono::milliseconds(50)) : path(path), flushInterval(flushInterval)
+    {
+        if constexpr (!isTraceEnabled())
+        {
+            nrInfo(LogLevel::warning)("Tracing is compiled out (NR_TRACE_DISABLED); {} will not be written.", path.string());
+        }
+        else
+        {
+            nrAssert(!detail::traceRecording.load())("Only one TraceSession can record at a time.");
+            out.open(path, std::ios::binary | std::ios::trunc);
+            if (!out)
+            {
+                nrInfo(LogLevel::warning)("Cannot open trace file {}.", path.string());
+                return;
+            }
+            out << R"({"displayTimeUnit":"ns","traceEvents":[{"name":"process_name","ph":"M","pid":0,"args":{"name":"CPU"}})";
+            firstEvent = false;
+            // events left behind by zones that outlived an earlier session
+            detail::TraceRegistry::instance().forEach([](detail::TraceBuffer &buffer) { buffer.tail.store(buffer.head.load(std::memory_order_acquire), std::memory_order_release); });
+            {
+                detail::ExternalTraceQueue &queue = detail::ExternalTraceQueue::instance();
+                std::scoped_lock lock(queue.mutex);
+                queue.events.clear();
+                queue.dropped = 0;
+            }
+            originTicks = detail::traceTimestamp();
+            originTime = std::chrono::steady_clock::now();
+            detail::traceRecording.store(true, std::memory_order_release);
+            flusher = std::jthread([this](std::stop_token stop) { run(stop); });
+        }
+    }
+    TraceSession(const TraceSession &) = delete;
+    TraceSession &operator=(const TraceSession &) = delete;
+    ~TraceSession()
+    {
+        if (!flusher.joinable())
+            return;
+        detail::traceRecording.store(false, std::memory_order_release);
+        flusher.request_stop();
+        flusher.join();
+        out << "]}\n";
+        out.close();
+        std::uint64_t dropped = 0;
+        detail::TraceRegistry::instance().forEach([&](detail::TraceBuffer &buffer) { dropped += buffer.dropped.exchange(0, std::memory_order_relaxed); });
+        {
+            detail::ExternalTraceQueue &queue = detail::ExternalTraceQueue::instance();
+            std::scoped_lock lock(queue.mutex);
+            dropped += std::exchange(queue.dropped, 0);
+        }
+        if (dropped)
+            nrInfo(LogLevel::warning)("trace: {} events dropped on full rings; shorten the flush interval.", dropped);
+        nrInfo()("trace: {} events written to {}", written, path.string());
+    }
+
+  private:
+    void run(std::stop_token stop)
+    {
+        std::mutex waitMutex;
+        std::condition_variable_any wake;
+        while (!stop.stop_requested())
+        {
+            std::unique_lock lock(waitMutex);
+            wake.wait_for(lock, stop, flushInterval, [] { return false; });
+            lock.unlock();
+            flush();
+        }
+        flush();
+    }
+
+    void calibrate()
+    {
+        // at least a millisecond between the two samples keeps the rate error well below one percent
+        std::this_thread::sleep_until(originTime + std::chrono::milliseconds(1));
+        const std::uint64_t ticks = detail::traceTimestamp();
+        const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - originTime).count();
+        ticksPerUs = static_cast<double>(ticks - originTicks) / us;
+    }
+
+    void flush()
+    {
+        if (ticksPerUs == 0.0)
+            calibrate();
+        std::string text;
+        detail::TraceRegistry::instance().forEach([&](detail::TraceBuffer &buffer) {
+            if (!buffer.threadName.empty() && namedThreads.insert(buffer.threadIndex).second)
+            {
+                separator(text);
+                text += std::format(R"({{"name":"thread_name","ph":"M","pid":0,"tid":{},"args":{{"name":")", buffer.threadIndex);
+                appendEscaped(text, buffer.threadName);
+                text += "\"}}";
+            }
+            const std::uint64_t head = buffer.head.load(std::memory_order_acquire);
+            std::uint64_t tail = buffer.tail.load(std::memory_order_relaxed);
+            for (; tail != head; ++tail)
+            {
+                detail::TraceEvent const &event = buffer.events[tail & (detail::TraceBuffer::capacity - 1)];
+                // a zone opened under an earlier session and closed after this one started
+                if (event.begin < originTicks)
+                    continue;
+                separator(text);
+                text += R"({"name":")";
+                appendEscaped(text, event.name ? event.name : event.loc.function_name());
+                text += std::format(R"(","cat":"cpu","ph":"X","pid":0,"tid":{},"ts":{:.3f},"dur":{:.3f},"args":{{"file":")", buffer.threadIndex, static_cast<double>(event.begin - originTicks) / ticksPerUs,
+                                    static_cast<double>(event.end - event.begin) / ticksPerUs);
+                appendEscaped(text, event.loc.file_name());
+                text += std::format(R"(","line":{}}}}})", event.loc.line());
+                ++written;
+            }
+            buffer.tail.store(tail, std::memory_order_release);
+        });
+
+        std::vector<detail::ExternalTraceEvent> external;
+        {
+            detail::ExternalTraceQueue &queue = detail::ExternalTraceQueue::instance();
+            std::scoped_lock lock(queue.mutex);
+            external.swap(queue.events);
+        }
+        for (detail::ExternalTraceEvent const &event : external)
+        {
+            if (event.begin < originTime)
+                continue;
+            auto [track, added] = tracks.try_emplace(event.track, static_cast<std::uint32_t>(tracks.size() + 1));
+            if (added)
+            {
+                separator(text);
+                text += std::format(R"({{"name":"process_name","ph":"M","pid":{},"args":{{"name":")", track->second);
+                appendEscaped(text, event.track);
+                text += "\"}}";
+            }
+            separator(text);
+            text += R"({"name":")";
+            appendEscaped(text, event.name);
+            text += std::format(R"(","ph":"X","pid":{},"tid":0,"ts":{:.3f},"dur":{:.3f}}})", track->second, std::chrono::duration<double, std::micro>(event.begin - originTime).count(),
+                                std::chrono::duration<double, std::micro>(event.end - event.begin).count());
+            ++written;
+        }
+        out << text;
+        out.flush();
+    }
+
+    void separator(std::string &text)
+    {
+        if (!std::exchange(firstEvent, false))
+            text += ',';
+    }
+    static void appendEscaped(std::string &text, std::string_view value)
+    {
+        for (char c : value)
+        {
+            if (c == '"' || c == '\\')
+                text += '\\';
+            text += c;
+        }
+    }
+
+    std::filesystem::path path;
+    std::chrono::milliseconds flushInterval;
+    std::ofstream out;
+    std::uint64_t originTicks = 0;
+    std::chrono::steady_clock::time_point originTime;
+    double ticksPerUs = 0.0;
+    bool firstEvent = true;
+    std::uint64_t written = 0;
+    std::set<std::uint32_t> namedThreads;
+    // pid of each external track; the CPU threads are pid 0
+    std::map<std::string, std::uint32_t, std::less<>> tracks;
+    std::jthread flusher;
+};
+
+// Per-zone cost with no session and with a recording one. Zones are opened in bursts of half a ring with a pause for
+// the flusher in between, so the numbers measure the zone, not the drop path.
+inline void traceBenchmark(std::filesystem::path const &path = "trace-benchmark.json")
+{
+    constexpr std::uint32_t bursts = 128;
+    constexpr std::uint32_t burstSize = static_cast<std::uint32_t>(detail::TraceBuffer::capacity / 2);
+    auto measure = [] {
+        std::chrono::steady_clock::duration total{};
+        for (std::uint32_t b = 0; b < bursts; ++b)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            for (std::uint32_t i = 0; i < burstSize; ++i)
+            {
+                auto zone = nrZone("benchmark");
+            }
+            total += std::chrono::steady_clock::now() - start;
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        return std::chrono::duration<double, std::nano>(total).count() / (bursts * burstSize);
+    };
+    const double idle = measure();
+    double recording = 0.0;
+    {
+        TraceSession session(path, std::chrono::milliseconds(1));
+        recording = measure();
+    }
+    nrInfo()("trace zone: {:.2f} ns without a session, {:.2f} ns recording ({})", idle, recording, isTraceEnabled() ? "enabled" : "compiled out");
+}
+
+} // namespace nr